@@ -0,0 +1,53 @@
+#ifndef AS_UTILS_AFFINITY_HPP
+#define AS_UTILS_AFFINITY_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <log4cpp/Category.hh>
+
+namespace asutils {
+
+  /**
+   * Helpers to pin threads to a set of cpus or to the cpus of a NUMA node.
+   * Linux places a page on the node of the thread that first touches it, so
+   * pinning the threads that build and fill a buffer keeps it node local
+   */
+  class Affinity {
+
+    private:
+
+      static log4cpp::Category &logger;
+
+    public:
+
+      /**
+       * Parses a kernel cpu list like 0-3,8-11 into the cpu ids.  Reversed
+       * ranges and cpus past CPU_SETSIZE are skipped
+       */
+      static std::vector<uint32_t> parse_cpu_list(const std::string &list);
+
+      /**
+       * Returns the cpus of a NUMA node or an empty vector if the node
+       * doesn't exist
+       */
+      static std::vector<uint32_t> node_cpus(const uint32_t node);
+
+      /**
+       * Pins a thread to the cpus.  An empty set leaves the thread alone.
+       * Returns false if the kernel refused
+       */
+      static bool pin_thread(pthread_t thread, const std::vector<uint32_t> &cpus);
+
+      /**
+       * Pins the calling thread to the cpus
+       */
+      static bool pin_this_thread(const std::vector<uint32_t> &cpus);
+
+  };
+
+}
+
+#endif
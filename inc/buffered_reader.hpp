@@ -1,20 +1,101 @@
 #ifndef AS_UTILS_BUFFERED_READER_HPP
 #define AS_UTILS_BUFFERED_READER_HPP
 
+#include <string.h>
+#include <stdint.h>
 #include <vector>
+#include <algorithm>
 #include <functional>
+#include <atomic>
 
 namespace asutils {
 
   class BufferedReader {
 
+    public:
+
+      /**
+       * How frames are told apart.  DELIMITED frames end with del, which can't
+       * show up inside one.  LENGTH_PREFIXED frames start with their size as a
+       * PREFIX_SIZE byte big endian integer and can carry any bytes
+       */
+      enum Framing { DELIMITED, LENGTH_PREFIXED };
+
+      /**
+       * The bytes of the size in front of a LENGTH_PREFIXED frame
+       */
+      static const size_t PREFIX_SIZE = 4;
+
+      /**
+       * The bounds of how much prepare asks a socket read for.  It starts at
+       * MIN_READ, doubles every time a read fills all of it and halves when
+       * reads use less than a quarter
+       */
+      static const size_t MIN_READ = 4096;
+      static const size_t MAX_READ = 1 << 20;
+
+      /**
+       * A view of one frame handed to a batch callback
+       */
+      struct Frame {
+
+        const char *data;
+        size_t size;
+
+      };
+
+      /**
+       * What a streaming callback is told.  BEGIN comes with the frame's first
+       * header_size bytes, or all of it if it is shorter, CHUNK with the next
+       * piece of the frame and END once it is done
+       */
+      enum Event { BEGIN, CHUNK, END };
+
     private:
 
+      /**
+       * How frames are told apart
+       */
+      Framing framing;
+
       /**
        * The buffer to pool bytes while we have not hit a frame
        */
       std::vector<char> buffer;
 
+      /**
+       * The buffer prepare hands out for the socket to read straight into.
+       * Frames are delivered from it in place and a partial frame stays put
+       * until the rest of it comes in
+       */
+      std::vector<char> in;
+
+      /**
+       * The first byte of in that isn't delivered yet
+       */
+      size_t in_head;
+
+      /**
+       * The end of the bytes in in
+       */
+      size_t in_tail;
+
+      /**
+       * Where the next search for a del in in starts so a partial frame isn't
+       * scanned twice
+       */
+      size_t in_scan;
+
+      /**
+       * How much the next prepare asks for
+       */
+      size_t next_read;
+
+      /**
+       * How much the last prepare handed out
+       */
+      size_t prepared;
+
       /**
        * The delim to read up until to be considered a complete frame
        */
@@ -25,6 +106,135 @@ namespace asutils {
        */
       std::function<void(std::vector<char>)> call_back;
 
+      /**
+       * The callback to invoke with a view of a complete frame
+       */
+      std::function<void(const char *frame, size_t size)> v_call_back;
+
+      /**
+       * The callback to invoke once per read with views of every frame it completed
+       */
+      std::function<void(const Frame *frames, size_t n)> b_call_back;
+
+      /**
+       * The frames of the current read waiting for the batch callback
+       */
+      std::vector<Frame> batch;
+
+      /**
+       * The callback to invoke with the pieces of every frame as they come in
+       */
+      std::function<void(const Event event, const char *data, size_t size)> s_call_back;
+
+      /**
+       * The bytes at the front of a frame a streaming callback gets with BEGIN
+       */
+      size_t header_size;
+
+      /**
+       * True while a streamed frame is in progress
+       */
+      bool s_in_frame;
+
+      /**
+       * True once BEGIN went out for the streamed frame
+       */
+      bool s_begun;
+
+      /**
+       * The bytes of the streamed frame seen so far
+       */
+      size_t s_seen;
+
+      /**
+       * The bytes of a LENGTH_PREFIXED streamed frame still to come
+       */
+      size_t s_left;
+
+      /**
+       * The biggest frame we accept or 0 for no limit
+       */
+      size_t max_frame;
+
+      /**
+       * The most buffer capacity we grow to for frames that fit in it and keep
+       * around between frames or 0 for no limit
+       */
+      size_t budget;
+
+      /**
+       * The callback to invoke when a frame is over max_frame
+       */
+      std::function<void()> o_call_back;
+
+      /**
+       * A gauge shared by many readers of the bytes they hold in partial frames
+       * or NULL
+       */
+      std::atomic<int64_t> *gauge;
+
+      /**
+       * The bytes we added to the gauge
+       */
+      int64_t held;
+
+      /**
+       * Set once a frame went over max_frame.  Nothing is read after that
+       */
+      bool overflowed;
+
+      /**
+       * Hands a complete frame to whichever callback we have
+       */
+      void deliver(const char *frame, size_t size);
+
+      /**
+       * Hands the frames waiting in batch to the batch callback
+       */
+      void flush();
+
+      /**
+       * Returns true if a frame of size bytes is over max_frame
+       */
+      bool too_big(size_t size);
+
+      /**
+       * Drops our buffer, marks us overflowed and calls the overflow callback.
+       * Returns false so read can return it
+       */
+      bool overflow();
+
+      /**
+       * Gives back the buffer once a frame is done if it grew past the budget
+       */
+      void trim();
+
+      /**
+       * Brings the gauge up to date with what we hold
+       */
+      void account();
+
+      /**
+       * Delivers every whole frame in in.  Returns false on overflow
+       */
+      bool scan_in();
+
+      /**
+       * Streams frames to the streaming callback keeping nothing but the
+       * header.  Returns false on overflow
+       */
+      bool stream(const char *data, size_t size);
+
+      /**
+       * Reads DELIMITED frames.  Returns false on overflow
+       */
+      bool read_delimited(const char *data, size_t size);
+
+      /**
+       * Reads LENGTH_PREFIXED frames.  Returns false on overflow
+       */
+      bool read_prefixed(const char *data, size_t size);
+
     public:
 
       BufferedReader();
@@ -35,9 +245,100 @@ namespace asutils {
       BufferedReader(const char del, std::function<void(std::vector<char>)> call_back);
 
       /**
-       * This method will read up to the 'del' and call the function
+       * Constructor for a callback that gets a view of each frame instead of a
+       * copy.  The view is only good until the callback returns.  A frame that
+       * arrives whole in one read is viewed right where it lies
+       */
+      BufferedReader(const char del, std::function<void(const char *frame, size_t size)> v_call_back);
+
+      /**
+       * Constructor for a view callback that picks the framing.  del is only
+       * used when it is DELIMITED.  The view never includes the del or the prefix
+       */
+      BufferedReader(const Framing framing, const char del, std::function<void(const char *frame, size_t size)> v_call_back);
+
+      /**
+       * Constructor for a callback that gets views of every frame one read
+       * completed at once, so a client that pipelines many small frames costs
+       * one call per read instead of one per frame.  The views are only good
+       * until the callback returns
+       */
+      BufferedReader(const Framing framing, const char del, std::function<void(const Frame *frames, size_t n)> b_call_back);
+
+      /**
+       * Constructor for a streaming callback.  Frames are never buffered whole,
+       * the callback gets BEGIN with the first header_size bytes, CHUNKs of the
+       * rest as they are read and END, so a huge frame takes constant memory.
+       * max_frame still bounds the frame
+       */
+      BufferedReader(const Framing framing, const char del, const size_t header_size,
+          std::function<void(const Event event, const char *data, size_t size)> s_call_back);
+
+      /**
+       * The destructor takes what we hold off of the gauge
+       */
+      ~BufferedReader();
+
+      /**
+       * Readers move but don't copy so the gauge counts every byte once
+       */
+      BufferedReader(BufferedReader &&other);
+      BufferedReader &operator=(BufferedReader &&other);
+      BufferedReader(const BufferedReader &) = delete;
+      BufferedReader &operator=(const BufferedReader &) = delete;
+
+      /**
+       * Bounds what we buffer.  A frame over max_frame bytes drops whatever we
+       * hold, calls o_call_back and makes every read after it fail.  Reads don't
+       * grow past budget bytes and neither does the buffer but for a frame
+       * bigger than that.  A LENGTH_PREFIXED one gets exactly its size and any
+       * other grows by half at a time, so a reader holds at most max_frame plus
+       * budget.  Once such a frame is done the buffer is given back.  0 means no
+       * limit.  The bytes held in partial frames are added to gauge if it isn't
+       * NULL
+       */
+      void set_limits(const size_t max_frame, const size_t budget, std::function<void()> o_call_back,
+          std::atomic<int64_t> *gauge = NULL);
+
+      /**
+       * This method will read up to the end of every frame and call the function.
+       * DELIMITED frames are found with memchr a vector at a time and every run
+       * between them is copied in bulk.  LENGTH_PREFIXED frames jump straight
+       * from one prefix to the next.  Returns false once a frame went over the
+       * max frame size
+       */
+      bool read(const char *data, size_t size);
+
+      /**
+       * Returns writable space of at least the adaptive read size for a socket
+       * read to fill and sets space to its size.  For a LENGTH_PREFIXED frame
+       * bigger than the budget it is the rest of the frame.  The space is only good until the next commit.
+       * Don't mix with read on the same reader
+       */
+      char *prepare(size_t &space);
+
+      /**
+       * Takes the n bytes the socket read into the prepared space and delivers
+       * every frame they complete straight out of it.  Returns false once a
+       * frame went over the max frame size
+       */
+      bool commit(const size_t n);
+
+      /**
+       * Returns the buffer capacity we hold, which the budget bounds between
+       * frames
+       */
+      size_t capacity();
+
+      /**
+       * Writes the prefix of a LENGTH_PREFIXED frame of size bytes to result
+       */
+      static void write_prefix(const uint32_t size, char *result);
+
+      /**
+       * Reads the prefix of a LENGTH_PREFIXED frame
        */
-      void read(const char *data, size_t size);
+      static uint32_t read_prefix(const char *prefix);
 
   };
 
@@ -1,19 +1,96 @@
 #ifndef AS_UTILS_BUFFERED_WRITER_HPP
 #define AS_UTILS_BUFFERED_WRITER_HPP
 
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <algorithm>
 #include <functional>
 
 namespace asutils {
 
   class BufferedWriter {
 
+    public:
+
+      /**
+       * The size of the chunks the bytes are kept in
+       */
+      static const size_t CHUNK_SIZE = 16384;
+
+      /**
+       * How many emptied chunks are kept around for reuse
+       */
+      static const size_t MAX_SPARE = 4;
+
+      /**
+       * Handed over buffers smaller than this are copied into the chunks, a
+       * segment of their own would cost more than the copy
+       */
+      static const size_t MIN_SEGMENT = 256;
+
     private:
 
       /**
-       * The buffer to pool the message frame bytes
+       * A chunk of the buffer.  The bytes still to go are base[head, tail).
+       * Our own chunks point base at data and get appended to.  A handed over
+       * buffer is a chunk of its own that keep holds on to until it is sent.
+       * A file chunk has no base, its bytes are at offset + [head, tail) of fd
+       */
+      struct Chunk {
+
+        std::vector<char> data;
+        std::shared_ptr<const void> keep;
+        const char *base;
+        int32_t fd;
+        off_t offset;
+        size_t head;
+        size_t tail;
+
+      };
+
+      /**
+       * The chunks that pool the message frame bytes, oldest first
+       */
+      std::deque<Chunk> chunks;
+
+      /**
+       * Emptied chunks waiting to be reused
+       */
+      std::vector<std::vector<char>> spare;
+
+      /**
+       * The bytes in all of the chunks.  Atomic so it can be watched from other
+       * threads
+       */
+      std::atomic<size_t> total;
+
+      /**
+       * Where the bytes we hold are added up across writers or NULL
+       */
+      std::atomic<int64_t> *gauge;
+
+      /**
+       * When the oldest bytes still in the buffer were written
+       */
+      std::chrono::steady_clock::time_point oldest;
+
+      /**
+       * Appends an empty chunk, reusing a spare one if there is any
+       */
+      void add_chunk();
+
+      /**
+       * Adds delta to what we hold and to the gauge
        */
-      std::vector<char> buffer;
+      void account(const int64_t delta);
 
     public:
 
@@ -22,29 +99,87 @@ namespace asutils {
        */
       BufferedWriter();
 
+      /**
+       * The destructor takes what we hold off of the gauge
+       */
+      ~BufferedWriter();
+
+      /**
+       * Writers move but don't copy so the gauge counts every byte once
+       */
+      BufferedWriter(BufferedWriter &&other);
+      BufferedWriter &operator=(BufferedWriter &&other);
+      BufferedWriter(const BufferedWriter &) = delete;
+      BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+      /**
+       * Adds the bytes this writer holds to gauge from now on
+       */
+      void set_gauge(std::atomic<int64_t> *gauge);
+
       /**
        * This method will add to this buffer
        */
       void write(const char *msg_frame, size_t size);
 
+      /**
+       * Queues a buffer without copying it.  data stays valid as long as keep
+       * lives, which the writer holds until the bytes are sent
+       */
+      void write(const char *data, size_t size, std::shared_ptr<const void> keep);
+
+      /**
+       * Takes ownership of buffer and queues it without copying
+       */
+      void write(std::vector<char> &&buffer);
+
+      /**
+       * Takes ownership of buffer and queues it without copying
+       */
+      void write(std::string &&buffer);
+
+      /**
+       * Queues size bytes of fd from offset without reading them.  fd has to stay
+       * open and the bytes unchanged until they are sent, keep is let go of
+       * then
+       */
+      void write_file(const int32_t fd, const off_t offset, size_t size, std::shared_ptr<const void> keep);
+
       /**
        * This method will return a chunk of the buffer without removing it
        */
       void iread(char *r_buffer, size_t size);
 
+      /**
+       * Points up to max iovecs at the pending bytes in order, without copying
+       * them, and returns how many it filled.  They stay valid until the next
+       * write or clear.  They stop short of the first file chunk
+       */
+      size_t peek(struct iovec *iov, size_t max);
+
+      /**
+       * Returns true if the next bytes to go are in a file and where they are
+       */
+      bool file(int32_t &fd, off_t &offset, size_t &size);
+
       /**
        * This method clears this many bytes from the buffer
        */
       void clear(size_t size);
 
       /**
-       * This method returns the current size of the buffer
+       * This method returns the current size of the buffer.  It is safe to call
+       * from any thread
        */
       size_t size();
+
+      /**
+       * Returns when the oldest bytes still in the buffer were written.  Only
+       * means something while size is not 0
+       */
+      std::chrono::steady_clock::time_point since();
   };
 
 }
 
 #endif
-
-
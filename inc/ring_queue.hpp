@@ -0,0 +1,182 @@
+#ifndef AS_UTILS_RING_QUEUE_HPP
+#define AS_UTILS_RING_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace asutils {
+
+  /**
+   * A lock free bounded multi producer multi consumer queue.  Every cell carries
+   * a sequence number that tells producers and consumers whose turn it is, so
+   * the only shared writes are one CAS on the head or the tail per operation.
+   * The capacity is rounded up to a power of two
+   */
+  template<typename T>
+  class RingQueue {
+
+    private:
+
+      struct Cell {
+
+        std::atomic<size_t> seq;
+        T data;
+
+      };
+
+      /**
+       * The cells of the ring
+       */
+      std::unique_ptr<Cell[]> cells;
+
+      /**
+       * The capacity minus one used to wrap positions
+       */
+      size_t mask;
+
+      /**
+       * The next position to push to
+       */
+      std::atomic<size_t> tail;
+
+      /**
+       * Padding that keeps the head and the tail on separate cache lines so
+       * producers and consumers don't fight over them
+       */
+      char t_pad[64 - sizeof(std::atomic<size_t>)];
+
+      /**
+       * The next position to pop from
+       */
+      std::atomic<size_t> head;
+
+    public:
+
+      /**
+       * The constructor takes the minimum capacity of the ring
+       */
+      RingQueue(const size_t capacity) {
+
+        size_t size = 2;
+        while(size < capacity) {
+
+          size <<= 1;
+
+        }
+
+        this->cells.reset(new Cell[size]);
+        this->mask = size - 1;
+
+        for(size_t i=0; i < size; ++i) {
+
+          this->cells[i].seq.store(i, std::memory_order_relaxed);
+
+        }
+
+        this->tail.store(0, std::memory_order_relaxed);
+        this->head.store(0, std::memory_order_relaxed);
+
+      }
+
+      RingQueue(const RingQueue &) = delete;
+      RingQueue &operator=(const RingQueue &) = delete;
+
+      /**
+       * Pushes to the ring.  Returns false if the ring is full
+       */
+      template<typename U>
+      bool try_push(U &&value) {
+
+        size_t pos = this->tail.load(std::memory_order_relaxed);
+
+        while(1) {
+
+          Cell &cell = this->cells[pos & this->mask];
+          size_t seq = cell.seq.load(std::memory_order_acquire);
+          intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+          if(diff == 0) {
+
+            //the cell is free for this position, lets claim it
+            if(this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+
+              cell.data = std::forward<U>(value);
+              cell.seq.store(pos + 1, std::memory_order_release);
+              return true;
+
+            }
+
+          } else if(diff < 0) {
+
+            //the cell still holds a value from the last lap so we are full
+            return false;
+
+          } else {
+
+            //someone else claimed this position, go again
+            pos = this->tail.load(std::memory_order_relaxed);
+
+          }
+
+        }
+
+      }
+
+      /**
+       * Pops from the ring into value.  Returns false if the ring is empty
+       */
+      bool try_pop(T &value) {
+
+        size_t pos = this->head.load(std::memory_order_relaxed);
+
+        while(1) {
+
+          Cell &cell = this->cells[pos & this->mask];
+          size_t seq = cell.seq.load(std::memory_order_acquire);
+          intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+          if(diff == 0) {
+
+            //the cell holds the value for this position, lets claim it
+            if(this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+
+              value = std::move(cell.data);
+              cell.data = T();
+              //hand the cell to the producer one lap ahead
+              cell.seq.store(pos + this->mask + 1, std::memory_order_release);
+              return true;
+
+            }
+
+          } else if(diff < 0) {
+
+            //nothing has been pushed here yet so we are empty
+            return false;
+
+          } else {
+
+            pos = this->head.load(std::memory_order_relaxed);
+
+          }
+
+        }
+
+      }
+
+      /**
+       * Returns the capacity of the ring
+       */
+      size_t capacity() const {
+
+        return this->mask + 1;
+
+      }
+
+  };
+
+}
+
+#endif
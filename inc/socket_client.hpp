@@ -24,6 +24,7 @@
 #include "utils.hpp" 
 #include "buffered_reader.hpp"
 #include "buffered_writer.hpp"
+#include "timer_wheel.hpp"
 #include <csignal>
 #include <chrono>
 #include <atomic>
@@ -45,6 +46,13 @@ namespace asutils {
 
       static log4cpp::Category &logger;
 
+      /**
+       * How long to wait before the first reconnect attempt and the most we
+       * back off to after repeated failures
+       */
+      static const uint64_t RETRY_MILLIS = 10000;
+      static const uint64_t MAX_RETRY_MILLIS = 300000;
+
       /**
        * Threadpool for reading data
        */
@@ -55,6 +63,46 @@ namespace asutils {
        */
       ThreadPool w_tp;
 
+      /**
+       * Threadpool for connecting to hosts.  Name lookups and connects block so
+       * they run here instead of holding up a read worker
+       */
+      ThreadPool c_tp;
+
+      /**
+       * Timers for reaping, reconnecting, request deadlines and flushing held
+       * writers.  They fire on the read pool's LOW lane and hand reaping and
+       * reconnecting over to the connect pool
+       */
+      TimerWheel timers;
+
+      /**
+       * How frames are told apart on every connection
+       */
+      BufferedReader::Framing framing;
+
+      /**
+       * The bounds on what every connection's buffers hold
+       */
+      SocketUtils::Limits limits;
+
+      /**
+       * The bytes waiting in writers across all connections
+       */
+      std::atomic<int64_t> w_bytes;
+
+      /**
+       * The bytes of frames queued on write strands that haven't made it to
+       * their writers yet
+       */
+      std::atomic<int64_t> q_bytes;
+
+      /**
+       * The frames queued and the sends that got bytes out
+       */
+      std::atomic<uint64_t> w_frames;
+      std::atomic<uint64_t> w_sends;
+
       /**
        * The desired hosts
        */
@@ -92,10 +140,20 @@ namespace asutils {
        */
       std::mutex conn_mutex;
 
+      /**
+       * A response callback and the timer that gives up on it, 0 if it has none
+       */
+      struct Pending {
+
+        std::function<void(std::vector<char>, bool)> callback;
+        uint64_t timer;
+
+      };
+
       /**
        * The call backs sfd -> uuid -> callback
        */
-      std::unordered_map<int32_t,  std::unordered_map<std::string, std::function<void(std::vector<char>&&)>>> call_backs;
+      std::unordered_map<int32_t,  std::unordered_map<std::string, Pending>> call_backs;
       
       /**
        * A mutex to lock access to the call_backs map
@@ -133,32 +191,28 @@ namespace asutils {
       std::mutex e_mutex;
 
       /**
-       * A vector for hosts that could not be reconnected to
-       */
-      std::vector<std::string> e_hosts;
-
-      /**
-       * A mutex for e_hosts
+       * Make a connection and store it
        */
-      std::mutex eh_mutex;
+      bool make_connection(std::string node);
 
       /**
-       * Make a connection and store it
+       * Tries to reconnect to a host that either failed to connect or lost its
+       * connection.  If it fails again it schedules another try, backing off
+       * from delay_millis
        */
-      bool make_connection(std::string node);
+      void retry_conn(const std::string node, const uint64_t delay_millis);
 
       /**
-       * This method is for a single thread that will continuously try to
-       * connected to hosts that either failed to connect to or at some
-       * point lost connection
+       * Runs work that connects to hosts on the connect pool after delay_millis.
+       * The timers only hand it over
        */
-      void retry_conn();
+      void schedule_connect(const uint64_t delay_millis, std::function<void()> work);
 
       /**
        * This method loops for all of eternity to process e poll events
        */
-      void process_epoll_events(int32_t ep_sfd, std::function<void(int32_t, int32_t)> read_callback, 
-          std::function<void(int32_t, int32_t)> write_callback);
+      void process_epoll_events(int32_t ep_sfd, std::function<Task(int32_t, int32_t)> read_callback, 
+          std::function<Task(int32_t, int32_t)> write_callback);
 
       /**
        * This method reads message off the socket file descriptor, calls the callback and removes
@@ -172,14 +226,47 @@ namespace asutils {
       void write(int32_t ep_sfd, int32_t sfd);
 
       /**
-       * Method adds sfd to a set of zombied to be reaped later
+       * Writes out a writer that was held for more frames once its time is up.
+       * It goes through the write strand
+       */
+      void flush(int32_t ep_sfd, int32_t sfd);
+
+      /**
+       * Returns the read strand of sfd, creating the read resources if they
+       * don't exist yet
+       */
+      std::shared_ptr<Strand> read_strand(int32_t sfd);
+
+      /**
+       * Returns the write strand of sfd, creating the write resources if they
+       * don't exist yet
+       */
+      std::shared_ptr<Strand> write_strand(int32_t sfd);
+
+      /**
+       * Reserves bytes for a frame to sfd and returns its backlog, or NULL if
+       * the connection held limits.high_water bytes or more with its queued
+       * frames and hasn't been back down to limits.low_water since.  The
+       * strand gives them back once the frame is in the writer
+       */
+      std::shared_ptr<SocketUtils::Backlog> reserve(const int32_t sfd, const size_t bytes);
+
+      /**
+       * Takes every callback waiting on a response from sfd out, calls off
+       * their timers and tells them the request failed
+       */
+      void fail_pending(int32_t sfd);
+
+      /**
+       * Method adds sfd to a set of zombied and schedules it to be reaped later
        */
       void a_zombied(int32_t sfd);
 
       /**
-       * This method starts a thread that will continuously clean up zombied socket resouces
+       * Cleans up the resources of a zombied sfd once its time is up and
+       * reconnects to its host
        */
-      void reap_resources();
+      void reap(int32_t sfd);
 
       /**
        * Closes the server ep_sfd and sfd as well as cleans up
@@ -189,9 +276,12 @@ namespace asutils {
     public:
 
       /**
-       * Default constructor takes a vector of host:port
+       * Default constructor takes a vector of host:port, the framing the
+       * servers use and the bounds on what a connection can make us buffer
        */
-      SocketClient(std::vector<std::string> desired_hosts);
+      SocketClient(std::vector<std::string> desired_hosts,
+          const BufferedReader::Framing framing = BufferedReader::DELIMITED,
+          const SocketUtils::Limits &limits = SocketUtils::Limits());
 
       /**
        * Connects to all nodes
@@ -200,26 +290,72 @@ namespace asutils {
 
       /**
        * Sends a message on to the node that the node at the index ni.  It will not block but call the resp_callback with a response from the server.
-       * If the server is down it will return false and not make the request
+       * If the server is down it will return false and not make the request.  If to_millis is set and no response came by then, or the
+       * connection closes first, the resp_callback is called with an empty response instead
        */
-      bool send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>)> resp_callback, std::string &uuid_str);
+      bool send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>)> resp_callback, std::string &uuid_str,
+          uint64_t to_millis = 0);
 
       /**
        * Sends a message on to the node that the hash_key hashes to.  It will not block but call the resp_callback with a response from the server.
-       * If the server is down it will return false and not make the request
+       * If the server is down it will return false and not make the request.  If to_millis is set and no response came by then, or the
+       * connection closes first, the resp_callback is called with an empty response instead
        */
-      bool send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>)> resp_callback);
+      bool send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>)> resp_callback,
+          uint64_t to_millis = 0);
 
       /**
-       * Sends a message on to the node at index ni.  It will block and put response in the result
+       * Sends a message on to the node at index ni like the above, but the resp_callback is told whether the request worked.  It gets
+       * the response and true, or an empty response and false if to_millis is set and no response came by then or the connection closed
+       */
+      bool send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>, bool)> resp_callback,
+          std::string &uuid_str, uint64_t to_millis = 0);
+
+      /**
+       * Sends a message on to the node that the hash_key hashes to like the above, but the resp_callback is told whether the request
+       * worked.  It gets the response and true, or an empty response and false if to_millis is set and no response came by then or the
+       * connection closed
+       */
+      bool send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>, bool)> resp_callback,
+          uint64_t to_millis = 0);
+
+      /**
+       * Sends a message on to the node at index ni.  It will block and put response in the result.  Returns false if the
+       * node is down, no response came in to_millis or the connection closed
        */
       bool send_msg(const char *data, size_t size, uint32_t ni, std::vector<char> &result, uint64_t to_millis);
 
       /**
-       * Sends a message on to the node that the hash_key hashes to.  It will block and put response in the result
+       * Sends a message on to the node that the hash_key hashes to.  It will block and put response in the result.  Returns
+       * false if the node is down, no response came in to_millis or the connection closed
        */
       bool send_msg(const char *data, size_t size, std::string &hash_key, std::vector<char> &result, uint64_t to_millis);
 
+      /**
+       * Returns the bytes waiting to be written across all connections, queued
+       * frames included
+       */
+      uint64_t buffered_bytes();
+
+      /**
+       * Returns the bytes waiting to be written to sfd, queued frames included.
+       * A send to a connection holding limits.high_water bytes or more returns
+       * false until it is back down to limits.low_water
+       */
+      uint64_t buffered_bytes(const int32_t sfd);
+
+      /**
+       * Returns the frames queued across all connections
+       */
+      uint64_t frames_queued();
+
+      /**
+       * Returns the send calls that got bytes out across all connections.  Next
+       * to frames_queued it shows how many frames went out per call, though a
+       * partial send takes another
+       */
+      uint64_t send_calls();
+
   };
 
 }
@@ -19,10 +19,14 @@
 #include "thread_pool.hpp"
 #include "buffered_reader.hpp"
 #include "buffered_writer.hpp"
+#include "affinity.hpp"
+#include "timer_wheel.hpp"
 #include <unordered_map>
 #include <csignal>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <array>
 #include <log4cpp/Category.hh>
 
 namespace asutils {
@@ -61,6 +65,12 @@ namespace asutils {
        */
       ThreadPool w_tp;
 
+      /**
+       * Timers for reaping zombied sockets and flushing held writers.  They fire
+       * on the read pool's LOW lane
+       */
+      TimerWheel timers;
+
       /**
        * A map holding all the SocketUtils::ReadR for a sfd 
        */
@@ -107,6 +117,58 @@ namespace asutils {
       std::function<void(std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
             SocketServer &server, const int32_t sfd)> handler;
 
+      /**
+       * A function to handle views of messages.  Used instead of handler when set
+       */
+      std::function<void(const char *uuid, const char *msg, size_t msg_size,
+            SocketServer &server, const int32_t sfd)> v_handler;
+
+      /**
+       * A function to handle every message one read brought in at once.  Used
+       * instead of handler and v_handler when set
+       */
+      std::function<void(const SocketUtils::Msg *msgs, size_t n, SocketServer &server,
+            const int32_t sfd)> b_handler;
+
+      /**
+       * A function to handle messages as a stream of pieces.  Used instead of
+       * every other handler when set
+       */
+      std::function<void(const BufferedReader::Event event, const char *uuid, const char *data, size_t size,
+            SocketServer &server, const int32_t sfd)> s_handler;
+
+      /**
+       * How frames are told apart on every connection
+       */
+      BufferedReader::Framing framing;
+
+      /**
+       * The bounds on what every connection's buffers hold
+       */
+      SocketUtils::Limits limits;
+
+      /**
+       * The bytes held in partial frames across all connections
+       */
+      std::atomic<int64_t> p_bytes;
+
+      /**
+       * The frames queued and the sends that got bytes out
+       */
+      std::atomic<uint64_t> w_frames;
+      std::atomic<uint64_t> w_sends;
+
+      /**
+       * The bytes waiting in writers across all connections
+       */
+      std::atomic<int64_t> w_bytes;
+
+      /**
+       * The bytes of frames queued on write strands that haven't made it to
+       * their writers yet
+       */
+      std::atomic<int64_t> q_bytes;
+
       /**
        * This is the initial socket file descriptor
        */
@@ -122,6 +184,12 @@ namespace asutils {
        */
       int32_t ep_sfd;
       
+      /**
+       * Pins the calling thread, sets up the listening socket and processes epoll
+       * events for good
+       */
+      void serve(const std::vector<uint32_t> &cpus);
+
       /**
        * This method creates a socket to listen on and returns it.  If it fails
        * the process will exit
@@ -142,8 +210,8 @@ namespace asutils {
       /**
        * This method loops for all of eternity to process e poll events
        */
-      void process_epoll_events(std::function<void()> add_callback, std::function<void(int32_t)> read_callback, 
-          std::function<void(int32_t)> write_callback);
+      void process_epoll_events(std::function<void()> add_callback, std::function<Task(int32_t)> read_callback, 
+          std::function<Task(int32_t)> write_callback);
 
       /**
        * Start listening on the socket
@@ -160,20 +228,50 @@ namespace asutils {
        */
       void write(int32_t sfd);
 
+      /**
+       * Writes out a writer that was held for more frames once its time is up.
+       * It goes through the write strand
+       */
+      void flush(const int32_t sfd);
+
+      /**
+       * Returns the read strand of sfd or NULL if sfd is unknown
+       */
+      std::shared_ptr<Strand> read_strand(int32_t sfd);
+
+      /**
+       * Returns the write strand of sfd or NULL if sfd is unknown
+       */
+      std::shared_ptr<Strand> write_strand(int32_t sfd);
+
+      /**
+       * Runs writes of bytes on the BufferedWriter of sfd from its write strand
+       * and has epoll tell us when the socket can take them.  The bytes count
+       * against the high water as soon as they are queued
+       */
+      void queue(const int32_t sfd, const size_t bytes, std::function<void(BufferedWriter &bw)> writes);
+
+      /**
+       * Stops or resumes reading from sfd to match whether its writer is over
+       * the high water.  It goes through the read strand so a read in flight
+       * finishes first
+       */
+      void sync_reads(const int32_t sfd);
+
       /**
        * Closes the client sfd as well as cleans up
        */
       void close_n_clean(int32_t sfd);
 
       /**
-       * Method adds sfd to a set of zombied to be reaped later
+       * Method adds sfd to a set of zombied and schedules it to be reaped later
        */
       void a_zombied(int32_t sfd);
 
       /**
-       * This method starts a thread that will continuously clean up zombied socket resouces
+       * Cleans up the resources of a zombied sfd once its time is up
        */
-      void reap_resources();
+      void reap(int32_t sfd);
 
     public:
 
@@ -184,10 +282,125 @@ namespace asutils {
             SocketServer &server, const int32_t sfd)> handler); 
 
       /**
-       * Send message on socket file descriptor
+       * Constructor that pins the epoll thread, which is the calling thread, and
+       * every pool to cpus.  Connection buffers are built and filled by the pinned
+       * threads so they land on the same NUMA node as the handlers that read them.
+       * Clients have to use the same framing.  limits bounds what a connection
+       * can make us buffer
+       */
+      SocketServer(const uint32_t port, std::function<void(std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
+            SocketServer &server, const int32_t sfd)> handler, const std::vector<uint32_t> &cpus,
+            const BufferedReader::Framing framing = BufferedReader::DELIMITED,
+            const SocketUtils::Limits &limits = SocketUtils::Limits()); 
+
+      /**
+       * Constructor for a handler that gets views of the uuid and message instead
+       * of copies.  The views point into the connection's read buffer and are
+       * only good until the handler returns, so a handler that needs the bytes
+       * later has to copy them itself
+       */
+      SocketServer(const uint32_t port, std::function<void(const char *uuid, const char *msg, size_t msg_size,
+            SocketServer &server, const int32_t sfd)> v_handler, const std::vector<uint32_t> &cpus = std::vector<uint32_t>(),
+            const BufferedReader::Framing framing = BufferedReader::DELIMITED,
+            const SocketUtils::Limits &limits = SocketUtils::Limits()); 
+
+      /**
+       * Constructor for a handler that gets views of every message one read of a
+       * connection brought in at once, in order.  A client that pipelines many
+       * small requests then costs one call per read instead of one per message.
+       * The views are only good until the handler returns
+       */
+      SocketServer(const uint32_t port, std::function<void(const SocketUtils::Msg *msgs, size_t n,
+            SocketServer &server, const int32_t sfd)> b_handler, const std::vector<uint32_t> &cpus = std::vector<uint32_t>(),
+            const BufferedReader::Framing framing = BufferedReader::DELIMITED,
+            const SocketUtils::Limits &limits = SocketUtils::Limits()); 
+
+      /**
+       * Constructor for a handler that streams messages instead of getting them
+       * whole, for payloads too big to hold.  It gets BEGIN once the uuid is in,
+       * CHUNKs of the message as they are read and END, always with the uuid.
+       * Raise limits.max_frame to the biggest message you expect
+       */
+      SocketServer(const uint32_t port, std::function<void(const BufferedReader::Event event, const char *uuid,
+            const char *data, size_t size, SocketServer &server, const int32_t sfd)> s_handler,
+            const std::vector<uint32_t> &cpus = std::vector<uint32_t>(),
+            const BufferedReader::Framing framing = BufferedReader::DELIMITED,
+            const SocketUtils::Limits &limits = SocketUtils::Limits()); 
+
+      /**
+       * Send message on socket file descriptor.  The frame is queued on the
+       * sfd's write strand so the call never waits on a writer
        */
       void send_msg(std::vector<char> &uuid_v, std::vector<char> &msg_v, const int32_t sfd);
 
+      /**
+       * Send message on socket file descriptor from a 37 byte uuid and a message
+       * that the caller keeps ownership of, e.g. the views a v_handler got
+       */
+      void send_msg(const char *uuid, const char *msg, size_t msg_size, const int32_t sfd);
+
+      /**
+       * Send message on socket file descriptor from a 37 byte uuid and a message
+       * that stays valid as long as keep lives.  Only the uuid is copied, the
+       * message goes from the buffer to the socket
+       */
+      void send_msg(const char *uuid, const char *msg, size_t msg_size, std::shared_ptr<const void> keep,
+          const int32_t sfd);
+
+      /**
+       * Send message on socket file descriptor from a 37 byte uuid and a message
+       * the server takes ownership of, so it is never copied
+       */
+      void send_msg(const char *uuid, std::vector<char> &&msg, const int32_t sfd);
+
+      /**
+       * Send message on socket file descriptor from a 37 byte uuid and a message
+       * the server takes ownership of, so it is never copied
+       */
+      void send_msg(const char *uuid, std::string &&msg, const int32_t sfd);
+
+      /**
+       * Send size bytes of fd from offset as the message on socket file
+       * descriptor, with a 37 byte uuid.  The bytes go from the page cache to
+       * the socket with sendfile.  fd is duplicated so the caller can close it
+       * right away, but the bytes can't change until they are sent
+       */
+      void send_file(const char *uuid, const int32_t fd, const off_t offset, const size_t size, const int32_t sfd);
+
+      /**
+       * Runs bulk work on the read pool's LOW lane so it only gets the workers
+       * the message handlers leave over.  Returns false if it was rejected
+       */
+      bool add_background_work(std::function<void()> work);
+
+      /**
+       * Returns the bytes held in partial frames across all connections
+       */
+      uint64_t partial_bytes();
+
+      /**
+       * Returns the frames queued across all connections
+       */
+      uint64_t frames_queued();
+
+      /**
+       * Returns the send calls that got bytes out across all connections.  Next
+       * to frames_queued it shows how many frames went out per call, though a
+       * file frame takes a call per sendfile and a partial send takes another
+       */
+      uint64_t send_calls();
+
+      /**
+       * Returns the bytes waiting to be written across all connections, queued
+       * frames included
+       */
+      uint64_t buffered_bytes();
+
+      /**
+       * Returns the bytes waiting to be written to sfd, queued frames included
+       */
+      uint64_t buffered_bytes(const int32_t sfd);
+
   };
 
 
@@ -9,7 +9,10 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -17,10 +20,14 @@
 #include <functional>
 #include "buffered_reader.hpp"
 #include "buffered_writer.hpp" 
+#include "thread_pool.hpp"
+#include "strand.hpp"
 #include <uuid/uuid.h>
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include "utils.hpp" 
 #include <log4cpp/Category.hh>
 
@@ -35,27 +42,108 @@ namespace asutils {
     public:
 
       /**
-       * These are the read resources
+       * The most chunks of a writer handed to one writev
+       */
+      static const size_t MAX_IOV = 64;
+
+      /**
+       * The most bytes a frame has in front of its message
+       */
+      static const size_t MAX_HEADER = BufferedReader::PREFIX_SIZE + 37;
+
+      /**
+       * These are the read resources.  They are only touched from the strand.
+       * paused stops reads while the connection's writer is over its high water
        */
       struct ReadR {
 
         BufferedReader br;
-        std::mutex *mutex;
+        std::shared_ptr<Strand> strand;
         bool is_valid; 
+        bool paused;
+
+      };
+
+      /**
+       * Views of the uuid and message of one frame
+       */
+      struct Msg {
+
+        const char *uuid;
+        const char *msg;
+        size_t msg_size;
+
+      };
+
+      /**
+       * The bounds on what a connection's buffers hold.  A frame over max_frame
+       * bytes gets the connection dropped.  A reader's buffer only grows past
+       * budget bytes for a bigger frame, to at most max_frame plus budget, and
+       * is given back once the frame is done.  0 means no limit.  A
+       * writer holding less than flush_bytes waits up to flush_micros from its
+       * oldest byte for more frames before it goes to the socket, so small frames
+       * sent back to back share packets.  The wait is rounded up to the tick of
+       * the timers that flush it.  0 flush_bytes sends right away.  A
+       * connection whose writer holds high_water bytes or more stops taking
+       * more from the peer until it is back down to low_water.  0 high_water
+       * means no limit
+       */
+      struct Limits {
+
+        size_t max_frame;
+        size_t budget;
+        size_t flush_bytes;
+        uint64_t flush_micros;
+        size_t high_water;
+        size_t low_water;
+
+        Limits(const size_t max_frame = 16 << 20, const size_t budget = 64 << 10, const size_t flush_bytes = 0,
+            const uint64_t flush_micros = 0, const size_t high_water = 0, const size_t low_water = 0);
+
+      };
+
+      /**
+       * The bytes of a connection's frames on their way to its writer and
+       * whether the writer is over high water.  The threads that queue frames
+       * share it with the strand so the limits are checked and reserved before
+       * a frame is queued
+       */
+      struct Backlog {
+
+        std::atomic<int64_t> queued;
+        std::atomic<bool> over;
+
+        Backlog() : queued(0), over(false) {
+
+        }
 
       };
 
       /**
-       * These are the read resources
+       * These are the write resources.  They are only touched from the strand,
+       * but for backlog.  over is set once the writer and its queued frames
+       * reach high water until they are back down to low water.  held is set
+       * while a flush is scheduled for a writer waiting on more frames and
+       * corked while the kernel holds its last packet
        */
       struct WriteR {
 
         BufferedWriter bw;
-        std::mutex *mutex;
+        std::shared_ptr<Strand> strand;
+        std::shared_ptr<Backlog> backlog;
         bool is_valid; 
+        bool held;
+        bool corked;
 
       };
 
+      /**
+       * The settings for the read and write pools.  They start at one thread per
+       * core and grow to four per core when handlers block.  When cpus is not
+       * empty the workers are pinned to it and sized by it
+       */
+      static ThreadPool::Config io_pool_config(const std::vector<uint32_t> &cpus = std::vector<uint32_t>());
+
       /**
        * This method makes the socket non blocking
        */
@@ -78,17 +166,27 @@ namespace asutils {
       static void set_epoll(int32_t ep_sfd, int32_t sfd, int32_t events);
 
       /**
-       * This method drains the sfd into a buffered reader until it is told to stop by epoll
+       * This method drains the sfd into a buffered reader until it is told to stop by epoll.
+       * The socket reads straight into the reader's buffer.  A reader that overflows is
+       * handled like a closed connection
        */
       static void read_from_sfd(int32_t ep_sfd, int32_t sfd, BufferedReader &reader, std::function<void()> close_callback, 
           std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex);
 
       /**
-       * This method drains the sockets write buffer until it is empty or
-       * it's told not to by epoll
+       * This method drains the sockets write buffer until it is empty or it's
+       * told not to by epoll.  A writer under limits.flush_bytes that is younger
+       * than limits.flush_micros is held instead: epoll stops watching for
+       * EPOLLOUT and the micros it can still wait are returned so the caller
+       * flushes it then.  With corked set a writer that goes out while frames
+       * are still coming is sent with TCP_CORK on and the wait is returned too,
+       * and the next call takes the cork off.  0 means there is nothing to
+       * flush later.  sends counts the sends that got bytes out.  File chunks go
+       * out with sendfile
        */
-      static void write_to_sfd(int32_t ep_sfd, int32_t sfd, BufferedWriter &writer, std::function<void()> close_callback,
-          std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex);
+      static uint64_t write_to_sfd(int32_t ep_sfd, int32_t sfd, BufferedWriter &writer, std::function<void()> close_callback,
+          std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex, const Limits &limits = Limits(),
+          std::atomic<uint64_t> *sends = NULL, bool *corked = NULL);
 
       /**
        * Creates a message frame
@@ -105,6 +203,47 @@ namespace asutils {
        */
       static void unpack_frame(const char *msg, size_t msg_size, std::vector<char> &uuid_v, std::vector<char> &msg_v);
 
+      /**
+       * Returns the bytes a frame of msg_size bytes takes on the wire
+       */
+      static size_t frame_size(const BufferedReader::Framing framing, size_t msg_size);
+
+      /**
+       * Returns false if a message of msg_size bytes is too big for a frame,
+       * the length prefix only has 32 bits to count the uuid and message in
+       */
+      static bool fits_frame(const BufferedReader::Framing framing, size_t msg_size);
+
+      /**
+       * Creates a message frame of frame_size(framing, msg_size) bytes
+       */
+      static void pack_frame(const BufferedReader::Framing framing, const char *id, const char* msg, size_t msg_size, char *result);
+
+      /**
+       * Writes what goes in front of a message of msg_size bytes, at most
+       * MAX_HEADER bytes, and returns how many it wrote
+       */
+      static size_t pack_header(const BufferedReader::Framing framing, const char *id, size_t msg_size, char *result);
+
+      /**
+       * Writes what goes after a message, at most one byte, and returns how many
+       * it wrote
+       */
+      static size_t pack_trailer(const BufferedReader::Framing framing, char *result);
+
+      /**
+       * Unpacks a whole message frame as it was on the wire
+       */
+      static void unpack_frame(const BufferedReader::Framing framing, const char *frame, size_t frame_size,
+          std::vector<char> &uuid_v, std::vector<char> &msg_v);
+
+      /**
+       * Finds the message in a frame the BufferedReader already stripped the del
+       * off of.  The uuid is the first 37 bytes of frame.  Nothing is copied.
+       * Returns false if the frame is too short to hold a uuid
+       */
+      static bool unpack_frame(const char *frame, size_t frame_size, const char *&msg, size_t &msg_size);
+
   };
 
 }
@@ -0,0 +1,151 @@
+#ifndef AS_UTILS_STRAND_HPP
+#define AS_UTILS_STRAND_HPP
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <utility>
+#include "task.hpp"
+#include "thread_pool.hpp"
+#include <log4cpp/Category.hh>
+
+namespace asutils {
+
+  /**
+   * A serial executor on top of a ThreadPool.  Work posted to one strand runs
+   * in order and never concurrently, but no worker ever parks on a lock waiting
+   * for the strand.  Only one pool task per strand is ever queued or running,
+   * and it runs the queued work in turn.  Keep one strand per key, e.g. per
+   * connection.  A strand must be owned by a std::shared_ptr since its queued
+   * pool task keeps it alive
+   */
+  class Strand : public std::enable_shared_from_this<Strand> {
+
+    public:
+
+      /**
+       * The most tasks a strand runs before it hands the worker back to the
+       * pool so one busy key can't starve the others
+       */
+      static const size_t RUN_BATCH = 64;
+
+    private:
+
+      static log4cpp::Category &logger;
+
+      /**
+       * The pool the strand runs on
+       */
+      ThreadPool &pool;
+
+      /**
+       * Guards tasks and running.  Never held while a task runs
+       */
+      std::mutex mutex;
+
+      /**
+       * The work waiting for its turn
+       */
+      std::deque<Task> tasks;
+
+      /**
+       * True while the strand has a task queued on or running in the pool
+       */
+      bool running;
+
+      /**
+       * The pool task that runs the strand.  If it is dropped without running,
+       * e.g. because the pool rejected it, the strand goes idle so the next
+       * enqueue schedules it again instead of waiting on it for ever
+       */
+      struct Runner {
+
+        std::shared_ptr<Strand> self;
+        bool ran;
+
+        Runner(std::shared_ptr<Strand> &&self) : self(std::move(self)), ran(false) {
+
+        }
+
+        Runner(Runner &&other) noexcept : self(std::move(other.self)), ran(other.ran) {
+
+        }
+
+        ~Runner() {
+
+          if(this->self && !this->ran) {
+
+            this->self->idle();
+
+          }
+
+        }
+
+        void operator()() {
+
+          this->ran = true;
+          this->self->run();
+
+        }
+
+      };
+
+      /**
+       * Runs up to RUN_BATCH queued tasks at a time and requeues itself if there
+       * are more and the pool has room.  A task that throws is logged and the
+       * ones behind it still run
+       */
+      void run();
+
+      /**
+       * Marks the strand idle after its runner was dropped
+       */
+      void idle();
+
+    public:
+
+      /**
+       * The constructor takes the pool the work runs on
+       */
+      Strand(ThreadPool &pool);
+
+      Strand(const Strand &) = delete;
+      Strand &operator=(const Strand &) = delete;
+
+      /**
+       * Queues work on the strand.  If the strand was idle this returns the task
+       * that runs it, which the caller has to hand to the pool, e.g. as part of
+       * an add_work_batch.  Otherwise it returns an empty task
+       */
+      Task enqueue(Task &&work);
+
+      /**
+       * Queues any void() callable on the strand and schedules the strand on its
+       * pool if it was idle
+       */
+      template<typename F>
+      void post(F &&work) {
+
+        Task run = enqueue(Task(std::forward<F>(work)));
+
+        if(run) {
+
+          schedule(std::move(run));
+
+        }
+
+      }
+
+      /**
+       * Hands the task returned by enqueue to the pool.  If the pool rejects it
+       * the strand goes idle and the next enqueue schedules it again.  The same
+       * goes for a runner dropped anywhere else, e.g. left out of an
+       * add_work_batch
+       */
+      void schedule(Task &&run);
+
+  };
+
+}
+
+#endif
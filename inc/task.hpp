@@ -0,0 +1,240 @@
+#ifndef AS_UTILS_TASK_HPP
+#define AS_UTILS_TASK_HPP
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+namespace asutils {
+
+  /**
+   * A move only void() callable.  Callables up to INLINE_SIZE bytes are kept
+   * inside the task itself so building, queueing and running one does not
+   * touch the heap.  Bigger callables fall back to a single heap allocation
+   */
+  class Task {
+
+    public:
+
+      /**
+       * The bytes of inline storage.  Together with the ops pointer a task is
+       * one cache line
+       */
+      static const size_t INLINE_SIZE = 56;
+
+    private:
+
+      /**
+       * What to do with the stored callable
+       */
+      struct Ops {
+
+        void (*call)(void *storage);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *storage);
+
+      };
+
+      /**
+       * Ops for a callable living in the inline storage
+       */
+      template<typename F>
+      struct InlineOps {
+
+        static void call(void *storage) {
+
+          (*static_cast<F*>(storage))();
+
+        }
+
+        static void move(void *dst, void *src) {
+
+          new (dst) F(std::move(*static_cast<F*>(src)));
+          static_cast<F*>(src)->~F();
+
+        }
+
+        static void destroy(void *storage) {
+
+          static_cast<F*>(storage)->~F();
+
+        }
+
+        static const Ops ops;
+
+      };
+
+      /**
+       * Ops for a callable on the heap.  The inline storage holds the pointer
+       */
+      template<typename F>
+      struct HeapOps {
+
+        static void call(void *storage) {
+
+          (**static_cast<F**>(storage))();
+
+        }
+
+        static void move(void *dst, void *src) {
+
+          *static_cast<F**>(dst) = *static_cast<F**>(src);
+
+        }
+
+        static void destroy(void *storage) {
+
+          delete *static_cast<F**>(storage);
+
+        }
+
+        static const Ops ops;
+
+      };
+
+      /**
+       * The inline storage
+       */
+      typename std::aligned_storage<INLINE_SIZE, alignof(void*)>::type storage;
+
+      /**
+       * The ops for the stored callable or NULL if the task is empty
+       */
+      const Ops *ops;
+
+      /**
+       * Releases the stored callable
+       */
+      void reset() {
+
+        if(this->ops != NULL) {
+
+          this->ops->destroy(&this->storage);
+          this->ops = NULL;
+
+        }
+
+      }
+
+      /**
+       * Builds the callable in the inline storage
+       */
+      template<typename D, typename F>
+      void build(F &&f, std::true_type) {
+
+        new (&this->storage) D(std::forward<F>(f));
+        this->ops = &InlineOps<D>::ops;
+
+      }
+
+      /**
+       * Builds the callable on the heap
+       */
+      template<typename D, typename F>
+      void build(F &&f, std::false_type) {
+
+        *reinterpret_cast<D**>(&this->storage) = new D(std::forward<F>(f));
+        this->ops = &HeapOps<D>::ops;
+
+      }
+
+    public:
+
+      /**
+       * True if a callable of type F is kept inline
+       */
+      template<typename F>
+      struct fits_inline : std::integral_constant<bool,
+          sizeof(F) <= INLINE_SIZE && alignof(void*) % alignof(F) == 0 &&
+          std::is_nothrow_move_constructible<F>::value> {};
+
+      /**
+       * An empty task
+       */
+      Task() : ops(NULL) {
+
+      }
+
+      /**
+       * Builds a task out of any void() callable
+       */
+      template<typename F, typename D = typename std::decay<F>::type,
+        typename = typename std::enable_if<!std::is_same<D, Task>::value>::type>
+      Task(F &&f) : ops(NULL) {
+
+        build<D>(std::forward<F>(f), fits_inline<D>());
+
+      }
+
+      Task(Task &&other) noexcept : ops(other.ops) {
+
+        if(this->ops != NULL) {
+
+          this->ops->move(&this->storage, &other.storage);
+          other.ops = NULL;
+
+        }
+
+      }
+
+      Task &operator=(Task &&other) noexcept {
+
+        if(this != &other) {
+
+          reset();
+          this->ops = other.ops;
+
+          if(this->ops != NULL) {
+
+            this->ops->move(&this->storage, &other.storage);
+            other.ops = NULL;
+
+          }
+
+        }
+
+        return *this;
+
+      }
+
+      Task(const Task &) = delete;
+      Task &operator=(const Task &) = delete;
+
+      ~Task() {
+
+        reset();
+
+      }
+
+      /**
+       * Runs the callable
+       */
+      void operator()() {
+
+        this->ops->call(&this->storage);
+
+      }
+
+      /**
+       * True if the task holds a callable
+       */
+      explicit operator bool() const {
+
+        return this->ops != NULL;
+
+      }
+
+  };
+
+  template<typename F>
+  const Task::Ops Task::InlineOps<F>::ops = { &Task::InlineOps<F>::call, &Task::InlineOps<F>::move,
+    &Task::InlineOps<F>::destroy };
+
+  template<typename F>
+  const Task::Ops Task::HeapOps<F>::ops = { &Task::HeapOps<F>::call, &Task::HeapOps<F>::move,
+    &Task::HeapOps<F>::destroy };
+
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef AS_UTILS_TASK_GRAPH_HPP
+#define AS_UTILS_TASK_GRAPH_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <utility>
+#include <log4cpp/Category.hh>
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+namespace asutils {
+
+  /**
+   * A graph of tasks run on a ThreadPool.  Every node names the nodes it
+   * depends on when it is added and runs as soon as the last of them is done,
+   * so independent stages overlap instead of waiting on each other.  Since a
+   * node can only depend on nodes added before it the graph is never cyclic.
+   * A graph runs once
+   */
+  class TaskGraph {
+
+    public:
+
+      /**
+       * Returned by add when the node could not be added
+       */
+      static const size_t INVALID = (size_t)-1;
+
+    private:
+
+      static log4cpp::Category &logger;
+
+      /**
+       * A node of the graph
+       */
+      struct Node {
+
+        Task work;
+        std::vector<size_t> dependents;
+        std::atomic<uint32_t> pending;
+
+      };
+
+      /**
+       * The pool the nodes run on
+       */
+      ThreadPool &pool;
+
+      /**
+       * The lane of the pool the nodes go to
+       */
+      ThreadPool::Priority lane;
+
+      /**
+       * The nodes in the order they were added
+       */
+      std::vector<std::unique_ptr<Node>> nodes;
+
+      /**
+       * The nodes that haven't finished yet
+       */
+      std::atomic<size_t> remaining;
+
+      /**
+       * Set once the graph is cancelled.  Nodes that haven't started are
+       * skipped
+       */
+      std::atomic<bool> cancelled;
+
+      /**
+       * Guards started, done and error
+       */
+      std::mutex mutex;
+
+      /**
+       * Signalled once every node finished
+       */
+      std::condition_variable done_cv;
+
+      /**
+       * Set by run
+       */
+      bool started;
+
+      /**
+       * Set once every node finished
+       */
+      bool done;
+
+      /**
+       * The first exception a node threw
+       */
+      std::exception_ptr error;
+
+      /**
+       * Fulfilled once every node finished
+       */
+      std::promise<bool> completion;
+
+      /**
+       * Runs a node and then whatever it made ready.  One ready dependent stays
+       * on this thread and the rest go to the pool
+       */
+      void execute(size_t node);
+
+      /**
+       * Marks a node finished and fulfills the completion once it was the last
+       */
+      void finish();
+
+      /**
+       * Adds a node running work after deps
+       */
+      size_t add_task(Task &&work, const std::vector<size_t> &deps);
+
+    public:
+
+      /**
+       * The constructor takes the pool and lane the nodes run on
+       */
+      TaskGraph(ThreadPool &pool, const ThreadPool::Priority lane = ThreadPool::HIGH);
+
+      /**
+       * The destructor cancels the graph and waits for the running nodes
+       */
+      ~TaskGraph();
+
+      TaskGraph(const TaskGraph &) = delete;
+      TaskGraph &operator=(const TaskGraph &) = delete;
+
+      /**
+       * Adds any void() callable as a node that runs once every node in deps is
+       * done.  Returns the node's id or INVALID if a dependency is unknown or
+       * the graph already runs
+       */
+      template<typename F>
+      size_t add(F &&work, const std::vector<size_t> &deps = std::vector<size_t>()) {
+
+        return add_task(Task(std::forward<F>(work)), deps);
+
+      }
+
+      /**
+       * Starts every node without dependencies.  The future turns true once all
+       * nodes ran, false if the graph was cancelled, and rethrows the first
+       * exception a node threw, which also cancels the graph.  Only the first
+       * call gets a valid future
+       */
+      std::future<bool> run();
+
+      /**
+       * Cancels the graph.  Running nodes finish but no new ones start
+       */
+      void cancel();
+
+      /**
+       * Returns true once the graph was cancelled
+       */
+      bool is_cancelled();
+
+      /**
+       * Returns the number of nodes
+       */
+      size_t size();
+
+  };
+
+}
+
+#endif
@@ -5,26 +5,198 @@
 #include <thread>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <random>
 #include <functional>
+#include <future>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+#include <chrono>
+#include "ring_queue.hpp"
+#include "task.hpp"
+#include "affinity.hpp"
 
 namespace asutils {
 
   class ThreadPool {
 
+    public:
+
+      /**
+       * The most tasks add_work_batch queues under one lock
+       */
+      static const size_t BATCH_SIZE = 64;
+
+      /**
+       * The scheduling modes of the pool.  SHARED has every worker pull off
+       * of one bounded queue.  STEALING gives every worker its own deque, which
+       * it works newest first, and lets idle workers steal the oldest work of
+       * random victims.  Work from outside the pool goes to a shared queue
+       * that workers drain in batches
+       */
+      enum Mode { SHARED, STEALING };
+
+      /**
+       * The queue behind a SHARED pool.  LOCKING is a std::queue guarded by the
+       * pool mutex.  RING is a lock free bounded ring buffer
+       */
+      enum Backend { LOCKING, RING };
+
+      /**
+       * What add_work does when the queue is at capacity.  BLOCK waits for
+       * room, BLOCK_TIMEOUT waits up to block_to_millis and then rejects,
+       * REJECT returns false right away, CALLER_RUNS runs the work on the
+       * calling thread and DROP_OLDEST throws away the oldest queued work, or
+       * rejects if other producers fill the room it made first.  It evicts at
+       * most one task per task added
+       */
+      enum Policy { BLOCK, BLOCK_TIMEOUT, REJECT, CALLER_RUNS, DROP_OLDEST };
+
+      /**
+       * The lanes work can be added to.  HIGH is for latency critical work and
+       * goes through the pool's own queue.  LOW is for bulk work and only runs
+       * when there is no HIGH work, or every high_weight HIGH tasks
+       */
+      enum Priority { HIGH, LOW };
+
+      /**
+       * The counters of one lane.  wait_micros is the total time the taken
+       * tasks spent queued
+       */
+      struct LaneStats {
+
+        uint64_t depth;
+        uint64_t taken;
+        uint64_t wait_micros;
+
+      };
+
+      /**
+       * The backpressure counters of a pool
+       */
+      struct Stats {
+
+        uint64_t rejected;
+        uint64_t dropped;
+        uint64_t caller_runs;
+        uint64_t blocked_micros;
+        uint32_t threads;
+        LaneStats lanes[2];
+
+      };
+
+      /**
+       * The settings of a pool
+       */
+      struct Config {
+
+        /**
+         * The number of worker threads
+         */
+        uint32_t p_size;
+
+        /**
+         * The scheduling mode
+         */
+        Mode mode;
+
+        /**
+         * The queue backend used in SHARED mode
+         */
+        Backend backend;
+
+        /**
+         * The number of queued tasks before the policy kicks in.  0 means the
+         * pool size in SHARED mode and unbounded in STEALING mode.  RING
+         * rounds it up to a power of two
+         */
+        uint32_t capacity;
+
+        /**
+         * What to do when the queue is at capacity
+         */
+        Policy policy;
+
+        /**
+         * How long BLOCK_TIMEOUT waits for room
+         */
+        uint64_t block_to_millis;
+
+        /**
+         * The most threads an elastic pool grows to.  The pool is elastic when
+         * this is above p_size, which is then the fewest threads it keeps
+         */
+        uint32_t max_size;
+
+        /**
+         * How long work may wait in the queue before an elastic pool adds a
+         * thread
+         */
+        uint64_t target_wait_micros;
+
+        /**
+         * How long a thread above p_size may sit idle before it exits
+         */
+        uint64_t idle_to_millis;
+
+        /**
+         * The cpus the workers are pinned to.  Empty leaves them to the
+         * scheduler.  Affinity::node_cpus gives the cpus of a NUMA node
+         */
+        std::vector<uint32_t> cpus;
+
+        /**
+         * How many HIGH tasks a worker runs before it lets a LOW one through
+         * while both lanes have work.  0 means LOW only runs when HIGH is empty
+         */
+        uint32_t high_weight;
+
+        Config(const uint32_t p_size, const Mode mode = SHARED);
+
+      };
+
     private:
 
       /**
-       * conditional variable to wait/notify on for the 
+       * A task and when it was queued
+       */
+      struct QueuedTask {
+
+        Task task;
+        uint64_t q_micros;
+
+      };
+
+      /**
+       * A worker's own deque of work used in STEALING mode
+       */
+      struct WorkerQueue {
+
+        std::mutex mutex;
+        std::deque<QueuedTask> tasks;
+
+      };
+
+      /**
+       * conditional variable to wait/notify on for the
        * producer
        */
       std::condition_variable p_cv;
 
       /**
-       * conditional variable to wait/notify on for the 
-       * consumer
+       * conditional variable to wait/notify on for the
+       * consumer.  In STEALING mode this is where idle workers park
        */
       std::condition_variable c_cv;
 
+      /**
+       * conditional variable to wait on for the workers to exit
+       */
+      std::condition_variable a_cv;
 
       /**
        * A mutex to lock critical sections
@@ -34,22 +206,327 @@ namespace asutils {
       /**
        * A queue that will hold the work
        */
-      std::queue<std::function<void()>> w_queue;
+      std::queue<QueuedTask> w_queue;
+
+      /**
+       * The LOW lane.  Guarded by the mutex
+       */
+      std::queue<QueuedTask> l_queue;
+
+      /**
+       * The size of the LOW lane so workers can skip the mutex when it is empty
+       */
+      std::atomic<int64_t> l_pending;
+
+      /**
+       * conditional variable for producers waiting on room in the LOW lane
+       */
+      std::condition_variable l_cv;
+
+      /**
+       * The per worker deques used in STEALING mode
+       */
+      std::vector<std::unique_ptr<WorkerQueue>> w_queues;
+
+      /**
+       * Work added from outside the pool in STEALING mode.  A worker whose own
+       * deque is empty takes the oldest and moves a share of the rest onto its
+       * deque under the same lock, so the workers only come back to it once
+       * per batch and only live workers ever see it
+       */
+      WorkerQueue inject;
+
+      /**
+       * Which of the w_queues have a live worker.  Guarded by the mutex
+       */
+      std::vector<bool> w_live;
+
+      /**
+       * The ring used by the RING backend
+       */
+      std::unique_ptr<RingQueue<QueuedTask>> r_queue;
+
+      /**
+       * The number of tasks sitting in the per worker deques or the ring.  It is
+       * counted after the push so it can briefly dip below zero
+       */
+      std::atomic<int64_t> pending;
+
+      /**
+       * The number of workers parked waiting for work
+       */
+      std::atomic<uint32_t> parked;
+
+      /**
+       * The number of producers parked waiting for room in the ring
+       */
+      std::atomic<uint32_t> p_parked;
 
       /**
        * The desired size of this pool
        */
       uint32_t p_size;
 
+      /**
+       * The number of tasks the shared queue can hold
+       */
+      uint32_t capacity;
+
+      /**
+       * The scheduling mode of this pool
+       */
+      Mode mode;
+
+      /**
+       * The queue backend of this pool
+       */
+      Backend backend;
+
+      /**
+       * What to do when the queue is at capacity
+       */
+      Policy policy;
+
+      /**
+       * How long BLOCK_TIMEOUT waits for room
+       */
+      uint64_t block_to_millis;
+
+      /**
+       * The backpressure counters
+       */
+      std::atomic<uint64_t> rejected;
+      std::atomic<uint64_t> dropped;
+      std::atomic<uint64_t> caller_runs;
+      std::atomic<uint64_t> blocked_micros;
+
+      /**
+       * The most threads this pool grows to
+       */
+      uint32_t max_size;
+
+      /**
+       * True if max_size is above p_size
+       */
+      bool elastic;
+
+      /**
+       * How long work may wait before the pool grows
+       */
+      uint64_t target_wait_micros;
 
       /**
-       * This method creates the threads that will live forever and 
-       * do work off of the w_queue
+       * How long a thread above p_size may sit idle
+       */
+      uint64_t idle_to_millis;
+
+      /**
+       * The cpus the workers are pinned to
+       */
+      std::vector<uint32_t> cpus;
+
+      /**
+       * How many HIGH tasks a worker runs before it lets a LOW one through
+       */
+      uint32_t high_weight;
+
+      /**
+       * The tasks taken and the micros they waited per lane
+       */
+      std::atomic<uint64_t> l_taken[2];
+      std::atomic<uint64_t> l_wait[2];
+
+      /**
+       * When a worker last took work
+       */
+      std::atomic<uint64_t> last_pop;
+
+      /**
+       * When the pool last grew
+       */
+      std::atomic<uint64_t> last_spawn;
+
+      /**
+       * Set when the pool is being destroyed
+       */
+      bool stop;
+
+      /**
+       * The number of worker threads still alive
+       */
+      uint32_t a_threads;
+
+      /**
+       * This method creates the threads that will live for the life of
+       * the pool and do work off of the w_queue
        */
       void build_worker_threads();
 
+      /**
+       * Starts one more worker thread.  Must be called holding the mutex
+       */
+      void start_worker();
+
+      /**
+       * Spawns a worker if the pool is elastic, below max_size and hasn't
+       * spawned one in the last target_wait_micros
+       */
+      void maybe_grow(const uint64_t now);
+
+      /**
+       * Records that a worker took work queued at q_micros off of lane and grows
+       * the pool if it waited longer than target_wait_micros
+       */
+      void note_pop(const uint64_t q_micros, const Priority lane);
+
+      /**
+       * True if a worker that ran streak HIGH tasks in a row should look at the
+       * LOW lane first
+       */
+      bool low_turn(const uint32_t streak);
+
+      /**
+       * Pops the oldest LOW task.  Must be called holding the mutex
+       */
+      bool pop_low(QueuedTask &work);
+
+      /**
+       * Pops the oldest LOW task, skipping the mutex when the lane is empty
+       */
+      bool try_low(QueuedTask &work);
+
+      /**
+       * Runs a task taken off of lane and updates the worker's streak
+       */
+      void run_task(QueuedTask &work, const Priority lane, uint32_t &streak);
+
+      /**
+       * Parks a worker holding lck until it is notified.  Returns false if the
+       * worker sat idle for idle_to_millis while the pool is above p_size and
+       * has to retire
+       */
+      bool park_worker(std::unique_lock<std::mutex> &lck, const uint32_t index);
+
+      /**
+       * True if there is queued work.  Must be called holding the mutex
+       */
+      bool has_work();
+
       void do_work();
 
+      /**
+       * The main loop for the threads in STEALING mode
+       */
+      void do_stealing_work(const uint32_t index);
+
+      /**
+       * Adds a task to lane, applying the policy when it is full.  Returns false
+       * if the task was rejected
+       */
+      bool add_task(Task &&work, const Priority lane);
+
+      /**
+       * Adds the task without blocking.  Only moves out of work when it succeeds
+       */
+      bool try_add(Task &work, const Priority lane);
+
+      /**
+       * Adds up to n tasks with one lock acquisition and wakes as many workers
+       * as there are new tasks.  The tasks that don't fit go through add_task.
+       * Returns how many were added
+       */
+      size_t add_tasks(Task *tasks, const size_t n, const Priority lane);
+
+      /**
+       * Grows an elastic pool when work queued at q_micros finds every worker
+       * busy and none of them has taken work in a while
+       */
+      void note_push(const uint64_t q_micros);
+
+      /**
+       * Adds the task to the LOW lane without blocking
+       */
+      bool try_add_low(Task &work, const uint64_t q_micros);
+
+      /**
+       * True if the lane has room.  Must be called holding the mutex
+       */
+      bool has_room(const Priority lane);
+
+      /**
+       * Parks the producer until the lane has room.  Returns false if the
+       * BLOCK_TIMEOUT deadline counted from start passes first
+       */
+      bool wait_for_room(const uint64_t start, const Priority lane);
+
+      /**
+       * Takes the oldest queued task out of the lane.  Returns false if there
+       * was nothing to take
+       */
+      bool take_oldest(Task &work, const Priority lane);
+
+      /**
+       * Wakes one producer parked waiting for room if there are any
+       */
+      void wake_producer();
+
+      /**
+       * The main loop for the threads with the RING backend
+       */
+      void do_ring_work();
+
+      /**
+       * Wakes one parked worker if there are any
+       */
+      void wake_worker();
+
+      /**
+       * Wakes up to n parked workers
+       */
+      void wake_workers(const size_t n);
+
+      /**
+       * Notifies up to n of the parked workers.  Must be called right after
+       * releasing the mutex the work was queued under
+       */
+      void notify_workers(const size_t n);
+
+      /**
+       * Adds work to the deque of the calling worker or to the shared injection
+       * queue if called from outside the pool.  Returns false if the pool has a
+       * capacity and it is reached
+       */
+      bool add_stealing_work(Task &work, const uint64_t q_micros);
+
+      /**
+       * Pops the newest work off the worker's own deque, then the oldest outside
+       * work along with a share of the rest, then steals the oldest work of a random victim.  Returns false if
+       * nothing was found
+       */
+      bool find_work(const uint32_t index, std::minstd_rand &rand, QueuedTask &work);
+
+      /**
+       * Takes the oldest outside work and moves up to half of what is left, at
+       * most BATCH_SIZE, onto own.  Returns false if there was none
+       */
+      bool take_inject(WorkerQueue &own, QueuedTask &work);
+
+      /**
+       * Takes the oldest work off of wq.  Returns false if it was empty
+       */
+      bool take_front(WorkerQueue &wq, QueuedTask &work);
+
+      /**
+       * Runs chunk(0) to chunk(n_chunks - 1) on the calling thread and up to
+       * p_size workers and waits for all of them to finish
+       */
+      void run_chunks(const size_t n_chunks, const std::function<void(size_t)> &chunk);
+
+      /**
+       * Marks a worker thread as exited
+       */
+      void exit_worker();
+
     public:
 
       /**
@@ -58,9 +535,184 @@ namespace asutils {
       ThreadPool(const uint32_t p_size);
 
       /**
-       * Adds work to be done
+       * The constructor adds a threadpool size and a scheduling mode
+       */
+      ThreadPool(const uint32_t p_size, const Mode mode);
+
+      /**
+       * The constructor takes the full pool settings
+       */
+      ThreadPool(const Config &config);
+
+      /**
+       * The destructor lets the workers finish the queued work and waits
+       * for them to exit
+       */
+      ~ThreadPool();
+
+      /**
+       * Adds work to be done.  What happens when the lane is at capacity is up
+       * to the pool's policy.  Returns false if the work was rejected
        */
-      void add_work(const std::function<void()> work); 
+      bool add_work(std::function<void()> work, const Priority lane = HIGH);
+
+      /**
+       * Adds any void() callable as work.  Captures up to Task::INLINE_SIZE
+       * bytes are moved through the queue without a heap allocation.  Returns
+       * false if the work was rejected
+       */
+      template<typename F>
+      bool post(F &&work, const Priority lane = HIGH) {
+
+        return add_task(Task(std::forward<F>(work)), lane);
+
+      }
+
+      /**
+       * Adds every task in [first, last) to lane.  Tasks are moved out of the
+       * range and queued BATCH_SIZE at a time under one lock acquisition, waking
+       * only as many workers as there is new work.  Elements can be Tasks or
+       * anything a Task can be built from.  Returns how many were added, the
+       * rest were rejected by the pool's policy and are moved to rejected if it
+       * is set, so the caller can retry them, or dropped otherwise
+       */
+      template<typename It>
+      size_t add_work_batch(It first, It last, const Priority lane = HIGH, std::vector<Task> *rejected = NULL) {
+
+        Task batch[BATCH_SIZE];
+        size_t added = 0;
+
+        while(first != last) {
+
+          size_t n = 0;
+          for(; first != last && n < BATCH_SIZE; ++first) {
+
+            batch[n++] = Task(std::move(*first));
+
+          }
+
+          added += add_tasks(batch, n, lane);
+
+          //whatever was added got moved out so what is left was turned away
+          for(size_t i=0; rejected != NULL && i < n; ++i) {
+
+            if(batch[i]) {
+
+              rejected->push_back(std::move(batch[i]));
+
+            }
+
+          }
+
+        }
+
+        return added;
+
+      }
+
+      /**
+       * Adds any void() callable as work if the lane has room right now.  It
+       * never blocks and ignores the policy so workers can use it to requeue
+       * themselves.  Returns false if the lane is full
+       */
+      template<typename F>
+      bool try_post(F &&work, const Priority lane = HIGH) {
+
+        Task task(std::forward<F>(work));
+        return try_add(task, lane);
+
+      }
+
+      /**
+       * Adds any callable as work and returns a future for its result.  The
+       * future's shared state costs one allocation, use post when nobody
+       * waits on the result.  If the work is rejected or dropped the future
+       * throws std::future_error (broken_promise)
+       */
+      template<typename F>
+      std::future<typename std::result_of<typename std::decay<F>::type()>::type> submit(F &&work,
+          const Priority lane = HIGH) {
+
+        typedef typename std::result_of<typename std::decay<F>::type()>::type R;
+
+        std::packaged_task<R()> task(std::forward<F>(work));
+        std::future<R> result = task.get_future();
+        add_task(Task(std::move(task)), lane);
+
+        return result;
+
+      }
+
+      /**
+       * Returns the backpressure counters, the number of live threads and the
+       * depth and wait of every lane
+       */
+      Stats get_stats();
+
+      /**
+       * Splits [begin, end) into chunks of grain indices and calls body(lo, hi)
+       * for every chunk across the pool.  The calling thread works on chunks
+       * too and returns once all of them are done.  The first exception thrown
+       * by body is rethrown here.  Called from a worker of a SHARED pool it can
+       * block on a full queue, STEALING pools never do
+       */
+      template<typename F>
+      void parallel_for(const size_t begin, const size_t end, const size_t grain, F &&body) {
+
+        if(end <= begin) {
+
+          return;
+
+        }
+
+        size_t g = std::max(grain, (size_t)1);
+        size_t n_chunks = (end - begin + g - 1) / g;
+
+        run_chunks(n_chunks, [begin, end, g, &body](size_t c) {
+
+          size_t lo = begin + c * g;
+          body(lo, std::min(end, lo + g));
+
+        });
+
+      }
+
+      /**
+       * Splits [begin, end) into chunks of grain indices, maps every chunk to a
+       * T with map(lo, hi) across the pool and folds the results in chunk order
+       * with combine(T, T) starting from identity
+       */
+      template<typename T, typename M, typename C>
+      T parallel_reduce(const size_t begin, const size_t end, const size_t grain, const T identity,
+          M &&map, C &&combine) {
+
+        if(end <= begin) {
+
+          return identity;
+
+        }
+
+        size_t g = std::max(grain, (size_t)1);
+        size_t n_chunks = (end - begin + g - 1) / g;
+        std::vector<T> partials(n_chunks, identity);
+
+        run_chunks(n_chunks, [begin, end, g, &map, &partials](size_t c) {
+
+          size_t lo = begin + c * g;
+          partials[c] = map(lo, std::min(end, lo + g));
+
+        });
+
+        T result = identity;
+        for(size_t c=0; c < n_chunks; ++c) {
+
+          result = combine(result, partials[c]);
+
+        }
+
+        return result;
+
+      }
 
   };
 
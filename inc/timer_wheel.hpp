@@ -0,0 +1,200 @@
+#ifndef AS_UTILS_TIMER_WHEEL_HPP
+#define AS_UTILS_TIMER_WHEEL_HPP
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <log4cpp/Category.hh>
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+namespace asutils {
+
+  /**
+   * A hierarchical timer wheel.  Timers are kept in LEVELS wheels of SLOTS
+   * slots each, where a slot of level n spans SLOTS^n ticks, so scheduling
+   * and cancelling are O(1) and a tick only touches the slot that is due.
+   * Timers in a higher level cascade down when their slot comes up.  A driver
+   * thread ticks the wheel off of a timerfd and hands whatever expired to a
+   * ThreadPool in one batch
+   */
+  class TimerWheel {
+
+    public:
+
+      /**
+       * The number of wheels and the slots in each one.  At the default 10ms
+       * tick the wheels cover about 16 months
+       */
+      static const uint32_t LEVELS = 4;
+      static const uint32_t SLOT_BITS = 8;
+      static const uint32_t SLOTS = 1 << SLOT_BITS;
+
+    private:
+
+      static log4cpp::Category &logger;
+
+      /**
+       * A scheduled timer.  It is linked into the slot it is waiting in
+       */
+      struct Timer {
+
+        uint64_t id;
+        uint64_t expire_tick;
+        Task task;
+        Timer **head;
+        Timer *prev;
+        Timer *next;
+
+      };
+
+      /**
+       * The pool expired timers run on
+       */
+      ThreadPool &pool;
+
+      /**
+       * The lane of the pool expired timers go to
+       */
+      ThreadPool::Priority lane;
+
+      /**
+       * How long a tick is
+       */
+      uint64_t tick_millis;
+
+      /**
+       * Guards the wheels, timers and c_tick
+       */
+      std::mutex mutex;
+
+      /**
+       * The heads of the slots of every level
+       */
+      Timer *wheels[LEVELS][SLOTS];
+
+      /**
+       * The pending timers by id so cancel doesn't have to search
+       */
+      std::unordered_map<uint64_t, Timer*> timers;
+
+      /**
+       * The next tick to process
+       */
+      uint64_t c_tick;
+
+      /**
+       * When tick 0 was in monotonic millis
+       */
+      uint64_t start_millis;
+
+      /**
+       * The id of the next timer.  0 is never handed out
+       */
+      uint64_t next_id;
+
+      /**
+       * The timerfd the driver waits on or -1 if it sleeps instead
+       */
+      int32_t t_fd;
+
+      /**
+       * Set when the wheel is being destroyed
+       */
+      std::atomic<bool> stop;
+
+      /**
+       * The driver thread
+       */
+      std::thread d_thread;
+
+      /**
+       * Links a timer into the slot for its expire tick.  Must be called
+       * holding the mutex
+       */
+      void link(Timer *timer);
+
+      /**
+       * Unlinks a timer from its slot.  Must be called holding the mutex
+       */
+      void unlink(Timer *timer);
+
+      /**
+       * Returns the head of the slot a timer expiring at expire_tick goes in.
+       * Must be called holding the mutex
+       */
+      Timer **slot_for(const uint64_t expire_tick);
+
+      /**
+       * Moves every timer in the current slot of level down to where it belongs
+       * now.  Returns the index of the slot.  Must be called holding the mutex
+       */
+      uint32_t cascade(const uint32_t level);
+
+      /**
+       * Processes one tick, moving the tasks of the expired timers into expired.
+       * Must be called holding the mutex
+       */
+      void tick(std::vector<Task> &expired);
+
+      /**
+       * The driver loop
+       */
+      void run();
+
+      /**
+       * Schedules a task to run after delay_millis and returns its id
+       */
+      uint64_t schedule_task(const uint64_t delay_millis, Task &&task);
+
+    public:
+
+      /**
+       * The constructor takes the pool and lane expired timers run on and the
+       * tick length.  The driver waits on a timerfd unless use_timerfd is false,
+       * in which case it sleeps between ticks
+       */
+      TimerWheel(ThreadPool &pool, const ThreadPool::Priority lane = ThreadPool::HIGH,
+          const uint64_t tick_millis = 10, const bool use_timerfd = true);
+
+      /**
+       * The destructor stops the driver.  Timers that haven't fired are dropped
+       */
+      ~TimerWheel();
+
+      TimerWheel(const TimerWheel &) = delete;
+      TimerWheel &operator=(const TimerWheel &) = delete;
+
+      /**
+       * Schedules any void() callable to run on the pool after delay_millis,
+       * rounded up to a whole tick.  Returns an id for cancel
+       */
+      template<typename F>
+      uint64_t schedule(const uint64_t delay_millis, F &&work) {
+
+        return schedule_task(delay_millis, Task(std::forward<F>(work)));
+
+      }
+
+      /**
+       * Cancels a timer.  Returns false if it already fired or was cancelled
+       */
+      bool cancel(const uint64_t id);
+
+      /**
+       * Returns the number of pending timers
+       */
+      size_t size();
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "buffered_reader.hpp"
+#include "utils.hpp"
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+using namespace asutils;
+
+/**
+ * The byte at a time loop BufferedReader::read used to run, kept here as
+ * the baseline
+ */
+static void bytewise_read(const char *data, size_t size, const char del, std::vector<char> &buffer,
+    std::function<void(std::vector<char>)> &call_back) {
+
+  for(size_t i=0; i < size; ++i) {
+
+    if(data[i] != del) {
+
+      buffer.push_back(data[i]);
+
+    } else {
+
+      call_back(buffer);
+      buffer.clear();
+
+    }
+
+  }
+
+}
+
+void buffered_reader_bench() {
+
+  //what a socket read hands us at a time
+  const size_t r_size = 64 * 1024;
+  const size_t total = 64 * 1024 * 1024;
+  const char del = (char) 4;
+
+  printf("BufferedReader: %lu MB in %lu KB reads\n", (unsigned long)(total >> 20), (unsigned long)(r_size >> 10));
+  printf("%-10s %10s %14s %14s\n", "frame", "frames", "bytewise MB/s", "memchr MB/s");
+
+  for(size_t f_size : {16, 256, 4 * 1024, 64 * 1024, 1024 * 1024}) {
+
+    //frames of f_size bytes including the del
+    std::vector<char> data(total);
+    for(size_t i=0; i < total; ++i) {
+
+      data[i] = (i % f_size == f_size - 1) ? del : 'a' + (i % 26);
+
+    }
+
+    size_t frames = 0;
+    std::function<void(std::vector<char>)> call_back = [&frames](std::vector<char> frame) { frames++; };
+
+    std::vector<char> buffer;
+    uint64_t start = Utils::epoch_micros_now();
+    for(size_t i=0; i < total; i += r_size) {
+
+      bytewise_read(&data[i], r_size, del, buffer, call_back);
+
+    }
+    uint64_t b_micros = Utils::epoch_micros_now() - start;
+
+    BufferedReader br(del, call_back);
+    start = Utils::epoch_micros_now();
+    for(size_t i=0; i < total; i += r_size) {
+
+      br.read(&data[i], r_size);
+
+    }
+    uint64_t m_micros = Utils::epoch_micros_now() - start;
+
+    printf("%-10lu %10lu %14.1f %14.1f\n", (unsigned long)f_size, (unsigned long)frames / 2,
+        total / (b_micros + 1.0), total / (m_micros + 1.0));
+
+  }
+
+}
@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+/**
+ * The benchmarks to run.  Each one prints its own results
+ */
+void thread_pool_bench();
+void buffered_reader_bench();
+
+int main(int argc, char **argv) {
+
+  thread_pool_bench();
+  buffered_reader_bench();
+
+  return 0;
+
+}
@@ -0,0 +1,114 @@
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include <string>
+
+using namespace asutils;
+
+/**
+ * Pushes tc empty tasks through the pool from np producer threads, batch at a
+ * time, and returns how long it took in micros
+ */
+static uint64_t run_producers(const ThreadPool::Config &config, const uint32_t np, const uint32_t tc,
+    const uint32_t batch) {
+
+  std::atomic<uint32_t> done(0);
+  uint64_t start = Utils::epoch_micros_now();
+
+  {
+
+    ThreadPool tp(config);
+
+    std::vector<std::thread> producers;
+    for(uint32_t p=0; p < np; ++p) {
+
+      producers.emplace_back([&tp, &done, np, tc, batch]() {
+
+        if(batch == 1) {
+
+          for(uint32_t i=0; i < tc / np; ++i) {
+
+            tp.add_work([&done]() { done++; });
+
+          }
+
+          return;
+
+        }
+
+        std::vector<Task> work;
+        for(uint32_t i=0; i < tc / np; i += batch) {
+
+          for(uint32_t j=0; j < batch; ++j) {
+
+            work.emplace_back([&done]() { done++; });
+
+          }
+
+          tp.add_work_batch(work.begin(), work.end());
+          work.clear();
+
+        }
+
+      });
+
+    }
+
+    for(std::thread &t : producers) {
+
+      t.join();
+
+    }
+
+    //the destructor waits for the queue to drain
+  }
+
+  return Utils::epoch_micros_now() - start;
+
+}
+
+void thread_pool_bench() {
+
+  const uint32_t tc = 1 << 20;
+  const uint32_t p_size = std::thread::hardware_concurrency();
+
+  printf("ThreadPool: %u tasks, %u workers\n", tc, p_size);
+  printf("%-24s %10s %6s %12s %12s\n", "queue", "producers", "batch", "micros", "ns/task");
+
+  std::vector<std::pair<std::string, ThreadPool::Config>> configs;
+
+  //what SocketServer and SocketClient used to get
+  ThreadPool::Config locking(p_size);
+  configs.emplace_back("locking (cap=p_size)", locking);
+
+  locking.capacity = 1024;
+  configs.emplace_back("locking (cap=1024)", locking);
+
+  ThreadPool::Config ring(p_size);
+  ring.backend = ThreadPool::RING;
+  ring.capacity = 1024;
+  configs.emplace_back("ring (cap=1024)", ring);
+
+  ThreadPool::Config stealing(p_size, ThreadPool::STEALING);
+  configs.emplace_back("stealing", stealing);
+
+  for(auto &c : configs) {
+
+    for(uint32_t np : {1, 4, 16, 64}) {
+
+      //one add_work per task against one add_work_batch per epoll sized batch
+      for(uint32_t batch : {1, 64}) {
+
+        uint64_t micros = run_producers(c.second, np, tc, batch);
+        printf("%-24s %10u %6u %12lu %12.1f\n", c.first.c_str(), np, batch, (unsigned long)micros,
+            (micros * 1000.0) / tc);
+
+      }
+
+    }
+
+  }
+
+}
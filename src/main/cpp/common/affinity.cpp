@@ -0,0 +1,137 @@
+#include "affinity.hpp"
+
+using namespace asutils;
+
+log4cpp::Category& Affinity::logger = log4cpp::Category::getRoot();
+
+/**
+ * Parses a kernel cpu list like 0-3,8-11 into the cpu ids.  Reversed ranges
+ * and cpus past CPU_SETSIZE are skipped
+ */
+std::vector<uint32_t> Affinity::parse_cpu_list(const std::string &list) {
+
+  std::vector<uint32_t> cpus;
+  size_t pos = 0;
+
+  while(pos < list.size()) {
+
+    size_t end = list.find(',', pos);
+    if(end == std::string::npos) {
+
+      end = list.size();
+
+    }
+
+    std::string range = list.substr(pos, end - pos);
+    size_t dash = range.find('-');
+
+    try {
+
+      unsigned long lo;
+      unsigned long hi;
+
+      if(dash == std::string::npos) {
+
+        lo = std::stoul(range);
+        hi = lo;
+
+      } else {
+
+        lo = std::stoul(range.substr(0, dash));
+        hi = std::stoul(range.substr(dash + 1));
+
+      }
+
+      //no cpu past CPU_SETSIZE can be pinned to so a range past it is garbage
+      if(hi < lo || hi >= CPU_SETSIZE) {
+
+        logger.error(std::string("Skipping a bad cpu range: ") + range);
+
+      } else {
+
+        for(unsigned long c=lo; c <= hi; ++c) {
+
+          cpus.push_back(c);
+
+        }
+
+      }
+
+    } catch(const std::exception &e) {
+
+      //whitespace and the trailing newline end up here
+    }
+
+    pos = end + 1;
+
+  }
+
+  return cpus;
+
+}
+
+/**
+ * Returns the cpus of a NUMA node or an empty vector if the node
+ * doesn't exist
+ */
+std::vector<uint32_t> Affinity::node_cpus(const uint32_t node) {
+
+  std::ifstream in(std::string("/sys/devices/system/node/node") + std::to_string(node) + "/cpulist");
+  std::string list;
+
+  if(!std::getline(in, list)) {
+
+    logger.error(std::string("Could not read the cpus of numa node ") + std::to_string(node));
+    return std::vector<uint32_t>();
+
+  }
+
+  return parse_cpu_list(list);
+
+}
+
+/**
+ * Pins a thread to the cpus.  An empty set leaves the thread alone.
+ * Returns false if the kernel refused
+ */
+bool Affinity::pin_thread(pthread_t thread, const std::vector<uint32_t> &cpus) {
+
+  if(cpus.empty()) {
+
+    return true;
+
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for(uint32_t c : cpus) {
+
+    if(c < CPU_SETSIZE) {
+
+      CPU_SET(c, &set);
+
+    }
+
+  }
+
+  int32_t result = pthread_setaffinity_np(thread, sizeof(set), &set);
+  if(result != 0) {
+
+    logger.error(std::string("Could not pin thread, error: ") + std::to_string(result));
+    return false;
+
+  }
+
+  return true;
+
+}
+
+/**
+ * Pins the calling thread to the cpus
+ */
+bool Affinity::pin_this_thread(const std::vector<uint32_t> &cpus) {
+
+  return pin_thread(pthread_self(), cpus);
+
+}
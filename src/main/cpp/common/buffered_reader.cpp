@@ -2,38 +2,823 @@
 
 using namespace asutils;
 
-BufferedReader::BufferedReader(){
+const size_t BufferedReader::PREFIX_SIZE;
+const size_t BufferedReader::MIN_READ;
+const size_t BufferedReader::MAX_READ;
+
+BufferedReader::BufferedReader() : BufferedReader(DELIMITED, 0, std::function<void(const char*, size_t)>()) {
 
 }
 
-BufferedReader::BufferedReader(const char del, std::function<void(std::vector<char>)> call_back) {
+BufferedReader::BufferedReader(const char del, std::function<void(std::vector<char>)> call_back) :
+  BufferedReader(DELIMITED, del, std::function<void(const char*, size_t)>()) {
 
-  this->del = del;
   this->call_back = call_back;
 
 }
 
 /**
- * This method will read up to the 'del' and call the function
+ * Constructor for a callback that gets a view of each frame instead of a
+ * copy
+ */
+BufferedReader::BufferedReader(const char del, std::function<void(const char *frame, size_t size)> v_call_back) :
+  BufferedReader(DELIMITED, del, v_call_back) {
+
+}
+
+/**
+ * Constructor for a view callback that picks the framing
+ */
+BufferedReader::BufferedReader(const Framing framing, const char del,
+    std::function<void(const char *frame, size_t size)> v_call_back) {
+
+  this->framing = framing;
+  this->del = del;
+  this->v_call_back = v_call_back;
+  this->max_frame = 0;
+  this->budget = 0;
+  this->gauge = NULL;
+  this->held = 0;
+  this->overflowed = false;
+  this->in_head = 0;
+  this->in_tail = 0;
+  this->in_scan = 0;
+  this->next_read = MIN_READ;
+  this->prepared = 0;
+  this->header_size = 0;
+  this->s_in_frame = false;
+  this->s_begun = false;
+  this->s_seen = 0;
+  this->s_left = 0;
+
+}
+
+/**
+ * Constructor for a streaming callback.  Frames are never buffered whole
+ */
+BufferedReader::BufferedReader(const Framing framing, const char del, const size_t header_size,
+    std::function<void(const Event event, const char *data, size_t size)> s_call_back) :
+  BufferedReader(framing, del, std::function<void(const char*, size_t)>()) {
+
+  this->header_size = header_size;
+  this->s_call_back = s_call_back;
+
+}
+
+/**
+ * Constructor for a callback that gets views of every frame one read
+ * completed at once
+ */
+BufferedReader::BufferedReader(const Framing framing, const char del,
+    std::function<void(const Frame *frames, size_t n)> b_call_back) :
+  BufferedReader(framing, del, std::function<void(const char*, size_t)>()) {
+
+  this->b_call_back = b_call_back;
+
+}
+
+/**
+ * The destructor takes what we hold off of the gauge
+ */
+BufferedReader::~BufferedReader() {
+
+  this->buffer.clear();
+  this->in_head = this->in_tail;
+  account();
+
+}
+
+/**
+ * Readers move but don't copy so the gauge counts every byte once
+ */
+BufferedReader::BufferedReader(BufferedReader &&other) : BufferedReader() {
+
+  *this = std::move(other);
+
+}
+
+/**
+ * Readers move but don't copy so the gauge counts every byte once
  */
-void BufferedReader::read(const char *data, size_t size) {
+BufferedReader &BufferedReader::operator=(BufferedReader &&other) {
+
+  if(this == &other) {
+
+    return *this;
+
+  }
 
-  for(size_t i=0; i < size; ++i) {
+  //let go of whatever we held first
+  this->buffer.clear();
+  this->in_head = this->in_tail;
+  account();
+
+  this->framing = other.framing;
+  this->del = other.del;
+  this->call_back = std::move(other.call_back);
+  this->v_call_back = std::move(other.v_call_back);
+  this->b_call_back = std::move(other.b_call_back);
+  this->s_call_back = std::move(other.s_call_back);
+  this->header_size = other.header_size;
+  this->s_in_frame = other.s_in_frame;
+  this->s_begun = other.s_begun;
+  this->s_seen = other.s_seen;
+  this->s_left = other.s_left;
+  this->o_call_back = std::move(other.o_call_back);
+  this->max_frame = other.max_frame;
+  this->budget = other.budget;
+  this->gauge = other.gauge;
+  this->overflowed = other.overflowed;
+
+  this->next_read = other.next_read;
+  this->prepared = other.prepared;
+
+  //the bytes other put on the gauge are ours now
+  this->buffer = std::move(other.buffer);
+  this->in = std::move(other.in);
+  this->in_head = other.in_head;
+  this->in_tail = other.in_tail;
+  this->in_scan = other.in_scan;
+  this->held = other.held;
+  other.buffer.clear();
+  other.in.clear();
+  other.in_head = 0;
+  other.in_tail = 0;
+  other.in_scan = 0;
+  other.held = 0;
+
+  return *this;
+
+}
+
+/**
+ * Bounds what we buffer and what we report to the gauge
+ */
+void BufferedReader::set_limits(const size_t max_frame, const size_t budget, std::function<void()> o_call_back,
+    std::atomic<int64_t> *gauge) {
+
+  this->max_frame = max_frame;
+  this->budget = budget;
+  this->o_call_back = o_call_back;
+
+  //move what we hold over to the new gauge
+  if(this->gauge != NULL) {
+
+    this->gauge->fetch_sub(this->held);
+
+  }
+
+  this->held = 0;
+  this->gauge = gauge;
+  account();
+
+}
+
+/**
+ * Returns true if a frame of size bytes is over max_frame
+ */
+bool BufferedReader::too_big(size_t size) {
+
+  return this->max_frame > 0 && size > this->max_frame;
+
+}
+
+/**
+ * Drops our buffer, marks us overflowed and calls the overflow callback
+ */
+bool BufferedReader::overflow() {
+
+  //the frames before the bad one are fine and still point into our buffers
+  flush();
+
+  this->overflowed = true;
+  std::vector<char>().swap(this->buffer);
+  std::vector<char>().swap(this->in);
+  this->in_head = 0;
+  this->in_tail = 0;
+  this->in_scan = 0;
+
+  if(this->o_call_back) {
+
+    this->o_call_back();
+
+  }
+
+  return false;
+
+}
+
+/**
+ * Gives back the buffer once a frame is done if it grew past the budget
+ */
+void BufferedReader::trim() {
+
+  if(this->budget > 0 && this->buffer.capacity() > this->budget) {
+
+    std::vector<char>().swap(this->buffer);
+
+  }
+
+}
+
+/**
+ * Returns the buffer capacity we hold
+ */
+size_t BufferedReader::capacity() {
+
+  return this->buffer.capacity() + this->in.capacity();
+
+}
+
+/**
+ * Brings the gauge up to date with what we hold
+ */
+void BufferedReader::account() {
 
-    if(data[i] != del) {
+  if(this->gauge == NULL) {
 
-      //we don't have a line yet so keep appending
-      this->buffer.push_back(data[i]);
+    return;
+
+  }
+
+  int64_t now = this->buffer.size() + (this->in_tail - this->in_head);
+  if(now != this->held) {
+
+    this->gauge->fetch_add(now - this->held);
+    this->held = now;
+
+  }
+
+}
+
+/**
+ * Writes the prefix of a LENGTH_PREFIXED frame of size bytes to result
+ */
+void BufferedReader::write_prefix(const uint32_t size, char *result) {
+
+  result[0] = (char) (size >> 24);
+  result[1] = (char) (size >> 16);
+  result[2] = (char) (size >> 8);
+  result[3] = (char) size;
+
+}
+
+/**
+ * Reads the prefix of a LENGTH_PREFIXED frame
+ */
+uint32_t BufferedReader::read_prefix(const char *prefix) {
+
+  const unsigned char *p = (const unsigned char *) prefix;
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+
+}
+
+/**
+ * Hands a complete frame to whichever callback we have
+ */
+void BufferedReader::deliver(const char *frame, size_t size) {
+
+  if(this->b_call_back) {
+
+    Frame f;
+    f.data = frame;
+    f.size = size;
+    this->batch.push_back(f);
+
+  } else if(this->v_call_back) {
+
+    this->v_call_back(frame, size);
+
+  } else {
+
+    this->call_back(std::vector<char>(frame, frame + size));
+
+  }
+
+}
+
+/**
+ * Hands the frames waiting in batch to the batch callback
+ */
+void BufferedReader::flush() {
+
+  if(!this->batch.empty()) {
+
+    this->b_call_back(this->batch.data(), this->batch.size());
+    this->batch.clear();
+
+  }
+
+}
+
+/**
+ * This method will read up to the end of every frame and call the function.
+ * Returns false once a frame went over the max frame size
+ */
+bool BufferedReader::read(const char *data, size_t size) {
+
+  if(this->overflowed) {
+
+    return false;
+
+  }
+
+  bool result;
+
+  if(this->s_call_back) {
+
+    result = stream(data, size);
+
+  } else if(this->framing == LENGTH_PREFIXED) {
+
+    result = read_prefixed(data, size);
+
+  } else {
+
+    result = read_delimited(data, size);
+
+  }
+
+  flush();
+  account();
+
+  return result;
+
+}
+
+/**
+ * Reads DELIMITED frames.  memchr finds the delimiters a vector at a time and
+ * every run between them is copied in bulk
+ */
+bool BufferedReader::read_delimited(const char *data, size_t size) {
+
+  const char *end = data + size;
+
+  while(data < end) {
+
+    const char *hit = (const char *) memchr(data, this->del, end - data);
+
+    if(hit == NULL) {
+
+      //we don't have a frame yet so keep the rest for later unless it is already too much
+      if(too_big(this->buffer.size() + (end - data))) {
+
+        return overflow();
+
+      }
+
+      this->buffer.insert(this->buffer.end(), data, end);
+      return true;
+
+    }
+
+    if(too_big(this->buffer.size() + (hit - data))) {
+
+      return overflow();
+
+    }
+
+    //we have a frame yay
+    if(this->buffer.empty()) {
+
+      //it is all in this read so it never touches our buffer
+      deliver(data, hit - data);
+
+    } else if(!this->call_back) {
+
+      this->buffer.insert(this->buffer.end(), data, hit);
+      deliver(this->buffer.data(), this->buffer.size());
+      //the views have to be done with before the buffer is reused
+      flush();
+      //and clear the local buffer, keeping its capacity for the next one if we can
+      this->buffer.clear();
+      trim();
 
     } else {
 
-      //we have a frame yay, set it into the result
-      this->call_back(this->buffer);
+      this->buffer.insert(this->buffer.end(), data, hit);
+      this->call_back(std::move(this->buffer));
       //and clear the local buffer
-      this->buffer.clear();     
+      this->buffer.clear();
+
+    }
+
+    //skip the del
+    data = hit + 1;
+
+  }
+
+  return true;
+
+}
+
+/**
+ * Reads LENGTH_PREFIXED frames.  Whole frames are viewed where they lie and
+ * only the pieces of a frame split across reads are buffered
+ */
+bool BufferedReader::read_prefixed(const char *data, size_t size) {
+
+  const char *end = data + size;
+
+  while(data < end) {
+
+    size_t left = end - data;
+
+    if(this->buffer.empty()) {
+
+      //jump from prefix to prefix while whole frames are in this read
+      if(left >= PREFIX_SIZE) {
+
+        uint32_t f_size = read_prefix(data);
+        if(too_big(f_size)) {
+
+          return overflow();
+
+        }
+
+        if(left - PREFIX_SIZE >= f_size) {
+
+          deliver(data + PREFIX_SIZE, f_size);
+          data += PREFIX_SIZE + f_size;
+          continue;
+
+        }
+
+      }
+
+    }
+
+    //the frame goes past this read so keep what we have of it, prefix first
+    if(this->buffer.size() < PREFIX_SIZE) {
+
+      size_t take = std::min(PREFIX_SIZE - this->buffer.size(), left);
+      this->buffer.insert(this->buffer.end(), data, data + take);
+      data += take;
+
+      if(this->buffer.size() < PREFIX_SIZE) {
+
+        continue;
+
+      }
+
+    }
+
+    //we know how big it is before we buffer a byte of it
+    size_t f_size = read_prefix(this->buffer.data());
+    if(too_big(f_size)) {
+
+      return overflow();
+
+    }
+
+    size_t take = std::min(PREFIX_SIZE + f_size - this->buffer.size(), (size_t) (end - data));
+    this->buffer.insert(this->buffer.end(), data, data + take);
+    data += take;
+
+    if(this->buffer.size() == PREFIX_SIZE + f_size) {
+
+      //we have a frame yay
+      deliver(this->buffer.data() + PREFIX_SIZE, f_size);
+      //the views have to be done with before the buffer is reused
+      flush();
+      //and clear the local buffer, keeping its capacity for the next one if we can
+      this->buffer.clear();
+      trim();
 
     }
 
   }
 
+  return true;
+
+}
+
+/**
+ * Returns writable space of at least the adaptive read size for a socket
+ * read to fill.  A partial frame is slid to the front instead of wrapping
+ * around so it can still be delivered in place once it is whole.  Past the
+ * budget a LENGTH_PREFIXED frame gets exactly its own size and anything else
+ * grows by half, never past max_frame plus the budget
+ */
+char *BufferedReader::prepare(size_t &space) {
+
+  if(this->in.size() - this->in_tail < this->next_read) {
+
+    if(this->in_head > 0) {
+
+      //slide the partial frame down over what was delivered
+      memmove(this->in.data(), this->in.data() + this->in_head, this->in_tail - this->in_head);
+      this->in_tail -= this->in_head;
+      this->in_scan -= this->in_head;
+      this->in_head = 0;
+
+    }
+
+    size_t need = this->in_tail + this->next_read;
+
+    //a partial LENGTH_PREFIXED frame tells us how big it is so a big one gets
+    //room for just itself and the read stops at its end
+    size_t f_end = 0;
+    if(!this->s_call_back && this->framing == LENGTH_PREFIXED && this->in_tail >= PREFIX_SIZE) {
+
+      f_end = PREFIX_SIZE + read_prefix(this->in.data());
+
+    }
+
+    if(this->budget > 0 && f_end > this->budget && f_end > this->in_tail) {
+
+      need = f_end;
+
+    }
+
+    if(this->in.size() < need) {
+
+      size_t grown = std::max(this->in.size() * 2, need);
+      if(this->budget > 0 && grown > this->budget) {
+
+        if(need == f_end) {
+
+          grown = f_end;
+
+        } else {
+
+          //a frame we can't see the end of grows by half so copies stay linear,
+          //but never past the biggest frame there can be and a read
+          grown = std::max(std::max(this->budget, this->in.size() + this->in.size() / 2), need);
+          if(this->max_frame > 0) {
+
+            grown = std::min(grown, std::max(need, this->max_frame + this->budget));
+
+          }
+
+        }
+
+      }
+
+      //resize alone would round the allocation up to whatever it likes
+      this->in.reserve(grown);
+      this->in.resize(grown);
+
+    }
+
+  }
+
+  space = this->in.size() - this->in_tail;
+  this->prepared = space;
+
+  return this->in.data() + this->in_tail;
+
+}
+
+/**
+ * Takes the n bytes the socket read into the prepared space and delivers
+ * every frame they complete straight out of it
+ */
+bool BufferedReader::commit(const size_t n) {
+
+  if(this->overflowed) {
+
+    return false;
+
+  }
+
+  //a read that filled everything we offered means there is more waiting, but
+  //reads don't grow past the budget
+  if(n == this->prepared && this->next_read < MAX_READ && (this->budget == 0 || this->next_read * 2 <= this->budget)) {
+
+    this->next_read *= 2;
+
+  } else if(n < this->prepared / 4 && this->next_read > MIN_READ) {
+
+    this->next_read /= 2;
+
+  }
+
+  this->in_tail += n;
+
+  //streaming keeps nothing in in so it is all fresh bytes
+  bool result = this->s_call_back ? stream(this->in.data() + this->in_head, n) : scan_in();
+  if(this->s_call_back) {
+
+    this->in_head = this->in_tail;
+
+  }
+
+  //one call for everything this read completed, before in moves
+  flush();
+
+  if(result && this->in_head == this->in_tail) {
+
+    //nothing partial is left so start over at the front
+    this->in_head = 0;
+    this->in_tail = 0;
+    this->in_scan = 0;
+
+    //and give back a buffer a big frame grew past the budget.  reads start
+    //small again so an idle connection doesn't hold on to anything
+    if(this->budget > 0 && this->in.capacity() > this->budget) {
+
+      std::vector<char>().swap(this->in);
+      this->next_read = MIN_READ;
+
+    }
+
+  }
+
+  account();
+
+  return result;
+
+}
+
+/**
+ * Delivers every whole frame in in
+ */
+bool BufferedReader::scan_in() {
+
+  while(this->in_head < this->in_tail) {
+
+    const char *base = this->in.data();
+    size_t left = this->in_tail - this->in_head;
+
+    if(this->framing == LENGTH_PREFIXED) {
+
+      if(left < PREFIX_SIZE) {
+
+        return true;
+
+      }
+
+      uint32_t f_size = read_prefix(base + this->in_head);
+      if(too_big(f_size)) {
+
+        return overflow();
+
+      }
+
+      if(left - PREFIX_SIZE < f_size) {
+
+        //the rest of it comes with the next read
+        return true;
+
+      }
+
+      this->in_head += PREFIX_SIZE + f_size;
+      deliver(base + this->in_head - f_size, f_size);
+
+    } else {
+
+      const char *from = base + std::max(this->in_scan, this->in_head);
+      const char *hit = (const char *) memchr(from, this->del, base + this->in_tail - from);
+
+      if(hit == NULL) {
+
+        if(too_big(left)) {
+
+          return overflow();
+
+        }
+
+        //the rest of it comes with the next read
+        this->in_scan = this->in_tail;
+        return true;
+
+      }
+
+      size_t f_size = hit - (base + this->in_head);
+      if(too_big(f_size)) {
+
+        return overflow();
+
+      }
+
+      //skip the del
+      this->in_head += f_size + 1;
+      this->in_scan = this->in_head;
+      deliver(base + this->in_head - f_size - 1, f_size);
+
+    }
+
+  }
+
+  return true;
+
+}
+
+/**
+ * Streams frames to the streaming callback keeping nothing but the header
+ */
+bool BufferedReader::stream(const char *data, size_t size) {
+
+  const char *end = data + size;
+
+  while(data < end || (this->s_in_frame && this->framing == LENGTH_PREFIXED && this->s_left == 0)) {
+
+    if(!this->s_in_frame) {
+
+      if(this->framing == LENGTH_PREFIXED) {
+
+        //the prefix sits in the buffer until it is whole
+        size_t take = std::min(PREFIX_SIZE - this->buffer.size(), (size_t) (end - data));
+        this->buffer.insert(this->buffer.end(), data, data + take);
+        data += take;
+
+        if(this->buffer.size() < PREFIX_SIZE) {
+
+          return true;
+
+        }
+
+        this->s_left = read_prefix(this->buffer.data());
+        this->buffer.clear();
+
+        if(too_big(this->s_left)) {
+
+          return overflow();
+
+        }
+
+      }
+
+      this->s_in_frame = true;
+      this->s_begun = false;
+      this->s_seen = 0;
+
+    }
+
+    //how much of the frame is in this read and whether it ends in it
+    size_t avail = end - data;
+    bool ends = false;
+    size_t skip = 0;
+
+    if(this->framing == LENGTH_PREFIXED) {
+
+      if(this->s_left <= avail) {
+
+        avail = this->s_left;
+        ends = true;
+
+      }
+
+    } else {
+
+      const char *hit = (const char *) memchr(data, this->del, avail);
+      if(hit != NULL) {
+
+        avail = hit - data;
+        ends = true;
+        skip = 1;
+
+      }
+
+    }
+
+    this->s_seen += avail;
+    if(this->framing == LENGTH_PREFIXED) {
+
+      this->s_left -= avail;
+
+    } else if(too_big(this->s_seen)) {
+
+      return overflow();
+
+    }
+
+    if(!this->s_begun) {
+
+      //the header is the only thing we buffer
+      size_t take = std::min(this->header_size - this->buffer.size(), avail);
+      this->buffer.insert(this->buffer.end(), data, data + take);
+      data += take;
+      avail -= take;
+
+      if(this->buffer.size() == this->header_size || ends) {
+
+        this->s_call_back(BEGIN, this->buffer.data(), this->buffer.size());
+        this->buffer.clear();
+        this->s_begun = true;
+
+      }
+
+    }
+
+    if(avail > 0) {
+
+      this->s_call_back(CHUNK, data, avail);
+      data += avail;
+
+    }
+
+    if(ends) {
+
+      this->s_call_back(END, NULL, 0);
+      this->s_in_frame = false;
+      data += skip;
+
+    }
+
+  }
+
+  return true;
+
 }
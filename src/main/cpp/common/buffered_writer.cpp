@@ -2,10 +2,126 @@
 
 using namespace asutils;
 
+const size_t BufferedWriter::CHUNK_SIZE;
+const size_t BufferedWriter::MAX_SPARE;
+const size_t BufferedWriter::MIN_SEGMENT;
+
 /**
  * Default constructor
  */
-BufferedWriter::BufferedWriter() {
+BufferedWriter::BufferedWriter() : total(0) {
+
+  this->gauge = NULL;
+
+}
+
+/**
+ * The destructor takes what we hold off of the gauge
+ */
+BufferedWriter::~BufferedWriter() {
+
+  account(-(int64_t) this->total.load());
+
+}
+
+/**
+ * Writers move but don't copy so the gauge counts every byte once
+ */
+BufferedWriter::BufferedWriter(BufferedWriter &&other) : BufferedWriter() {
+
+  *this = std::move(other);
+
+}
+
+/**
+ * Writers move but don't copy so the gauge counts every byte once
+ */
+BufferedWriter &BufferedWriter::operator=(BufferedWriter &&other) {
+
+  if(this == &other) {
+
+    return *this;
+
+  }
+
+  //let go of whatever we held first
+  account(-(int64_t) this->total.load());
+
+  this->chunks = std::move(other.chunks);
+  this->spare = std::move(other.spare);
+  this->total = other.total.load();
+  this->gauge = other.gauge;
+  this->oldest = other.oldest;
+
+  //the bytes are ours now so the other one has nothing to take off
+  other.chunks.clear();
+  other.total = 0;
+
+  return *this;
+
+}
+
+/**
+ * Adds the bytes this writer holds to gauge from now on
+ */
+void BufferedWriter::set_gauge(std::atomic<int64_t> *gauge) {
+
+  if(this->gauge != NULL) {
+
+    *this->gauge -= this->total.load();
+
+  }
+
+  this->gauge = gauge;
+
+  if(this->gauge != NULL) {
+
+    *this->gauge += this->total.load();
+
+  }
+
+}
+
+/**
+ * Adds delta to what we hold and to the gauge
+ */
+void BufferedWriter::account(const int64_t delta) {
+
+  this->total += delta;
+
+  if(this->gauge != NULL) {
+
+    *this->gauge += delta;
+
+  }
+
+}
+
+/**
+ * Appends an empty chunk, reusing a spare one if there is any
+ */
+void BufferedWriter::add_chunk() {
+
+  Chunk chunk;
+  chunk.fd = -1;
+  chunk.offset = 0;
+  chunk.head = 0;
+  chunk.tail = 0;
+
+  if(!this->spare.empty()) {
+
+    chunk.data = std::move(this->spare.back());
+    this->spare.pop_back();
+
+  } else {
+
+    chunk.data.resize(CHUNK_SIZE);
+
+  }
+
+  chunk.base = chunk.data.data();
+  this->chunks.push_back(std::move(chunk));
+
 }
 
 /**
@@ -13,11 +129,131 @@ BufferedWriter::BufferedWriter() {
  */
 void BufferedWriter::write(const char *msg_frame, size_t size) {
 
-  for(uint32_t i=0; i < size; ++i) {
+  if(this->total == 0 && size > 0) {
 
-    this->buffer.emplace_back(msg_frame[i]);
+    this->oldest = std::chrono::steady_clock::now();
 
   }
+
+  account(size);
+
+  while(size > 0) {
+
+    //only our own chunks are appended to, handed over buffers and files have no
+    //data of their own
+    if(this->chunks.empty() || this->chunks.back().data.empty() ||
+        this->chunks.back().tail == this->chunks.back().data.size()) {
+
+      add_chunk();
+
+    }
+
+    Chunk &chunk = this->chunks.back();
+    size_t take = std::min(size, chunk.data.size() - chunk.tail);
+    memcpy(chunk.data.data() + chunk.tail, msg_frame, take);
+
+    chunk.tail += take;
+    msg_frame += take;
+    size -= take;
+
+  }
+
+}
+
+/**
+ * Queues a buffer without copying it.  data stays valid as long as keep
+ * lives
+ */
+void BufferedWriter::write(const char *data, size_t size, std::shared_ptr<const void> keep) {
+
+  if(size < MIN_SEGMENT || !keep) {
+
+    write(data, size);
+    return;
+
+  }
+
+  if(this->total == 0) {
+
+    this->oldest = std::chrono::steady_clock::now();
+
+  }
+
+  Chunk chunk;
+  chunk.keep = std::move(keep);
+  chunk.base = data;
+  chunk.fd = -1;
+  chunk.offset = 0;
+  chunk.head = 0;
+  chunk.tail = size;
+
+  this->chunks.push_back(std::move(chunk));
+  account(size);
+
+}
+
+/**
+ * Takes ownership of buffer and queues it without copying
+ */
+void BufferedWriter::write(std::vector<char> &&buffer) {
+
+  if(buffer.size() < MIN_SEGMENT) {
+
+    write(buffer.data(), buffer.size());
+    return;
+
+  }
+
+  std::shared_ptr<std::vector<char>> owned = std::make_shared<std::vector<char>>(std::move(buffer));
+  write(owned->data(), owned->size(), owned);
+
+}
+
+/**
+ * Takes ownership of buffer and queues it without copying
+ */
+void BufferedWriter::write(std::string &&buffer) {
+
+  if(buffer.size() < MIN_SEGMENT) {
+
+    write(buffer.data(), buffer.size());
+    return;
+
+  }
+
+  std::shared_ptr<std::string> owned = std::make_shared<std::string>(std::move(buffer));
+  write(owned->data(), owned->size(), owned);
+
+}
+
+/**
+ * Queues size bytes of fd from offset without reading them
+ */
+void BufferedWriter::write_file(const int32_t fd, const off_t offset, size_t size, std::shared_ptr<const void> keep) {
+
+  if(size == 0) {
+
+    return;
+
+  }
+
+  if(this->total == 0) {
+
+    this->oldest = std::chrono::steady_clock::now();
+
+  }
+
+  Chunk chunk;
+  chunk.keep = std::move(keep);
+  chunk.base = NULL;
+  chunk.fd = fd;
+  chunk.offset = offset;
+  chunk.head = 0;
+  chunk.tail = size;
+
+  this->chunks.push_back(std::move(chunk));
+  account(size);
+
 }
 
 /**
@@ -25,20 +261,118 @@ void BufferedWriter::write(const char *msg_frame, size_t size) {
  */
 void BufferedWriter::iread(char *r_buffer, size_t size) {
 
-  for(uint32_t i=0; i < size; ++i){
+  for(auto it = this->chunks.begin(); size > 0 && it != this->chunks.end(); ++it) {
+
+    size_t take = std::min(size, it->tail - it->head);
+
+    if(it->fd >= 0) {
+
+      //file bytes have to be read in
+      if(pread(it->fd, r_buffer, take, it->offset + it->head) != (ssize_t) take) {
+
+        memset(r_buffer, 0, take);
+
+      }
 
-    r_buffer[i] = this->buffer[i];
+    } else {
+
+      memcpy(r_buffer, it->base + it->head, take);
+
+    }
+
+    r_buffer += take;
+    size -= take;
 
   }
 
 }
 
+/**
+ * Points up to max iovecs at the pending bytes in order, without copying
+ * them
+ */
+size_t BufferedWriter::peek(struct iovec *iov, size_t max) {
+
+  size_t n = 0;
+
+  for(auto it = this->chunks.begin(); n < max && it != this->chunks.end(); ++it) {
+
+    if(it->fd >= 0) {
+
+      //a file goes out on its own
+      break;
+
+    }
+
+    if(it->head == it->tail) {
+
+      continue;
+
+    }
+
+    iov[n].iov_base = (void*) (it->base + it->head);
+    iov[n].iov_len = it->tail - it->head;
+    n++;
+
+  }
+
+  return n;
+
+}
+
+/**
+ * Returns true if the next bytes to go are in a file and where they are
+ */
+bool BufferedWriter::file(int32_t &fd, off_t &offset, size_t &size) {
+
+  if(this->chunks.empty() || this->chunks.front().fd < 0) {
+
+    return false;
+
+  }
+
+  Chunk &chunk = this->chunks.front();
+  fd = chunk.fd;
+  offset = chunk.offset + chunk.head;
+  size = chunk.tail - chunk.head;
+
+  return true;
+
+}
+
 /**
  * This method clears this many bytes from the buffer
  */
 void BufferedWriter::clear(size_t size) {
 
-  this->buffer.erase(this->buffer.begin(), this->buffer.begin() + size);
+  size = std::min(size, this->total.load());
+  account(-(int64_t) size);
+
+  while(size > 0) {
+
+    Chunk &chunk = this->chunks.front();
+    size_t take = std::min(size, chunk.tail - chunk.head);
+    chunk.head += take;
+    size -= take;
+
+    if(chunk.head < chunk.tail) {
+
+      break;
+
+    }
+
+    //done with this one, keep a few of ours around so a busy connection doesn't
+    //allocate.  a handed over buffer is let go of right here
+    if(!chunk.data.empty() && this->spare.size() < MAX_SPARE) {
+
+      this->spare.push_back(std::move(chunk.data));
+
+    }
+
+    this->chunks.pop_front();
+
+  }
+
 }
 
 /**
@@ -46,6 +380,15 @@ void BufferedWriter::clear(size_t size) {
  */
 size_t BufferedWriter::size() {
 
-  return this->buffer.size();
+  return this->total;
+
+}
+
+/**
+ * Returns when the oldest bytes still in the buffer were written
+ */
+std::chrono::steady_clock::time_point BufferedWriter::since() {
+
+  return this->oldest;
 
 }
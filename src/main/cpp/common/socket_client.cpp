@@ -5,23 +5,33 @@ using namespace asutils;
 log4cpp::Category& SocketClient::logger = log4cpp::Category::getRoot();
 
 /**
- * Default constructor takes a vector of host:port
+ * The settings for the connect pool.  It keeps one thread and grows to one
+ * per host when connects to several hosts block at once
  */
-SocketClient::SocketClient(std::vector<std::string> desired_hosts) : r_tp(std::thread::hardware_concurrency()),
-  w_tp(std::thread::hardware_concurrency()) {
+static ThreadPool::Config connect_pool_config(const size_t n_hosts) {
+
+  ThreadPool::Config config(1, ThreadPool::STEALING);
+  config.max_size = n_hosts > 1 ? n_hosts : 1;
+
+  return config;
+
+}
+
+/**
+ * Default constructor takes a vector of host:port, the framing the
+ * servers use and the bounds on what a connection can make us buffer
+ */
+SocketClient::SocketClient(std::vector<std::string> desired_hosts, const BufferedReader::Framing framing,
+    const SocketUtils::Limits &limits) : r_tp(SocketUtils::io_pool_config()),
+  w_tp(SocketUtils::io_pool_config()), c_tp(connect_pool_config(desired_hosts.size())), timers(r_tp, ThreadPool::LOW), w_bytes(0), q_bytes(0),
+  w_frames(0), w_sends(0) {
 
     //ignore sigpipe
     std::signal(SIGPIPE, SIG_IGN);
 
     this->desired_hosts = desired_hosts;
-
-    //start the zombied reaper
-    std::thread z_thread (&SocketClient::reap_resources, this);
-    z_thread.detach();
-
-    //start a thread that will attempt to reconnect to hosts
-    std::thread r_thread (&SocketClient::retry_conn, this);
-    r_thread.detach();
+    this->framing = framing;
+    this->limits = limits;
 
   }
 
@@ -42,10 +52,9 @@ uint32_t SocketClient::connect_to_hosts() {
 
     } else {
 
-      //add this host to the failed list to reattempt later
-      this->eh_mutex.lock();
-      this->e_hosts.push_back(t);
-      this->eh_mutex.unlock();
+      //reattempt later
+      schedule_connect(RETRY_MILLIS, [this, t]() { this->retry_conn(t, RETRY_MILLIS); });
+
     }
 
   }
@@ -149,7 +158,7 @@ bool SocketClient::make_connection(std::string node) {
         //create some epoll callback
 
         //this one is for reading data
-        std::function<void(int32_t, int32_t)> read_callback = [this](int32_t ep_sfd, int32_t sfd) {
+        std::function<Task(int32_t, int32_t)> read_callback = [this](int32_t ep_sfd, int32_t sfd) {
 
           //turn off EPOLLIN notifications for this sfd
           this->e_mutex.lock();
@@ -157,14 +166,14 @@ bool SocketClient::make_connection(std::string node) {
           SocketUtils::set_epoll(ep_sfd, sfd, this->sfd_events[sfd]);
           this->e_mutex.unlock();
 
-          //add the read to our processing threadpool
-          std::function<void()> process_f = [this, ep_sfd, sfd]() { this->read(ep_sfd, sfd); };
-          r_tp.add_work(process_f);
+          //queue the read on the sfd's strand and hand back the strand for our
+          //processing threadpool if it isn't already scheduled
+          return read_strand(sfd)->enqueue(Task([this, ep_sfd, sfd]() { this->read(ep_sfd, sfd); }));
 
         };
 
         //this one is for writing data
-        std::function<void(int32_t, int32_t)> write_callback = [this](int32_t ep_sfd, int32_t sfd) {
+        std::function<Task(int32_t, int32_t)> write_callback = [this](int32_t ep_sfd, int32_t sfd) {
 
           //turn off EPOLLOUT notifications for this sfd
           this->e_mutex.lock();
@@ -172,9 +181,9 @@ bool SocketClient::make_connection(std::string node) {
           SocketUtils::set_epoll(ep_sfd, sfd, this->sfd_events[sfd]);
           this->e_mutex.unlock();
 
-          //add the write to our write threadpool
-          std::function<void()> write_f = [this, ep_sfd, sfd]() { this->write(ep_sfd, sfd); };
-          w_tp.add_work(write_f);
+          //queue the write on the sfd's strand and hand back the strand for our
+          //write threadpool if it isn't already scheduled
+          return write_strand(sfd)->enqueue(Task([this, ep_sfd, sfd]() { this->write(ep_sfd, sfd); }));
 
         };
 
@@ -197,51 +206,54 @@ bool SocketClient::make_connection(std::string node) {
 }
 
 /**
- * This method continuously tries to reconnect to nodes
- * that were could not be connected to 
+ * Tries to reconnect to a host that either failed to connect or lost its
+ * connection.  If it fails again it schedules another try, backing off
+ * from delay_millis
  */
-void SocketClient::retry_conn() {
+void SocketClient::retry_conn(const std::string node, const uint64_t delay_millis) {
 
-  while(1) {
+  logger.info(std::string("Attempting to reconnect to host: ") + node);
 
-    //sleep for a bit and try again
-    std::this_thread::sleep_for(std::chrono::seconds(10));
+  if(!make_connection(node)) {
 
-    this->eh_mutex.lock();
+    //wait twice as long next time up to a limit
+    uint64_t n_delay = delay_millis * 2;
+    if(n_delay > MAX_RETRY_MILLIS) {
 
-    //a vector to hold the indices of the successfully reconnected nodes
-    std::vector<uint32_t> sci;
-    for(uint32_t i=0; i < this->e_hosts.size(); ++i) {
+      n_delay = MAX_RETRY_MILLIS;
 
-      logger.info(std::string("Attempting to reconnect to host: ") + std::string(this->e_hosts[i]));
-      if(make_connection(this->e_hosts[i])) {
+    }
 
-        //if connection was successfull we need to remove it 
-        //from this list
-        sci.push_back(i);
 
-      }
+    schedule_connect(n_delay, [this, node, n_delay]() { this->retry_conn(node, n_delay); });
 
-    }
+  }
 
-    for(uint32_t i=0; i < sci.size(); ++i) {
+}
 
-      //remove the successfully reconnected hosts
-      this->e_hosts.erase(this->e_hosts.begin() + sci[i]);
+/**
+ * Runs work that connects to hosts on the connect pool after delay_millis
+ */
+void SocketClient::schedule_connect(const uint64_t delay_millis, std::function<void()> work) {
 
-    }
+  //the timers fire on a read worker so they only hand the work over
+  this->timers.schedule(delay_millis, [this, work = std::move(work)]() mutable {
 
-    this->eh_mutex.unlock();
+    if(!this->c_tp.add_work(std::move(work))) {
 
-  }
+      logger.error("Dropped a reconnect the connect pool had no room for");
+
+    }
+
+  });
 
 }
 
 /**
  * This method loops for all of eternity to process e poll events
  */
-void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32_t, int32_t)> read_callback,
-    std::function<void(int32_t, int32_t)> write_callback) {
+void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<Task(int32_t, int32_t)> read_callback,
+    std::function<Task(int32_t, int32_t)> write_callback) {
 
   struct epoll_event *e_events;
 
@@ -250,10 +262,18 @@ void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32
   uint8_t max_events = 64;
   e_events = (epoll_event*)calloc (max_events, sizeof(epoll_event));
 
+  //the reads and writes of one epoll batch are handed to the pools together
+  std::vector<Task> r_batch;
+  std::vector<Task> w_batch;
+  std::vector<Task> r_rejected;
+  std::vector<Task> w_rejected;
+  r_batch.reserve(max_events);
+  w_batch.reserve(max_events);
+
   while(1) {
 
-    //lets wait for events here for ever
-    int32_t n_events = epoll_wait(ep_sfd, e_events, max_events, -1);
+    //lets wait for events here for ever, unless there are turned away runners to hand over again
+    int32_t n_events = epoll_wait(ep_sfd, e_events, max_events, r_batch.empty() && w_batch.empty() ? -1 : 1);
 
     if(n_events < 0 ) {
 
@@ -287,7 +307,12 @@ void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32
 
           //if we are in this block then we have data to read yo!
           //let's call the read_callback provided
-          read_callback(ep_sfd, e_events[i].data.fd);
+          Task r_task = read_callback(ep_sfd, e_events[i].data.fd);
+          if(r_task) {
+
+            r_batch.push_back(std::move(r_task));
+
+          }
 
         } 
 
@@ -295,7 +320,12 @@ void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32
 
           //if we are in this block then we are able to write
           //call the callback
-          write_callback(ep_sfd, e_events[i].data.fd);
+          Task w_task = write_callback(ep_sfd, e_events[i].data.fd);
+          if(w_task) {
+
+            w_batch.push_back(std::move(w_task));
+
+          }
 
         } 
 
@@ -303,6 +333,16 @@ void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32
 
     }
 
+    //one lock and just enough wake ups per pool for the whole batch
+    this->r_tp.add_work_batch(r_batch.begin(), r_batch.end(), ThreadPool::HIGH, &r_rejected);
+    this->w_tp.add_work_batch(w_batch.begin(), w_batch.end(), ThreadPool::HIGH, &w_rejected);
+    r_batch.clear();
+    w_batch.clear();
+
+    //a turned away runner is still the only runner of its strand so it goes again next time around
+    r_batch.swap(r_rejected);
+    w_batch.swap(w_rejected);
+
   }
 
 }
@@ -313,152 +353,315 @@ void SocketClient::process_epoll_events(int32_t ep_sfd, std::function<void(int32
  */
 void SocketClient::read(int32_t ep_sfd, int32_t sfd) {
 
-  //the callback for once we have a full message frame
-  std::function<void(std::vector<char>)> call_back = [sfd, ep_sfd, this](std::vector<char> msg_frame) {
+  //grab a lock and get our buffered reader.  read_strand made it
+  this->r_mutex.lock();
 
-    //we need to add the del since the buffered reader strips it
-    msg_frame.push_back((char) 4);
+  std::unordered_map<int32_t, SocketUtils::ReadR>::iterator rr_got = this->rrm.find(sfd);
+  if( rr_got == this->rrm.end()) {
 
-    //the uuid and the message placeholders
-    std::vector<char> uuid_v;
-    std::vector<char> msg_v;
+    this->r_mutex.unlock();
+    return;
 
-    //unpack the message
-    SocketUtils::unpack_frame(&msg_frame[0], msg_frame.size(), uuid_v, msg_v);
+  }
 
-    //convert the uuid_v to a string
-    std::string uuid_str(uuid_v.begin(), uuid_v.end());
+  SocketUtils::ReadR *rr = &rr_got->second;
+
+  //release the lock as now we have the shared resources we need
+  this->r_mutex.unlock();
+
+  //create a callback for a client close scenario
+  std::function<void()> close_callback = [&sfd, this, &rr]() {
 
-    //grab a lock and get 'da callback
+    //unset valid
+    rr->is_valid = false;
+    this->a_zombied(sfd);
+
+  };
+
+  //we run on the sfd's read strand so nobody else is touching rr
+  if(rr->is_valid) {
+
+    SocketUtils::read_from_sfd(ep_sfd, sfd, rr->br, close_callback, 
+        this->sfd_events, this->e_mutex);
+
+  }
+
+}
+
+/**
+ * Returns the read strand of sfd, creating the read resources if they
+ * don't exist yet
+ */
+std::shared_ptr<Strand> SocketClient::read_strand(int32_t sfd) {
+
+  //the callback for every frame one read completed.  it gets views of the frames,
+  //often straight out of the socket read, and takes the callback lock once for all
+  //of them
+  std::function<void(const BufferedReader::Frame*, size_t)> call_back = [sfd, this](const BufferedReader::Frame *frames,
+      size_t n) {
+
+    //a callback that blew up takes its connection down once the lock is let go
+    bool broken = false;
+
+    //grab a lock and get 'da callbacks
     this->call_backs_mutex.lock();
 
-    std::unordered_map<std::string, std::function<void(std::vector<char>&&)>>::iterator cb_iter = this->call_backs[sfd].find(uuid_str);
-    if(cb_iter != this->call_backs[sfd].end()) {
+    //the connection may be gone and its callbacks with it
+    std::unordered_map<int32_t, std::unordered_map<std::string, Pending>>::iterator cbs_got = this->call_backs.find(sfd);
 
-      //get a reference to it
-      std::function<void(std::vector<char>)> da_callback = cb_iter->second;
+    for(size_t i=0; cbs_got != this->call_backs.end() && i < n; ++i) {
 
-      try {
+      std::unordered_map<std::string, Pending> &sfd_cbs = cbs_got->second;
+      const char *msg;
+      size_t msg_size;
 
-        std::string msg_str(msg_v.begin(), msg_v.end());
-        //call the callback
-        da_callback(std::move(msg_v)); 
+      //find the message
+      if(!SocketUtils::unpack_frame(frames[i].data, frames[i].size, msg, msg_size)) {
 
-      } catch(std::exception &e) {
+        logger.error(std::string("Dropping a frame too short for a uuid on sfd: ") + std::to_string(sfd));
+        continue;
 
-        //no callback found! something is wrong with this sfd let's add it to zombied
-        this->a_zombied(sfd);
-        logger.error("Could not locate callback!  This is very very bad!");
       }
 
-      //and remove it from our callback map
-      this->call_backs[sfd].erase(uuid_str);
+      //the uuid is the first 37 bytes
+      std::string uuid_str(frames[i].data, 37);
+
+      std::unordered_map<std::string, Pending>::iterator cb_iter = sfd_cbs.find(uuid_str);
+      if(cb_iter != sfd_cbs.end()) {
+
+        //get a reference to it
+        std::function<void(std::vector<char>, bool)> da_callback = cb_iter->second.callback;
+
+        //the response made it so its deadline is off
+        if(cb_iter->second.timer != 0) {
+
+          this->timers.cancel(cb_iter->second.timer);
 
-    } 
+        }
+
+        try {
+
+          //call the callback with the only copy of the message we make
+          da_callback(std::vector<char>(msg, msg + msg_size), true); 
+
+        } catch(std::exception &e) {
+
+          //no callback found! something is wrong with this sfd let's add it to zombied
+          broken = true;
+          logger.error("Could not locate callback!  This is very very bad!");
+        }
+
+        //and remove it from our callback map
+        sfd_cbs.erase(uuid_str);
+
+      } 
+
+    }
 
     //release the lock
     this->call_backs_mutex.unlock();
 
+    if(broken) {
+
+      this->a_zombied(sfd);
+
+    }
+
   };
 
-  //grab a lock and check for a buffered reader exists
-  this->r_mutex.lock();
+  std::lock_guard<std::mutex> lck(this->r_mutex);
 
   //lets first get our buffered reader out for this sfd
-  std::unordered_map<int32_t, SocketUtils::ReadR>::const_iterator rr_got = this->rrm.find(sfd);
+  std::unordered_map<int32_t, SocketUtils::ReadR>::iterator rr_got = this->rrm.find(sfd);
   if( rr_got == this->rrm.end()) {
 
     //if we don't have an entry lets create one
     struct SocketUtils::ReadR nrr;
-    nrr.br = BufferedReader((char) 4, call_back);
-    nrr.mutex = new std::mutex();
+    nrr.br = BufferedReader(this->framing, (char) 4, call_back);
+    nrr.br.set_limits(this->limits.max_frame, this->limits.budget, [sfd]() {
+
+      logger.error(std::string("Dropping sfd for sending a frame over the limit: ") + std::to_string(sfd));
+
+    });
+    nrr.strand = std::make_shared<Strand>(this->r_tp);
     nrr.is_valid = true;
-    this->rrm.emplace(sfd, std::move(nrr));
+    nrr.paused = false;
+    rr_got = this->rrm.emplace(sfd, std::move(nrr)).first;
 
   }
 
-  SocketUtils::ReadR *rr = &this->rrm.find(sfd)->second;
+  return rr_got->second.strand;
 
-  //release the lock as now we have the shared resources we need
-  this->r_mutex.unlock();
+}
+
+/**
+ * This method writes messages on to the socket
+ */
+void SocketClient::write(int32_t ep_sfd, int32_t sfd) {
+
+  //grab a global write lock and get our buffered writer.  write_strand made it
+  this->w_mutex.lock();
+
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if( wr_got == this->wrm.end()) {
+
+    this->w_mutex.unlock();
+    return;
+
+  }
+
+  SocketUtils::WriteR *wr = &wr_got->second;
+
+  //release the global write lock
+  this->w_mutex.unlock();
 
   //create a callback for a client close scenario
-  std::function<void()> close_callback = [&sfd, this, &rr]() {
+  std::function<void()> close_callback = [&sfd, this, &wr]() {
 
     //unset valid
-    rr->is_valid = false;
+    wr->is_valid = false;
     this->a_zombied(sfd);
 
   };
 
-  //now lets finally lock on this sfd mutex
-  rr->mutex->lock();
+  //we run on the sfd's write strand so nobody else is touching wr
+  if(wr->is_valid) {
 
-  if(rr->is_valid) {
+    //only do stuff if we haven't been marked for death
+    uint64_t hold = SocketUtils::write_to_sfd(ep_sfd, sfd, wr->bw, close_callback,
+        this->sfd_events, this->e_mutex, this->limits, &this->w_sends, &wr->corked);
 
-    SocketUtils::read_from_sfd(ep_sfd, sfd, rr->br, close_callback, 
-        this->sfd_events, this->e_mutex);
+    if(hold > 0 && !wr->held) {
 
-  }
+      //one flush per wait, rounded up so it never comes before the time is up
+      wr->held = true;
+      this->timers.schedule((hold + 999) / 1000, [this, ep_sfd, sfd]() { this->flush(ep_sfd, sfd); });
+
+    }
 
-  //unlock after read
-  rr->mutex->unlock();
+  }
 
 }
 
 /**
- * This method writes messages on to the socket
+ * Writes out a writer that was held for more frames once its time is up
  */
-void SocketClient::write(int32_t ep_sfd, int32_t sfd) {
+void SocketClient::flush(int32_t ep_sfd, int32_t sfd) {
 
-  //grab a global write lock
+  //write_strand would make the resources again if the connection is gone
+  std::shared_ptr<Strand> strand;
   this->w_mutex.lock();
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got != this->wrm.end()) {
+
+    strand = wr_got->second.strand;
+
+  }
+  this->w_mutex.unlock();
+
+  if(strand == NULL) {
+
+    return;
+
+  }
+
+  strand->post([this, ep_sfd, sfd]() {
+
+    this->w_mutex.lock();
+    std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+    if(wr_got != this->wrm.end()) {
+
+      wr_got->second.held = false;
+
+    }
+    this->w_mutex.unlock();
+
+    this->write(ep_sfd, sfd);
+
+  });
+
+}
+
+/**
+ * Returns the write strand of sfd, creating the write resources if they
+ * don't exist yet
+ */
+std::shared_ptr<Strand> SocketClient::write_strand(int32_t sfd) {
+
+  std::lock_guard<std::mutex> lck(this->w_mutex);
 
   //let's get our buffered writer out for this sfd
-  std::unordered_map<int32_t, SocketUtils::WriteR>::const_iterator wr_got = this->wrm.find(sfd);
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
   if( wr_got == this->wrm.end()) {
 
     //if we don't have an entry lets create one
     struct SocketUtils::WriteR nwr;
-    nwr.mutex = new std::mutex();
+    nwr.bw.set_gauge(&this->w_bytes);
+    nwr.strand = std::make_shared<Strand>(this->w_tp);
     nwr.is_valid = true;
-    this->wrm.emplace(sfd, std::move(nwr));
+    nwr.backlog = std::make_shared<SocketUtils::Backlog>();
+    nwr.held = false;
+    nwr.corked = false;
+    wr_got = this->wrm.emplace(sfd, std::move(nwr)).first;
 
   }
 
-  SocketUtils::WriteR *wr = &this->wrm.find(sfd)->second;
+  return wr_got->second.strand;
 
-  //release the global write lock
-  this->w_mutex.unlock();
+}
 
-  //create a callback for a client close scenario
-  std::function<void()> close_callback = [&sfd, this, &wr]() {
+/**
+ * Reserves bytes for a frame to sfd and returns its backlog, or NULL if the
+ * connection is over its high water
+ */
+std::shared_ptr<SocketUtils::Backlog> SocketClient::reserve(const int32_t sfd, const size_t bytes) {
 
-    //unset valid
-    wr->is_valid = false;
-    this->a_zombied(sfd);
+  std::lock_guard<std::mutex> lck(this->w_mutex);
 
-  };
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got == this->wrm.end()) {
 
-  //grab the sfd write lock
-  wr->mutex->lock();
+    return NULL;
 
-  if(wr->is_valid) {
+  }
+
+  //add and then check so whoever sees the sum over the high water backs out
+  //again, the strand takes it back off once the frame is in the writer
+  std::shared_ptr<SocketUtils::Backlog> backlog = wr_got->second.backlog;
+  size_t before = backlog->queued.fetch_add(bytes) + wr_got->second.bw.size();
+  if(this->limits.high_water > 0) {
+
+    //once at the high water it takes getting back down to the low water before
+    //we send again, like the server pausing reads
+    if(before >= this->limits.high_water) {
+
+      backlog->over = true;
+
+    } else if(backlog->over && before <= this->limits.low_water) {
+
+      backlog->over = false;
+
+    }
+
+    if(backlog->over) {
+
+      backlog->queued -= bytes;
+      return NULL;
+
+    }
 
-    //only do stuff if we haven't been marked for death
-    SocketUtils::write_to_sfd(ep_sfd, sfd, wr->bw, close_callback,
-        this->sfd_events, this->e_mutex);
   }
+  this->q_bytes += bytes;
 
-  //release the sfd write lock
-  wr->mutex->unlock();
+  return backlog;
 
 }
 
 /**
  * Sends a message on to the node that the hash_key hashes to
  */
-bool SocketClient::send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>)> resp_callback) {
+bool SocketClient::send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>)> resp_callback,
+    uint64_t to_millis) {
 
   //lets get the host that this message will be sent to
   size_t hash =  Utils::hash_it(hash_key);
@@ -466,14 +669,58 @@ bool SocketClient::send_msg(const char *data, size_t size, std::string &hash_key
   //grab a uuid to represent this request
   std::string uuid_str = Utils::build_uuid_str();
 
-  return send_msg(data, size, ni, resp_callback, uuid_str);
+  return send_msg(data, size, ni, resp_callback, uuid_str, to_millis);
 
 }
 
 /**
  * Sends a message on to the node that is at index ni
  */
-bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>)> resp_callback, std::string &uuid_str) {
+bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>)> resp_callback, std::string &uuid_str,
+    uint64_t to_millis) {
+
+  //this callback only hears of a failure as an empty response
+  std::function<void(std::vector<char>, bool)> da_callback;
+  if(resp_callback != NULL) {
+
+    da_callback = [resp_callback](std::vector<char> resp, bool) { resp_callback(std::move(resp)); };
+
+  }
+
+  return send_msg(data, size, ni, da_callback, uuid_str, to_millis);
+
+}
+
+/**
+ * Sends a message on to the node that the hash_key hashes to and tells the
+ * resp_callback whether the request worked
+ */
+bool SocketClient::send_msg(const char *data, size_t size, std::string &hash_key, std::function<void(std::vector<char>, bool)> resp_callback,
+    uint64_t to_millis) {
+
+  //lets get the host that this message will be sent to
+  size_t hash =  Utils::hash_it(hash_key);
+  uint32_t ni = hash % this->desired_hosts.size();
+  //grab a uuid to represent this request
+  std::string uuid_str = Utils::build_uuid_str();
+
+  return send_msg(data, size, ni, resp_callback, uuid_str, to_millis);
+
+}
+
+/**
+ * Sends a message on to the node that is at index ni and tells the
+ * resp_callback whether the request worked
+ */
+bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::function<void(std::vector<char>, bool)> resp_callback,
+    std::string &uuid_str, uint64_t to_millis) {
+
+  if(!SocketUtils::fits_frame(this->framing, size)) {
+
+    logger.error(std::string("Rejecting a message too big for a frame: ") + std::to_string(size));
+    return false;
+
+  }
 
   bool result = true;
 
@@ -491,6 +738,19 @@ bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::fun
     sfd = this->h_status[this->desired_hosts[ni]].sfd;
     ep_sfd = this->h_status[this->desired_hosts[ni]].ep_sfd;
 
+    //the frame's bytes are reserved before anything else so senders racing
+    //each other can't all get past the high water
+    size_t f_size = SocketUtils::frame_size(this->framing, size);
+    std::shared_ptr<Strand> strand = write_strand(sfd);
+    std::shared_ptr<SocketUtils::Backlog> backlog = reserve(sfd, f_size);
+    if(backlog == NULL) {
+
+      //the server isn't keeping up so we don't pile more on it
+      logger.error(std::string("Rejecting a message to a connection over the high water: ") + std::to_string(sfd));
+      return false;
+
+    }
+
     
     //now let's register the callback.  We will have to deregister it if we can't send
     if(resp_callback != NULL) { 
@@ -499,68 +759,117 @@ bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::fun
       //first grab a lock to modify the map
       this->call_backs_mutex.lock();
 
-      this->call_backs[sfd][uuid_str] = resp_callback;
+      Pending &pending = this->call_backs[sfd][uuid_str];
+      pending.callback = resp_callback;
+      pending.timer = 0;
 
       //unlock access to the map
       this->call_backs_mutex.unlock();
 
+      if(to_millis > 0) {
+
+        //give up on the response if it doesn't make it in time.  if it already did
+        //there is nothing left to find
+        uint64_t timer = this->timers.schedule(to_millis, [this, sfd, uuid_str]() {
+
+          std::function<void(std::vector<char>, bool)> da_callback;
+
+          this->call_backs_mutex.lock();
+          std::unordered_map<int32_t, std::unordered_map<std::string, Pending>>::iterator cbs_got = this->call_backs.find(sfd);
+          if(cbs_got != this->call_backs.end()) {
+
+            std::unordered_map<std::string, Pending>::iterator cb_iter = cbs_got->second.find(uuid_str);
+            if(cb_iter != cbs_got->second.end()) {
+
+              da_callback = std::move(cb_iter->second.callback);
+              cbs_got->second.erase(cb_iter);
+
+            }
+
+          }
+          this->call_backs_mutex.unlock();
+
+          if(da_callback) {
+
+            //the caller hears it timed out
+            da_callback(std::vector<char>(), false);
+
+          }
+
+        });
+
+        //keep the id so the response can call it off.  if the timer beat us to
+        //it the callback is gone already
+        this->call_backs_mutex.lock();
+        std::unordered_map<int32_t, std::unordered_map<std::string, Pending>>::iterator cbs_got = this->call_backs.find(sfd);
+        if(cbs_got != this->call_backs.end()) {
+
+          std::unordered_map<std::string, Pending>::iterator cb_iter = cbs_got->second.find(uuid_str);
+          if(cb_iter != cbs_got->second.end()) {
+
+            cb_iter->second.timer = timer;
+
+          }
+
+        }
+        this->call_backs_mutex.unlock();
+
+      }
+
     }     
 
     //now let's make a msg frame
 
-    //make a buffer just big enough for uuid + size + del
-    uint32_t mfs = 37+size+1;
-    char msg_frame[mfs]; 
-    SocketUtils::pack_frame(uuid_str.c_str(), data, size, msg_frame);
+    //make a buffer just big enough for the frame
+    std::vector<char> msg_frame(f_size); 
+    SocketUtils::pack_frame(this->framing, uuid_str.c_str(), data, size, &msg_frame[0]);
 
-    //grab a global write lock
-    this->w_mutex.lock();
+    //the buffered writer belongs to the write strand so the frame goes through it.
+    //a dead writer marks the host unhealthy, which we checked above
+    strand->post([this, ep_sfd, sfd, f_size, backlog, msg_frame = std::move(msg_frame)]() mutable {
 
-    //let's get our buffered writer out for this sfd
-    std::unordered_map<int32_t, SocketUtils::WriteR>::const_iterator wr_got = this->wrm.find(sfd);
-    if( wr_got == this->wrm.end()) {
+      //grab a global write lock
+      this->w_mutex.lock();
 
-      //if we don't have an entry lets create one
-      struct SocketUtils::WriteR nwr;
-      nwr.mutex = new std::mutex();
-      nwr.is_valid = true;
-      this->wrm.emplace(sfd, std::move(nwr));
+      SocketUtils::WriteR *wr = NULL;
+      std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+      if( wr_got != this->wrm.end()) {
 
-    }
+        wr = &wr_got->second;
 
-    SocketUtils::WriteR *wr = &this->wrm.find(sfd)->second;
-    //release the global write lock
-    this->w_mutex.unlock();
+      }
 
-    //grab the sfd write lock
-    wr->mutex->lock();
+      //release the global write lock
+      this->w_mutex.unlock();
 
-    if(wr->is_valid) {
+      if(wr != NULL && wr->is_valid) {
 
-      //if this resource is not dead then write to the buffered writer 
-      wr->bw.write(msg_frame, mfs);
+        //if this resource is not dead then write to the buffered writer 
+        wr->bw.write(std::move(msg_frame));
+        this->w_frames++;
 
-    } else {
+      }
 
-      //could not write hte data
-      result = false;
+      //the writer counts the bytes now, or they are gone with the connection
+      backlog->queued -= f_size;
+      this->q_bytes -= f_size;
 
-    }
+      if(wr != NULL && wr->is_valid) {
 
-    //release the sfd write lock
-    wr->mutex->unlock();
+        //tell empoll to let us know when we can write cause we have stuff to write.
+        //a held writer waits for its flush unless this made it big enough to go
+        if(!wr->held || wr->bw.size() >= this->limits.flush_bytes) {
 
-    if(result) {
+          this->e_mutex.lock();
+          this->sfd_events[sfd] |= EPOLLOUT;
+          SocketUtils::set_epoll(ep_sfd, sfd, this->sfd_events[sfd] );
+          this->e_mutex.unlock();
 
-      //if buffered writer was valid then we have data to write
+        }
 
-      //tell empoll to let us know when we can write cause we have stuff to write
-      e_mutex.lock();
-      sfd_events[sfd] |= EPOLLOUT;
-      SocketUtils::set_epoll(ep_sfd, sfd, sfd_events[sfd] );
-      e_mutex.unlock();
+      }
 
-    }
+    });
 
   }
 
@@ -587,61 +896,48 @@ bool SocketClient::send_msg(const char *data, size_t size, std::string &hash_key
  */
 bool SocketClient::send_msg(const char *data, size_t size, uint32_t ni, std::vector<char> &result, uint64_t to_millis) {
 
-  //lets get the sfd that we are going to ask
-  int32_t sfd = this->h_status[this->desired_hosts[ni]].sfd;
-
   bool success = false;
   std::mutex sm_mutex;
   std::unique_lock<std::mutex> lck(sm_mutex, std::defer_lock);
   std::condition_variable cv;
   bool ss = false;
+  bool ok = false;
   //grab a uuid to represent this request
   std::string uuid_str = Utils::build_uuid_str();
   
-  std::function<void(std::vector<char>)> call_back = [&success, &result, &cv, &ss](std::vector<char> da_result) {
+  std::function<void(std::vector<char>, bool)> call_back = [&result, &sm_mutex, &cv, &ss, &ok](std::vector<char> da_result, bool da_ok) {
 
     //set the result and notify
-    success = true;
-    result = da_result;
+    std::lock_guard<std::mutex> r_lck(sm_mutex);
+    ok = da_ok;
+    result = std::move(da_result);
     ss = true;
     cv.notify_one();
 
   };
 
-  success = send_msg(data, size, ni, call_back, uuid_str);
+  //the request's own timer gives up on it so the callback is called exactly once, by
+  //the response, the timer or a close, and never after we're gone.  a timer needs at
+  //least a milli
+  success = send_msg(data, size, ni, call_back, uuid_str, to_millis > 0 ? to_millis : 1);
 
   if(success) {
 
     //if success was false right off the bat that means there was no node to send it to
     //so we don't get into this block
 
-    //init the wait return value to no timeout
-    std::cv_status w_status = std::cv_status::no_timeout;
-
-    //wait here untill callback is called or we timeout
+    //wait here untill callback is called
     lck.lock();
-    while(!ss && w_status == std::cv_status::no_timeout) {
+    while(!ss) {
 
-      w_status = cv.wait_for(lck, std::chrono::milliseconds(to_millis));
+      cv.wait(lck);
 
     }
+    success = ok;
     lck.unlock();
 
   }
 
-  //Here we need to make sure to unregister the callback in case of time out.  If we don't the
-  //call_back lamda will contain dangling referenecs and we will certainly sigsegv
-
-  //grab a lock and get 'da callback
-  this->call_backs_mutex.lock();
-
-  //and remove it from our callback map
-  this->call_backs[sfd].erase(uuid_str);
-
-  //release the lock
-  this->call_backs_mutex.unlock();
-
-
   return success;
 
 }
@@ -663,17 +959,14 @@ void SocketClient::close_n_clean(int32_t ep_sfd, int32_t sfd) {
   close(ep_sfd);
 
 
-  //clean callbacks
-  this->call_backs_mutex.lock();
-  this->call_backs.erase(sfd);
-  this->call_backs_mutex.unlock();
+  //the requests still waiting won't get a response now
+  this->fail_pending(sfd);
 
   //clean with read resources
   this->r_mutex.lock();
   std::unordered_map<int32_t, SocketUtils::ReadR>::const_iterator rr_got = this->rrm.find(sfd);
   if( rr_got != this->rrm.end()) {
 
-    delete this->rrm[sfd].mutex;
     this->rrm.erase(sfd);
   }
   this->r_mutex.unlock();
@@ -683,7 +976,6 @@ void SocketClient::close_n_clean(int32_t ep_sfd, int32_t sfd) {
   std::unordered_map<int32_t, SocketUtils::WriteR>::const_iterator wr_got = this->wrm.find(sfd);
   if( wr_got != this->wrm.end()) {
 
-    delete this->wrm[sfd].mutex;
     this->wrm.erase(sfd);
   }
   this->w_mutex.unlock();
@@ -696,7 +988,49 @@ void SocketClient::close_n_clean(int32_t ep_sfd, int32_t sfd) {
 }
 
 /**
- * Method adds sfd to a set of zombied to be reaped later
+ * Takes every callback waiting on a response from sfd out, calls off their
+ * timers and tells them the request failed
+ */
+void SocketClient::fail_pending(int32_t sfd) {
+
+  //they come out under the lock so neither a late response nor a timer finds
+  //them, but they are called after it's let go
+  std::unordered_map<std::string, Pending> pendings;
+
+  this->call_backs_mutex.lock();
+  std::unordered_map<int32_t, std::unordered_map<std::string, Pending>>::iterator cbs_got = this->call_backs.find(sfd);
+  if(cbs_got != this->call_backs.end()) {
+
+    pendings.swap(cbs_got->second);
+    this->call_backs.erase(cbs_got);
+
+  }
+  this->call_backs_mutex.unlock();
+
+  for(std::pair<const std::string, Pending> &pending : pendings) {
+
+    if(pending.second.timer != 0) {
+
+      this->timers.cancel(pending.second.timer);
+
+    }
+
+    try {
+
+      pending.second.callback(std::vector<char>(), false);
+
+    } catch(std::exception &e) {
+
+      logger.error(std::string("A callback threw on a failed request: ") + e.what());
+
+    }
+
+  }
+
+}
+
+/**
+ * Method adds sfd to a set of zombied and schedules it to be reaped later
  */
 void SocketClient::a_zombied(int32_t sfd) {
 
@@ -709,76 +1043,102 @@ void SocketClient::a_zombied(int32_t sfd) {
   this->h_status[node].is_healthy = false;
   this->hs_mutex.unlock();
 
+  //nothing more gets sent to it so there is no point waiting on responses
+  this->fail_pending(sfd);
+
   //grab lock
-  this->z_mutex.lock();
+  std::lock_guard<std::mutex> lck(this->z_mutex);
+
+  //the reader and the writer can both mark it but it only gets reaped once
+  if(this->zm.find(sfd) != this->zm.end()) {
+
+    return;
+
+  }
+
   //add this sfd to zombied set
   this->zm[sfd] = Utils::epoch_millis_now();
-  //release the zombie set lock
-  this->z_mutex.unlock();
+
+  //reap after 60 seconds of being marked for death
+  schedule_connect(60000, [this, sfd]() { this->reap(sfd); });
 
 }
 
 /**
- * This method starts a thread that will continuously clean up zombied socket resouces
+ * Cleans up the resources of a zombied sfd once its time is up and
+ * reconnects to its host
  */
-void SocketClient::reap_resources() {
+void SocketClient::reap(int32_t sfd) {
 
-  logger.info("Starting zombied resource reaper");
+  //get host name
+  this->conn_mutex.lock();
+  std::string node = this->conns[sfd];
+  this->conn_mutex.unlock();
 
-  while(1) {
+  this->hs_mutex.lock();
+  int32_t ep_sfd = this->h_status[node].ep_sfd;
+  this->hs_mutex.unlock();
 
-    //sleep for 30 seconds and then loop
-    std::this_thread::sleep_for(std::chrono::seconds(30));
-    logger.info("Reaping zombied resources");
+  //close and clean resources
+  this->close_n_clean(ep_sfd, sfd);
 
-    //grab the zombied sfd lock
-    this->z_mutex.lock();
+  //now remove the entry from our zombie set
+  this->z_mutex.lock();
+  this->zm.erase(sfd);
+  this->z_mutex.unlock();
 
-    //these are the zombies that need to be removed
-    std::vector<int32_t> zv;
-    for(auto it = this->zm.begin(); it != this->zm.end(); ++it ) {
+  //attempt reconnect
+  if(!make_connection(node)) {
 
-      //reap after 60 seconds of being marked for death
-      if((Utils::epoch_millis_now() - it->second) > 60000) {
+    //reattempt later
+    schedule_connect(RETRY_MILLIS, [this, node]() { this->retry_conn(node, RETRY_MILLIS); });
 
-        int32_t sfd = it->first;
+  }
 
-        //get host name
-        this->conn_mutex.lock();
-        std::string node = this->conns[sfd];
-        this->conn_mutex.unlock();
+}
 
-        int32_t ep_sfd = this->h_status[node].ep_sfd;
+/**
+ * Returns the bytes waiting to be written across all connections, queued
+ * frames included
+ */
+uint64_t SocketClient::buffered_bytes() {
 
-        //close and clean resources
-        this->close_n_clean(ep_sfd, sfd);
-        zv.emplace_back(sfd);
+  return this->w_bytes.load() + this->q_bytes.load();
 
-        //attempt reconnect
-        if(!make_connection(node)) {
+}
 
-          //add this host to the failed list to reattempt later
-          this->eh_mutex.lock();
-          this->e_hosts.push_back(node);
-          this->eh_mutex.unlock();
+/**
+ * Returns the bytes waiting to be written to sfd, queued frames included
+ */
+uint64_t SocketClient::buffered_bytes(const int32_t sfd) {
 
-        }
+  std::lock_guard<std::mutex> lck(this->w_mutex);
 
-      }
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got == this->wrm.end()) {
 
-    }
+    return 0;
 
-    for(int32_t &zsfd : zv) {
+  }
 
-      //now remove the entries from our zombie set
-      this->zm.erase(zsfd);
+  return wr_got->second.bw.size() + wr_got->second.backlog->queued.load();
 
-    }
+}
 
-    this->z_mutex.unlock();
+/**
+ * Returns the frames queued across all connections
+ */
+uint64_t SocketClient::frames_queued() {
 
-  }
+  return this->w_frames.load();
 
 }
 
+/**
+ * Returns the send calls that got bytes out across all connections
+ */
+uint64_t SocketClient::send_calls() {
 
+  return this->w_sends.load();
+
+}
@@ -4,18 +4,117 @@ using namespace asutils;
 
 log4cpp::Category& SocketServer::logger = log4cpp::Category::getRoot();
 
+/**
+ * The accept pool runs the accept on the epoll thread when it is full
+ * instead of stalling every connection behind it
+ */
+static ThreadPool::Config accept_pool_config(const std::vector<uint32_t> &cpus) {
+
+  ThreadPool::Config config(cpus.empty() ? std::thread::hardware_concurrency() : cpus.size());
+  config.policy = ThreadPool::CALLER_RUNS;
+  config.cpus = cpus;
+
+  return config;
+
+}
+
 /**
  * Default constructor takes a port to listen to
  */
 SocketServer::SocketServer(const uint32_t port, std::function<void(std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
-            SocketServer &server, const int32_t sfd)> handler) : a_tp(std::thread::hardware_concurrency()), 
-  r_tp(std::thread::hardware_concurrency()), w_tp(std::thread::hardware_concurrency()) {
+            SocketServer &server, const int32_t sfd)> handler) : SocketServer(port, handler, std::vector<uint32_t>()) {
 
-  //ignore sigpipe
-  std::signal(SIGPIPE, SIG_IGN);
+}
+
+/**
+ * Constructor that pins the epoll thread, which is the calling thread, and
+ * every pool to cpus
+ */
+SocketServer::SocketServer(const uint32_t port, std::function<void(std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
+            SocketServer &server, const int32_t sfd)> handler, const std::vector<uint32_t> &cpus,
+            const BufferedReader::Framing framing,
+            const SocketUtils::Limits &limits) : 
+  a_tp(accept_pool_config(cpus)), r_tp(SocketUtils::io_pool_config(cpus)), w_tp(SocketUtils::io_pool_config(cpus)),
+  timers(r_tp, ThreadPool::LOW), p_bytes(0), w_frames(0), w_sends(0), w_bytes(0), q_bytes(0) {
 
   this->handler = handler;
   this->port = port;
+  this->framing = framing;
+  this->limits = limits;
+
+  serve(cpus);
+
+}
+
+/**
+ * Constructor for a handler that gets views of the uuid and message instead
+ * of copies
+ */
+SocketServer::SocketServer(const uint32_t port, std::function<void(const char *uuid, const char *msg, size_t msg_size,
+            SocketServer &server, const int32_t sfd)> v_handler, const std::vector<uint32_t> &cpus,
+            const BufferedReader::Framing framing,
+            const SocketUtils::Limits &limits) : 
+  a_tp(accept_pool_config(cpus)), r_tp(SocketUtils::io_pool_config(cpus)), w_tp(SocketUtils::io_pool_config(cpus)),
+  timers(r_tp, ThreadPool::LOW), p_bytes(0), w_frames(0), w_sends(0), w_bytes(0), q_bytes(0) {
+
+  this->v_handler = v_handler;
+  this->port = port;
+  this->framing = framing;
+  this->limits = limits;
+
+  serve(cpus);
+
+}
+
+/**
+ * Constructor for a handler that gets views of every message one read of a
+ * connection brought in at once
+ */
+SocketServer::SocketServer(const uint32_t port, std::function<void(const SocketUtils::Msg *msgs, size_t n,
+            SocketServer &server, const int32_t sfd)> b_handler, const std::vector<uint32_t> &cpus,
+            const BufferedReader::Framing framing, const SocketUtils::Limits &limits) : 
+  a_tp(accept_pool_config(cpus)), r_tp(SocketUtils::io_pool_config(cpus)), w_tp(SocketUtils::io_pool_config(cpus)),
+  timers(r_tp, ThreadPool::LOW), p_bytes(0), w_frames(0), w_sends(0), w_bytes(0), q_bytes(0) {
+
+  this->b_handler = b_handler;
+  this->port = port;
+  this->framing = framing;
+  this->limits = limits;
+
+  serve(cpus);
+
+}
+
+/**
+ * Constructor for a handler that streams messages instead of getting them
+ * whole
+ */
+SocketServer::SocketServer(const uint32_t port, std::function<void(const BufferedReader::Event event, const char *uuid,
+            const char *data, size_t size, SocketServer &server, const int32_t sfd)> s_handler,
+            const std::vector<uint32_t> &cpus, const BufferedReader::Framing framing, const SocketUtils::Limits &limits) : 
+  a_tp(accept_pool_config(cpus)), r_tp(SocketUtils::io_pool_config(cpus)), w_tp(SocketUtils::io_pool_config(cpus)),
+  timers(r_tp, ThreadPool::LOW), p_bytes(0), w_frames(0), w_sends(0), w_bytes(0), q_bytes(0) {
+
+  this->s_handler = s_handler;
+  this->port = port;
+  this->framing = framing;
+  this->limits = limits;
+
+  serve(cpus);
+
+}
+
+/**
+ * Pins the calling thread, sets up the listening socket and processes epoll
+ * events for good
+ */
+void SocketServer::serve(const std::vector<uint32_t> &cpus) {
+
+  //the epoll loop runs on this thread for good
+  Affinity::pin_this_thread(cpus);
+
+  //ignore sigpipe
+  std::signal(SIGPIPE, SIG_IGN);
 
   create_socket();
   bind_socket();
@@ -35,7 +134,7 @@ SocketServer::SocketServer(const uint32_t port, std::function<void(std::vector<c
   std::function<void()> add_callback = [this]() { 
 
     //add to our add conn threadpool
-    std::function<void()> add_f = [this]()  { 
+    a_tp.post([this]()  { 
 
       std::function<void(int32_t)> sa_callback = [this](int32_t nsfd) {
 
@@ -45,29 +144,34 @@ SocketServer::SocketServer(const uint32_t port, std::function<void(std::vector<c
       
       SocketUtils::add_fd_to_epoll(this->ep_sfd, this->i_sfd, sa_callback);
     
-    };
-
-    a_tp.add_work(add_f);
+    });
 
   };
 
-  //this one is for reading data
-  std::function<void(int32_t)> read_callback = [this](int32_t sfd) {
+  //this one is for reading data.  it queues the read on the sfd's read strand and
+  //returns the strand for the read threadpool if it wasn't already scheduled
+  std::function<Task(int32_t)> read_callback = [this](int32_t sfd) {
 
     //turn off EPOLLIN notifications for this sfd
     this->e_mutex.lock();
     this->sfd_events[sfd] ^= EPOLLIN;
     SocketUtils::set_epoll(this->ep_sfd, sfd, this->sfd_events[sfd]);
     this->e_mutex.unlock();
+
+    std::shared_ptr<Strand> strand = read_strand(sfd);
+    if(strand == NULL) {
+
+      return Task();
+
+    }
     
-    //add the read to our read threadpool
-    std::function<void()> read_f = [this, sfd]() { this->read(sfd);  };
-    r_tp.add_work(read_f);
+    return strand->enqueue(Task([this, sfd]() { this->read(sfd);  }));
   
   };
 
-  //this one is for writing data
-  std::function<void(int32_t)> write_callback = [this](int32_t sfd) {
+  //this one is for writing data.  it queues the write on the sfd's write strand and
+  //returns the strand for the write threadpool if it wasn't already scheduled
+  std::function<Task(int32_t)> write_callback = [this](int32_t sfd) {
 
     //turn off EPOLLOUT notifications for this sfd
     this->e_mutex.lock();
@@ -75,16 +179,17 @@ SocketServer::SocketServer(const uint32_t port, std::function<void(std::vector<c
     SocketUtils::set_epoll(this->ep_sfd, sfd, this->sfd_events[sfd]);
     this->e_mutex.unlock();
 
-    //add the write to our write threadpool
-    std::function<void()> write_f = [this, sfd]() { this->write(sfd); };
-    w_tp.add_work(write_f);
+    std::shared_ptr<Strand> strand = write_strand(sfd);
+    if(strand == NULL) {
+
+      return Task();
+
+    }
+
+    return strand->enqueue(Task([this, sfd]() { this->write(sfd); }));
 
   };
 
-  //start zombied resource reaper
-  std::thread pt(&SocketServer::reap_resources, this);
-  pt.detach();
-  
   process_epoll_events(add_callback, read_callback, write_callback);
   
 }
@@ -139,39 +244,117 @@ void SocketServer::bind_socket(){
  */
 void SocketServer::add(int32_t nsfd) {
 
-  //the callback for once we have a full message frame
-  std::function<void(std::vector<char>)> call_back = [this, nsfd](std::vector<char> msg_frame) {
+  //the callback for every frame one read completed.  it gets views of the frames,
+  //often straight out of the socket read.  msgs is only ever touched from the
+  //connection's read strand so it is reused from batch to batch
+  std::vector<SocketUtils::Msg> msgs;
+  std::function<void(const BufferedReader::Frame*, size_t)> call_back = [this, nsfd, msgs](const BufferedReader::Frame *frames,
+      size_t n) mutable {
+
+    for(size_t i=0; i < n; ++i) {
+
+      SocketUtils::Msg m;
+      m.uuid = frames[i].data;
 
-    //we need to add the del since the buffered reader strips it
-    msg_frame.push_back((char) 4);
+      //find the message
+      if(!SocketUtils::unpack_frame(frames[i].data, frames[i].size, m.msg, m.msg_size)) {
 
-    //the uuid and the message placeholders
-    std::vector<char> uuid_v;
-    std::vector<char> msg_v;
+        logger.error(std::string("Dropping a frame too short for a uuid on sfd: ") + std::to_string(nsfd));
+        continue;
 
-    //unpack the message
-    SocketUtils::unpack_frame(&msg_frame[0], msg_frame.size(), uuid_v, msg_v);
-    this->handler(std::move(uuid_v), std::move(msg_v), *this, nsfd);
+      }
+
+      if(this->b_handler) {
+
+        //the whole batch goes at once below
+        msgs.push_back(m);
+
+      } else if(this->v_handler) {
+
+        this->v_handler(m.uuid, m.msg, m.msg_size, *this, nsfd);
+
+      } else {
+
+        //the handler wants its own copies
+        this->handler(std::vector<char>(m.uuid, m.uuid + 37), std::vector<char>(m.msg, m.msg + m.msg_size), *this, nsfd);
+
+      }
+
+    }
+
+    if(!msgs.empty()) {
+
+      this->b_handler(msgs.data(), msgs.size(), *this, nsfd);
+      msgs.clear();
+
+    }
+
+  };
+
+  //the callback for streamed messages.  the uuid is the header of the frame so it
+  //is kept for the pieces that follow, on the read strand like msgs above
+  std::string uuid;
+  bool valid = false;
+  std::function<void(const BufferedReader::Event, const char*, size_t)> s_call_back = [this, nsfd, uuid, valid](
+      const BufferedReader::Event event, const char *data, size_t size) mutable {
+
+    if(event == BufferedReader::BEGIN) {
+
+      valid = size == 37;
+      if(!valid) {
+
+        logger.error(std::string("Dropping a frame too short for a uuid on sfd: ") + std::to_string(nsfd));
+        return;
+
+      }
+
+      uuid.assign(data, size);
+
+    }
+
+    if(valid) {
+
+      this->s_handler(event, uuid.data(), data, size, *this, nsfd);
+
+    }
 
   };
 
   //init the read resources
   this->r_mutex.lock();
   struct SocketUtils::ReadR nrr;
-  nrr.br = BufferedReader((char) 4, call_back);
-  nrr.mutex = new std::mutex();
+  if(this->s_handler) {
+
+    nrr.br = BufferedReader(this->framing, (char) 4, 37, s_call_back);
+
+  } else {
+
+    nrr.br = BufferedReader(this->framing, (char) 4, call_back);
+
+  }
+  nrr.br.set_limits(this->limits.max_frame, this->limits.budget, [nsfd]() {
+
+    logger.error(std::string("Dropping sfd for sending a frame over the limit: ") + std::to_string(nsfd));
+
+  }, &this->p_bytes);
+  nrr.strand = std::make_shared<Strand>(this->r_tp);
   nrr.is_valid = true;
+  nrr.paused = false;
   //if we don't have an entry lets create one
-  this->rrm.emplace(nsfd, nrr);
+  this->rrm.emplace(nsfd, std::move(nrr));
   this->r_mutex.unlock();
 
   //init the write resources
   this->w_mutex.lock();
   struct SocketUtils::WriteR nwr;
-  nwr.mutex = new std::mutex();
+  nwr.bw.set_gauge(&this->w_bytes);
+  nwr.strand = std::make_shared<Strand>(this->w_tp);
   nwr.is_valid = true;
+  nwr.backlog = std::make_shared<SocketUtils::Backlog>();
+  nwr.held = false;
+  nwr.corked = false;
   //if we don't have an entry lets create one
-  this->wrm.emplace(nsfd, nwr);
+  this->wrm.emplace(nsfd, std::move(nwr));
   this->w_mutex.unlock();
 
   //init the epoll resources
@@ -184,8 +367,8 @@ void SocketServer::add(int32_t nsfd) {
 /**
  * This method loops for all of eternity to process e poll events
  */
-void SocketServer::process_epoll_events(std::function<void()> add_callback, std::function<void(int32_t)> read_callback, 
-    std::function<void(int32_t)> write_callback) {
+void SocketServer::process_epoll_events(std::function<void()> add_callback, std::function<Task(int32_t)> read_callback, 
+    std::function<Task(int32_t)> write_callback) {
 
   struct epoll_event *e_events;
 
@@ -194,10 +377,18 @@ void SocketServer::process_epoll_events(std::function<void()> add_callback, std:
   uint8_t max_events = 64;
   e_events = (epoll_event*)calloc (max_events, sizeof(epoll_event));
 
+  //the reads and writes of one epoll batch are handed to the pools together
+  std::vector<Task> r_batch;
+  std::vector<Task> w_batch;
+  std::vector<Task> r_rejected;
+  std::vector<Task> w_rejected;
+  r_batch.reserve(max_events);
+  w_batch.reserve(max_events);
+
   while(1) {
     
-    //lets wait for events here for ever
-    int32_t n_events = epoll_wait(this->ep_sfd, e_events, max_events, -1);
+    //lets wait for events here for ever, unless there are turned away runners to hand over again
+    int32_t n_events = epoll_wait(this->ep_sfd, e_events, max_events, r_batch.empty() && w_batch.empty() ? -1 : 1);
 
     if(n_events < 0 ) {
 
@@ -232,7 +423,12 @@ void SocketServer::process_epoll_events(std::function<void()> add_callback, std:
 
           //if we are in this block then we have data to read yo!
           //let's call the read_callback provided
-          read_callback(e_events[i].data.fd);
+          Task r_task = read_callback(e_events[i].data.fd);
+          if(r_task) {
+
+            r_batch.push_back(std::move(r_task));
+
+          }
 
         } 
         
@@ -240,7 +436,12 @@ void SocketServer::process_epoll_events(std::function<void()> add_callback, std:
 
           //if we are in this block then we are able to write
           //call the callback
-          write_callback(e_events[i].data.fd);
+          Task w_task = write_callback(e_events[i].data.fd);
+          if(w_task) {
+
+            w_batch.push_back(std::move(w_task));
+
+          }
           
         } 
 
@@ -248,6 +449,16 @@ void SocketServer::process_epoll_events(std::function<void()> add_callback, std:
 
     }
 
+    //one lock and just enough wake ups per pool for the whole batch
+    this->r_tp.add_work_batch(r_batch.begin(), r_batch.end(), ThreadPool::HIGH, &r_rejected);
+    this->w_tp.add_work_batch(w_batch.begin(), w_batch.end(), ThreadPool::HIGH, &w_rejected);
+    r_batch.clear();
+    w_batch.clear();
+
+    //a turned away runner is still the only runner of its strand so it goes again next time around
+    r_batch.swap(r_rejected);
+    w_batch.swap(w_rejected);
+
   }
 
 }
@@ -301,10 +512,9 @@ void SocketServer::read(int32_t sfd) {
       
     };
     
-    //now lets finally lock on this sfd mutex
-    rr->mutex->lock();
-
-    if(rr->is_valid) {
+    //we run on the sfd's read strand so nobody else is touching rr.  a paused
+    //connection leaves EPOLLIN off until it is resumed
+    if(rr->is_valid && !rr->paused) {
 
       //only do stuff if we haven't been marked for death
       SocketUtils::read_from_sfd(this->ep_sfd, sfd, rr->br, close_callback, 
@@ -312,9 +522,6 @@ void SocketServer::read(int32_t sfd) {
 
     }
 
-    //unlock after read
-    rr->mutex->unlock();
-
   }
 
 }
@@ -352,21 +559,62 @@ void SocketServer:: write(int32_t sfd) {
       
     };
 
-    //grab the sfd write lock
-    wr->mutex->lock();
-
+    //we run on the sfd's write strand so nobody else is touching wr
     if(wr->is_valid) {
 
       //only do stuff if we haven't been marked for death
-      SocketUtils::write_to_sfd(this->ep_sfd, sfd, wr->bw, close_callback,
-          this->sfd_events, this->e_mutex);
+      uint64_t hold = SocketUtils::write_to_sfd(this->ep_sfd, sfd, wr->bw, close_callback,
+          this->sfd_events, this->e_mutex, this->limits, &this->w_sends, &wr->corked);
+
+      if(hold > 0 && !wr->held) {
+
+        //one flush per wait, rounded up so it never comes before the time is up
+        wr->held = true;
+        this->timers.schedule((hold + 999) / 1000, [this, sfd]() { this->flush(sfd); });
+
+      }
+
+      SocketUtils::Backlog &backlog = *wr->backlog;
+      if(backlog.over && wr->bw.size() + backlog.queued <= this->limits.low_water && backlog.over.exchange(false)) {
+
+        //the peer caught up so we take its requests again
+        sync_reads(sfd);
+
+      }
+
     }
 
-    //release the sfd write lock
-    wr->mutex->unlock();
+  }
+
+}
+
+/**
+ * Writes out a writer that was held for more frames once its time is up
+ */
+void SocketServer::flush(const int32_t sfd) {
+
+  std::shared_ptr<Strand> strand = write_strand(sfd);
+  if(strand == NULL) {
+
+    return;
 
   }
 
+  strand->post([this, sfd]() {
+
+    this->w_mutex.lock();
+    std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+    if(wr_got != this->wrm.end()) {
+
+      wr_got->second.held = false;
+
+    }
+    this->w_mutex.unlock();
+
+    this->write(sfd);
+
+  });
+
 }
 
 /**
@@ -374,53 +622,310 @@ void SocketServer:: write(int32_t sfd) {
  */
 void SocketServer::send_msg(std::vector<char> &uuid_v, std::vector<char> &msg_v, const int32_t sfd) {
 
-  //make a buffer just big enough for uuid + size + del
-  uint32_t mfs = 37+msg_v.size()+1;
-  char msg_frame[mfs]; 
+  send_msg(&uuid_v[0], msg_v.data(), msg_v.size(), sfd);
+
+}
+
+/**
+ * Add message to a BufferedWriter for this sfd from a 37 byte uuid and a
+ * message that the caller keeps ownership of
+ */
+void SocketServer::send_msg(const char *uuid, const char *msg, size_t msg_size, const int32_t sfd) {
+
+  if(!SocketUtils::fits_frame(this->framing, msg_size)) {
+
+    logger.error(std::string("Dropping a message too big for a frame: ") + std::to_string(msg_size));
+    return;
+
+  }
+
+  //make a buffer just big enough for the frame
+  std::vector<char> msg_frame(SocketUtils::frame_size(this->framing, msg_size)); 
   //pack it neatly into a frame
-  SocketUtils::pack_frame(uuid_v, msg_v, msg_frame);
+  SocketUtils::pack_frame(this->framing, uuid, msg, msg_size, &msg_frame[0]);
 
-  //grab a mutex for read
-  this->w_mutex.lock();
+  //the frame is handed to the writer as is
+  size_t f_size = msg_frame.size();
+  queue(sfd, f_size, [msg_frame = std::move(msg_frame)](BufferedWriter &bw) mutable {
 
-  //get the resource
-  SocketUtils::WriteR *wr = NULL;
+    bw.write(std::move(msg_frame));
 
-  //let's get our buffered writer out for this sfd
-  std::unordered_map<int32_t, SocketUtils::WriteR>::const_iterator wr_got = this->wrm.find(sfd);
-  if( wr_got != this->wrm.end()) {
+  });
+
+}
+
+/**
+ * Add message to a BufferedWriter for this sfd from a 37 byte uuid and a
+ * message that stays valid as long as keep lives
+ */
+void SocketServer::send_msg(const char *uuid, const char *msg, size_t msg_size, std::shared_ptr<const void> keep,
+    const int32_t sfd) {
+
+  if(!SocketUtils::fits_frame(this->framing, msg_size)) {
+
+    logger.error(std::string("Dropping a message too big for a frame: ") + std::to_string(msg_size));
+    return;
 
-    wr = &this->wrm.find(sfd)->second;
-    
   }
 
-  //release the read lock
+  //the header and trailer are small so they get copied, the message doesn't
+  std::array<char, SocketUtils::MAX_HEADER + 1> edges;
+  size_t h_size = SocketUtils::pack_header(this->framing, uuid, msg_size, edges.data());
+  size_t t_size = SocketUtils::pack_trailer(this->framing, edges.data() + h_size);
+
+  queue(sfd, h_size + msg_size + t_size, [edges, h_size, t_size, msg, msg_size, keep](BufferedWriter &bw) {
+
+    bw.write(edges.data(), h_size);
+    bw.write(msg, msg_size, keep);
+    bw.write(edges.data() + h_size, t_size);
+
+  });
+
+}
+
+/**
+ * Add message to a BufferedWriter for this sfd from a 37 byte uuid and a
+ * message the server takes ownership of
+ */
+void SocketServer::send_msg(const char *uuid, std::vector<char> &&msg, const int32_t sfd) {
+
+  std::shared_ptr<std::vector<char>> owned = std::make_shared<std::vector<char>>(std::move(msg));
+  send_msg(uuid, owned->data(), owned->size(), owned, sfd);
+
+}
+
+/**
+ * Add message to a BufferedWriter for this sfd from a 37 byte uuid and a
+ * message the server takes ownership of
+ */
+void SocketServer::send_msg(const char *uuid, std::string &&msg, const int32_t sfd) {
+
+  std::shared_ptr<std::string> owned = std::make_shared<std::string>(std::move(msg));
+  send_msg(uuid, owned->data(), owned->size(), owned, sfd);
+
+}
+
+/**
+ * Send size bytes of fd from offset as the message on socket file
+ * descriptor, with a 37 byte uuid
+ */
+void SocketServer::send_file(const char *uuid, const int32_t fd, const off_t offset, const size_t size,
+    const int32_t sfd) {
+
+  if(!SocketUtils::fits_frame(this->framing, size)) {
+
+    logger.error(std::string("Dropping a message too big for a frame: ") + std::to_string(size));
+    return;
+
+  }
+
+  //our own fd so the caller's can go whenever, closed once the bytes are sent
+  int32_t d_fd = dup(fd);
+  if(d_fd < 0) {
+
+    logger.error(std::string("Couldn't duplicate the fd of a file to send: ") + std::to_string(errno));
+    return;
+
+  }
+
+  std::shared_ptr<const void> keep(new int32_t(d_fd), [](const int32_t *f_fd) {
+
+    close(*f_fd);
+    delete f_fd;
+
+  });
+
+  //the header and trailer go through the writer, the file doesn't
+  std::array<char, SocketUtils::MAX_HEADER + 1> edges;
+  size_t h_size = SocketUtils::pack_header(this->framing, uuid, size, edges.data());
+  size_t t_size = SocketUtils::pack_trailer(this->framing, edges.data() + h_size);
+
+  queue(sfd, h_size + size + t_size, [edges, h_size, t_size, d_fd, offset, size, keep](BufferedWriter &bw) {
+
+    bw.write(edges.data(), h_size);
+    bw.write_file(d_fd, offset, size, keep);
+    bw.write(edges.data() + h_size, t_size);
+
+  });
+
+}
+
+/**
+ * Runs writes of bytes on the BufferedWriter of sfd from its write strand and
+ * has epoll tell us when the socket can take them
+ */
+void SocketServer::queue(const int32_t sfd, const size_t bytes, std::function<void(BufferedWriter &bw)> writes) {
+
+  std::shared_ptr<Strand> strand;
+  std::shared_ptr<SocketUtils::Backlog> backlog;
+  size_t buffered = 0;
+
+  this->w_mutex.lock();
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got != this->wrm.end()) {
+
+    strand = wr_got->second.strand;
+    backlog = wr_got->second.backlog;
+    buffered = wr_got->second.bw.size();
+
+  }
   this->w_mutex.unlock();
 
-  if(wr != NULL) {
+  if(strand == NULL) {
 
-    //grab the sfd write lock
-    wr->mutex->lock();
+    return;
 
-    if(wr->is_valid) {
+  }
+
+  //the frame counts from now on, not once the strand gets to it, so a burst of
+  //responses can't get past the high water while they wait in the strand
+  size_t total = backlog->queued.fetch_add(bytes) + bytes + buffered;
+  this->q_bytes += bytes;
+
+  if(this->limits.high_water > 0 && total >= this->limits.high_water && !backlog->over.exchange(true)) {
+
+    //the peer isn't keeping up with its responses so stop taking its requests
+    logger.info(std::string("Pausing reads on sfd over the high water: ") + std::to_string(sfd));
+    sync_reads(sfd);
+
+  }
+
+  //the buffered writer belongs to the write strand so the frame goes through it
+  strand->post([this, sfd, bytes, backlog, writes = std::move(writes)]() {
+
+    //grab a mutex for the map
+    this->w_mutex.lock();
+
+    //get the resource
+    SocketUtils::WriteR *wr = NULL;
+
+    //let's get our buffered writer out for this sfd
+    std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+    if( wr_got != this->wrm.end()) {
+
+      wr = &wr_got->second;
+      
+    }
+
+    //release the map lock
+    this->w_mutex.unlock();
+
+    if(wr != NULL && wr->is_valid) {
 
       //if this resource is not dead then write to the buffered writer 
-      wr->bw.write(msg_frame, mfs);
+      writes(wr->bw);
+      this->w_frames++;
 
     }
 
-    //release the sfd write lock
-    wr->mutex->unlock();
+    //the writer counts the bytes now, or they are gone with the connection
+    backlog->queued -= bytes;
+    this->q_bytes -= bytes;
 
-    //tell empoll to let us know when we can write cause we have stuff to write
-    //grab a shared read lock
-    this->e_mutex.lock();
-    sfd_events[sfd] |= EPOLLOUT;
-    SocketUtils::set_epoll(this->ep_sfd, sfd, sfd_events[sfd] );
-    this->e_mutex.unlock();
+    if(wr != NULL && wr->is_valid) {
+
+      //tell empoll to let us know when we can write cause we have stuff to write.
+      //if it already is the frame goes out with the ones before it, and a held
+      //writer waits for its flush unless this made it big enough to go
+      this->e_mutex.lock();
+      if(!(this->sfd_events[sfd] & EPOLLOUT) && (!wr->held || wr->bw.size() >= this->limits.flush_bytes)) {
+
+        this->sfd_events[sfd] |= EPOLLOUT;
+        SocketUtils::set_epoll(this->ep_sfd, sfd, this->sfd_events[sfd] );
+
+      }
+      this->e_mutex.unlock();
+
+    }
+
+  });
+
+}
+
+/**
+ * Pauses or resumes reading from sfd to match whether its writer is over the
+ * high water, through its read strand
+ */
+void SocketServer::sync_reads(const int32_t sfd) {
+
+  std::shared_ptr<Strand> strand = read_strand(sfd);
+  if(strand == NULL) {
+
+    return;
+
+  }
+
+  strand->post([this, sfd]() {
+
+    //the flag is read here rather than passed in so a pause and a resume that
+    //race each other here still end up where the writer is
+    bool paused = false;
+    this->w_mutex.lock();
+    std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+    if(wr_got != this->wrm.end()) {
+
+      paused = wr_got->second.backlog->over;
+
+    }
+    this->w_mutex.unlock();
+
+    this->r_mutex.lock();
+    std::unordered_map<int32_t, SocketUtils::ReadR>::iterator rr_got = this->rrm.find(sfd);
+    bool was_paused = false;
+    if(rr_got != this->rrm.end()) {
+
+      was_paused = rr_got->second.paused;
+      rr_got->second.paused = paused;
+
+    }
+    this->r_mutex.unlock();
+
+    if(was_paused && !paused) {
+
+      //whatever came in while we were paused is waiting and this turns EPOLLIN
+      //back on
+      this->read(sfd);
+
+    }
+
+  });
+
+}
+
+/**
+ * Returns the read strand of sfd or NULL if sfd is unknown
+ */
+std::shared_ptr<Strand> SocketServer::read_strand(int32_t sfd) {
+
+  std::lock_guard<std::mutex> lck(this->r_mutex);
+
+  std::unordered_map<int32_t, SocketUtils::ReadR>::iterator rr_got = this->rrm.find(sfd);
+  if(rr_got == this->rrm.end()) {
+
+    return NULL;
+
+  }
+
+  return rr_got->second.strand;
+
+}
+
+/**
+ * Returns the write strand of sfd or NULL if sfd is unknown
+ */
+std::shared_ptr<Strand> SocketServer::write_strand(int32_t sfd) {
+
+  std::lock_guard<std::mutex> lck(this->w_mutex);
+
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got == this->wrm.end()) {
+
+    return NULL;
 
   }
 
+  return wr_got->second.strand;
+
 }
 
 /**
@@ -438,7 +943,6 @@ void SocketServer::close_n_clean(int32_t sfd) {
   std::unordered_map<int32_t, SocketUtils::ReadR>::const_iterator rr_got = this->rrm.find(sfd);
   if( rr_got != this->rrm.end()) {
 
-    delete this->rrm[sfd].mutex;
     this->rrm.erase(sfd);
 
   }
@@ -449,7 +953,6 @@ void SocketServer::close_n_clean(int32_t sfd) {
   std::unordered_map<int32_t, SocketUtils::WriteR>::const_iterator wr_got = this->wrm.find(sfd);
   if( wr_got != this->wrm.end()) {
 
-    delete this->wrm[sfd].mutex;
     this->wrm.erase(sfd);
   }
   this->w_mutex.unlock();
@@ -464,61 +967,106 @@ void SocketServer::close_n_clean(int32_t sfd) {
 }
 
 /**
- * Method adds sfd to a set of zombied to be reaped later
+ * Method adds sfd to a set of zombied and schedules it to be reaped later
  */
 void SocketServer::a_zombied(int32_t sfd) {
 
   //grab lock
-  this->z_mutex.lock();
+  std::lock_guard<std::mutex> lck(this->z_mutex);
+
+  //the reader and the writer can both mark it but it only gets reaped once
+  if(this->zm.find(sfd) != this->zm.end()) {
+
+    return;
+
+  }
+
   //add this sfd to zombied set
   this->zm[sfd] = Utils::epoch_millis_now();
-  //release the zombie set lock
+
+  //reap after 60 seconds of being marked for death
+  this->timers.schedule(60000, [this, sfd]() { this->reap(sfd); });
+
+}
+
+/**
+ * Cleans up the resources of a zombied sfd once its time is up
+ */
+void SocketServer::reap(int32_t sfd) {
+
+  logger.info(std::string("Reaping zombied sfd: ") + std::to_string(sfd));
+
+  //close and clean resources
+  this->close_n_clean(sfd);
+
+  //now remove the entry from our zombie set
+  this->z_mutex.lock();
+  this->zm.erase(sfd);
   this->z_mutex.unlock();
 
 }
 
 /**
- * This method starts a thread that will continuously clean up zombied socket resouces
+ * Runs bulk work on the read pool's LOW lane so it only gets the workers
+ * the message handlers leave over.  Returns false if it was rejected
  */
-void SocketServer::reap_resources() {
+bool SocketServer::add_background_work(std::function<void()> work) {
 
-  logger.info("Starting zombied resource reaper");
+  return this->r_tp.add_work(std::move(work), ThreadPool::LOW);
 
-  while(1) {
+}
 
-    //sleep for 30 seconds and then loop
-    std::this_thread::sleep_for(std::chrono::seconds(30));
-    logger.info("Reaping zombied resources");
+/**
+ * Returns the bytes held in partial frames across all connections
+ */
+uint64_t SocketServer::partial_bytes() {
 
-    //grab the zombied sfd lock
-    this->z_mutex.lock();
+  return this->p_bytes.load();
 
-    std::vector<int32_t> zv;
-    for(auto it = this->zm.begin(); it != this->zm.end(); ++it ) {
+}
 
-      //reap after 60 seconds of being marked for death
-     if((Utils::epoch_millis_now() - it->second) > 60000) {
+/**
+ * Returns the frames queued across all connections
+ */
+uint64_t SocketServer::frames_queued() {
 
-        //close and clean resources
-        this->close_n_clean(it->first);
-        zv.emplace_back(it->first);
+  return this->w_frames.load();
 
-      }
+}
 
-    }
+/**
+ * Returns the send calls that got bytes out across all connections
+ */
+uint64_t SocketServer::send_calls() {
 
-    for(int32_t &zsfd : zv) {
-      
-      //now remove the entries from our zombie set
-      this->zm.erase(zsfd);
-    
-    }
+  return this->w_sends.load();
 
-    this->z_mutex.unlock();
+}
 
+/**
+ * Returns the bytes waiting to be written across all connections, queued
+ * frames included
+ */
+uint64_t SocketServer::buffered_bytes() {
 
-  }
+  return this->w_bytes.load() + this->q_bytes.load();
 
 }
 
+/**
+ * Returns the bytes waiting to be written to sfd, queued frames included
+ */
+uint64_t SocketServer::buffered_bytes(const int32_t sfd) {
+
+  std::lock_guard<std::mutex> lck(this->w_mutex);
+
+  std::unordered_map<int32_t, SocketUtils::WriteR>::iterator wr_got = this->wrm.find(sfd);
+  if(wr_got == this->wrm.end()) {
+
+    return 0;
 
+  }
+
+  return wr_got->second.bw.size() + wr_got->second.backlog->queued.load();
+
+}
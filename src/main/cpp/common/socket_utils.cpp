@@ -4,6 +4,28 @@ using namespace asutils;
 
 log4cpp::Category& SocketUtils::logger = log4cpp::Category::getRoot();
 
+const size_t SocketUtils::MAX_IOV;
+const size_t SocketUtils::MAX_HEADER;
+
+/**
+ * The settings for the read and write pools.  They start at one thread per
+ * core and grow to four per core when handlers block.  When cpus is not
+ * empty the workers are pinned to it and sized by it
+ */
+ThreadPool::Config SocketUtils::io_pool_config(const std::vector<uint32_t> &cpus) {
+
+  uint32_t cores = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+
+  ThreadPool::Config config(cores, ThreadPool::STEALING);
+  config.max_size = 4 * config.p_size;
+  config.cpus = cpus;
+  //background work still gets a turn after every eight messages
+  config.high_weight = 8;
+
+  return config;
+
+}
+
 /**
  * This method makes the socket non blocking
  */
@@ -154,7 +176,24 @@ void SocketUtils::add_fd_to_epoll(int32_t ep_sfd, int32_t sfd, std::function<voi
 }
 
 /**
- * This method drains the sfd into a buffered reader until it is told to stop by epoll
+ * The bounds on what a connection's reader holds
+ */
+SocketUtils::Limits::Limits(const size_t max_frame, const size_t budget, const size_t flush_bytes,
+    const uint64_t flush_micros, const size_t high_water, const size_t low_water) {
+
+  this->max_frame = max_frame;
+  this->budget = budget;
+  this->flush_bytes = flush_bytes;
+  this->flush_micros = flush_micros;
+  this->high_water = high_water;
+  this->low_water = low_water;
+
+}
+
+/**
+ * This method drains the sfd into a buffered reader until it is told to stop by epoll.
+ * The socket reads straight into the reader's buffer.  A reader that overflows is
+ * handled like a closed connection
  */
 void SocketUtils::read_from_sfd(int32_t ep_sfd, int32_t sfd, BufferedReader &reader, std::function<void()> close_callback, 
     std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex) {
@@ -166,10 +205,11 @@ void SocketUtils::read_from_sfd(int32_t ep_sfd, int32_t sfd, BufferedReader &rea
 
   while(keep_reading) {
 
-    char r_buff[1024];
-
-    //lets read some bytes into a buffer
-    ssize_t bytes_read = read(sfd, r_buff, sizeof(r_buff));
+    //lets read some bytes straight into the reader.  it grows the space while
+    //reads keep filling it
+    size_t space;
+    char *r_buff = reader.prepare(space);
+    ssize_t bytes_read = read(sfd, r_buff, space);
 
     if( bytes_read < 0 ) {
 
@@ -199,9 +239,14 @@ void SocketUtils::read_from_sfd(int32_t ep_sfd, int32_t sfd, BufferedReader &rea
       set_epollin = false;
       keep_reading = false; 
       
-    } else {
+    } else if(!reader.commit(bytes_read)) {
+
+      //the peer sent a frame over the limit so we are done with it
+      logger.error(std::string("Frame over the limit on sfd: ") + std::to_string(sfd));
+      close_callback();
 
-      reader.read(r_buff, bytes_read);
+      set_epollin = false;
+      keep_reading = false; 
 
     }
 
@@ -237,32 +282,103 @@ void SocketUtils::set_epoll(int32_t ep_sfd, int32_t sfd, int32_t events) {
 }
 
 /**
- * This method drains the sockets write buffer until it is empty or
- * it's told not to by epoll
+ * This method drains the sockets write buffer until it is empty or it's told
+ * not to by epoll.  Small young writers wait for more frames and the caller
+ * is told how long
  */
-void SocketUtils::write_to_sfd(int32_t ep_sfd, int32_t sfd, BufferedWriter &writer, std::function<void()> close_callback,
-    std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex) {
+uint64_t SocketUtils::write_to_sfd(int32_t ep_sfd, int32_t sfd, BufferedWriter &writer, std::function<void()> close_callback,
+    std::unordered_map<int32_t, int32_t> &sfd_events, std::mutex &e_mutex, const Limits &limits,
+    std::atomic<uint64_t> *sends, bool *corked) {
+
+  //how much longer the writer can wait for more frames
+  uint64_t left = 0;
+  if(limits.flush_bytes > 0 && writer.size() > 0) {
+
+    uint64_t age = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - writer.since()).count();
+    left = age < limits.flush_micros ? limits.flush_micros - age : 0;
+
+  }
+
+  //a corked tail is already waiting in the kernel so whatever comes next pushes it out
+  bool was_corked = corked != NULL && *corked;
+
+  if(left > 0 && writer.size() < limits.flush_bytes && !was_corked) {
+
+    //more frames are likely on the way.  epoll would just wake us right back up
+    //so it stops watching until the caller flushes us
+    e_mutex.lock();
+    if(sfd_events[sfd] & EPOLLOUT) {
+
+      sfd_events[sfd] &= ~EPOLLOUT;
+      SocketUtils::set_epoll(ep_sfd, sfd, sfd_events[sfd]);
+
+    }
+    e_mutex.unlock();
+
+    return left;
+
+  }
+
+  //the writer is big enough to go but frames are still coming, so the kernel
+  //holds the partial last packet for them until the caller flushes us
+  bool more = left > 0 && corked != NULL && !was_corked;
+  if(more) {
+
+    int32_t on = 1;
+    setsockopt(sfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    *corked = true;
+
+  }
 
   bool keep_writing = true;
 
+  struct iovec iov[MAX_IOV];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+
+  int32_t f_fd;
+  off_t f_offset;
+  size_t f_size;
+
   while(keep_writing && writer.size() > 0) {
 
-    //let's get some bytes out of our writer
-    size_t b_size = 1024;
+    ssize_t r;
 
-    if(writer.size() < b_size) {
-      //if what we have to write is less than 1024 
-      //let's set our size to what's in the buffer
+    if(writer.file(f_fd, f_offset, f_size)) {
 
-      b_size = writer.size();
-    
-    }
+      //file bytes go from the page cache to the socket without coming through us
+      r = sendfile(sfd, f_fd, &f_offset, f_size);
 
-    char r_buff[b_size];
-    writer.iread(r_buff, b_size);
+      if(r == 0) {
 
-    //attempt to send it off
-    int32_t r = write(sfd, r_buff, b_size);
+        //the file is shorter than we said, the frame can't be finished
+        logger.error(std::string("File ended before its frame on the socket.  Cannot continue: ") + std::to_string(sfd));
+        close_callback();
+        keep_writing = false;
+        continue;
+
+      }
+
+    } else {
+
+      //hand the kernel as much of the writer as it takes in one call, straight
+      //out of the chunks
+      msg.msg_iovlen = writer.peek(iov, MAX_IOV);
+
+      size_t pending = 0;
+      for(size_t i=0; i < msg.msg_iovlen; ++i) {
+
+        pending += iov[i].iov_len;
+
+      }
+
+      //if this isn't all of it tell the kernel to hold the tail of the packet for
+      //the next call of this drain
+      int32_t flags = MSG_NOSIGNAL | (pending < writer.size() ? MSG_MORE : 0);
+      r = sendmsg(sfd, &msg, flags);
+
+    }
 
     if( r < 0) {
 
@@ -286,13 +402,30 @@ void SocketUtils::write_to_sfd(int32_t ep_sfd, int32_t sfd, BufferedWriter &writ
       
     } else {
 
-      //if we wrote successfully remote the written bytes from our buffer
-      writer.clear(b_size);
+      //drop what made it out, a partial write leaves the rest for next time
+      writer.clear(r);
+
+      if(sends != NULL) {
+
+        (*sends)++;
+
+      }
 
     }
 
   }
 
+  if(was_corked) {
+
+    //this is the final flush, out goes the tail the kernel was holding
+    int32_t off = 0;
+    setsockopt(sfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    *corked = false;
+
+  }
+
+  return more ? left : 0;
+
 }
 
 /**
@@ -372,3 +505,137 @@ void SocketUtils::unpack_frame(const char *msg, size_t msg_size, std::vector<cha
   }
 
 }
+
+/**
+ * Returns the bytes a frame of msg_size bytes takes on the wire
+ */
+size_t SocketUtils::frame_size(const BufferedReader::Framing framing, size_t msg_size) {
+
+  if(framing == BufferedReader::LENGTH_PREFIXED) {
+
+    //prefix + uuid + msg
+    return BufferedReader::PREFIX_SIZE + 37 + msg_size;
+
+  }
+
+  //uuid + msg + del
+  return 37 + msg_size + 1;
+
+}
+
+/**
+ * Returns false if a message of msg_size bytes is too big for a frame
+ */
+bool SocketUtils::fits_frame(const BufferedReader::Framing framing, size_t msg_size) {
+
+  if(framing == BufferedReader::LENGTH_PREFIXED) {
+
+    return msg_size <= UINT32_MAX - 37;
+
+  }
+
+  return true;
+
+}
+
+/**
+ * Creates a message frame of frame_size(framing, msg_size) bytes
+ */
+void SocketUtils::pack_frame(const BufferedReader::Framing framing, const char *id, const char* msg, size_t msg_size,
+    char *result) {
+
+  if(framing == BufferedReader::DELIMITED) {
+
+    pack_frame(id, msg, msg_size, result);
+    return;
+
+  }
+
+  //the prefix counts the uuid and the msg
+  BufferedReader::write_prefix(37 + msg_size, result);
+  memcpy(result + BufferedReader::PREFIX_SIZE, id, 37);
+  memcpy(result + BufferedReader::PREFIX_SIZE + 37, msg, msg_size);
+
+}
+
+/**
+ * Writes what goes in front of a message of msg_size bytes and returns how
+ * many bytes it wrote
+ */
+size_t SocketUtils::pack_header(const BufferedReader::Framing framing, const char *id, size_t msg_size, char *result) {
+
+  if(framing == BufferedReader::DELIMITED) {
+
+    memcpy(result, id, 37);
+    return 37;
+
+  }
+
+  BufferedReader::write_prefix(37 + msg_size, result);
+  memcpy(result + BufferedReader::PREFIX_SIZE, id, 37);
+  return BufferedReader::PREFIX_SIZE + 37;
+
+}
+
+/**
+ * Writes what goes after a message and returns how many bytes it wrote
+ */
+size_t SocketUtils::pack_trailer(const BufferedReader::Framing framing, char *result) {
+
+  if(framing == BufferedReader::DELIMITED) {
+
+    result[0] = (char) 4;
+    return 1;
+
+  }
+
+  return 0;
+
+}
+
+/**
+ * Unpacks a whole message frame as it was on the wire
+ */
+void SocketUtils::unpack_frame(const BufferedReader::Framing framing, const char *frame, size_t frame_size,
+    std::vector<char> &uuid_v, std::vector<char> &msg_v) {
+
+  if(framing == BufferedReader::DELIMITED) {
+
+    unpack_frame(frame, frame_size, uuid_v, msg_v);
+    return;
+
+  }
+
+  const char *msg;
+  size_t msg_size;
+
+  //past the prefix it is just uuid and msg
+  if(frame_size >= BufferedReader::PREFIX_SIZE &&
+      unpack_frame(frame + BufferedReader::PREFIX_SIZE, frame_size - BufferedReader::PREFIX_SIZE, msg, msg_size)) {
+
+    uuid_v.insert(uuid_v.end(), frame + BufferedReader::PREFIX_SIZE, msg);
+    msg_v.insert(msg_v.end(), msg, msg + msg_size);
+
+  }
+
+}
+
+/**
+ * Finds the message in a frame the BufferedReader already stripped the del
+ * off of.  Nothing is copied
+ */
+bool SocketUtils::unpack_frame(const char *frame, size_t frame_size, const char *&msg, size_t &msg_size) {
+
+  if(frame_size < 37) {
+
+    return false;
+
+  }
+
+  //bytes 0-36 are the uuid and the rest is the msg
+  msg = frame + 37;
+  msg_size = frame_size - 37;
+
+  return true;
+
+}
@@ -0,0 +1,128 @@
+#include "strand.hpp"
+
+using namespace asutils;
+
+log4cpp::Category& Strand::logger = log4cpp::Category::getRoot();
+
+/**
+ * The constructor takes the pool the work runs on
+ */
+Strand::Strand(ThreadPool &pool) : pool(pool) {
+
+  this->running = false;
+
+}
+
+/**
+ * Queues work on the strand.  If the strand was idle this returns the task
+ * that runs it, which the caller has to hand to the pool.  Otherwise it
+ * returns an empty task
+ */
+Task Strand::enqueue(Task &&work) {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+  this->tasks.push_back(std::move(work));
+
+  if(this->running) {
+
+    //whoever is running the strand will get to it
+    return Task();
+
+  }
+
+  this->running = true;
+
+  return Task(Runner(shared_from_this()));
+
+}
+
+/**
+ * Hands the task returned by enqueue to the pool.  If the pool rejects it
+ * the strand goes idle and the next enqueue schedules it again
+ */
+void Strand::schedule(Task &&run) {
+
+  //a rejected runner is dropped, which sets the strand idle
+  this->pool.post(std::move(run));
+
+}
+
+/**
+ * Marks the strand idle after its runner was dropped
+ */
+void Strand::idle() {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+  this->running = false;
+
+}
+
+/**
+ * Runs up to RUN_BATCH queued tasks at a time and requeues itself if there
+ * are more and the pool has room.  A task that throws is logged and the ones
+ * behind it still run
+ */
+void Strand::run() {
+
+  Task work;
+
+  while(1) {
+
+    for(size_t i=0; i < RUN_BATCH; ++i) {
+
+      this->mutex.lock();
+
+      if(this->tasks.empty()) {
+
+        //all caught up, the next enqueue schedules us again
+        this->running = false;
+        this->mutex.unlock();
+        return;
+
+      }
+
+      work = std::move(this->tasks.front());
+      this->tasks.pop_front();
+      this->mutex.unlock();
+
+      try {
+
+        work();
+
+      } catch(std::exception &e) {
+
+        //the pool has nowhere to send it so one bad task only loses itself and
+        //the ones queued behind it still run
+        logger.error(std::string("A task on a strand threw: ") + e.what());
+
+      } catch(...) {
+
+        logger.error("A task on a strand threw");
+
+      }
+
+      work = Task();
+
+    }
+
+    //there is more to do but other keys get the worker first.  we can't wait on
+    //a full pool from inside it so if there is no room we just keep going
+    if(this->pool.try_post(Runner(shared_from_this()))) {
+
+      return;
+
+    }
+
+    //the runner we tried was dropped and set us idle.  we keep going unless an
+    //enqueue in the mean time already scheduled another one
+    std::lock_guard<std::mutex> lck(this->mutex);
+    if(this->running) {
+
+      return;
+
+    }
+    this->running = true;
+
+  }
+
+}
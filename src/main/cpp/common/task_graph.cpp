@@ -0,0 +1,260 @@
+#include "task_graph.hpp"
+
+using namespace asutils;
+
+log4cpp::Category& TaskGraph::logger = log4cpp::Category::getRoot();
+
+const size_t TaskGraph::INVALID;
+
+/**
+ * The constructor takes the pool and lane the nodes run on
+ */
+TaskGraph::TaskGraph(ThreadPool &pool, const ThreadPool::Priority lane) : pool(pool), remaining(0), cancelled(false) {
+
+  this->lane = lane;
+  this->started = false;
+  this->done = false;
+
+}
+
+/**
+ * The destructor cancels the graph and waits for the running nodes
+ */
+TaskGraph::~TaskGraph() {
+
+  cancel();
+
+  std::unique_lock<std::mutex> lck(this->mutex);
+  while(this->started && !this->done) {
+
+    this->done_cv.wait(lck);
+
+  }
+
+}
+
+/**
+ * Adds a node running work after deps
+ */
+size_t TaskGraph::add_task(Task &&work, const std::vector<size_t> &deps) {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+
+  if(this->started) {
+
+    logger.error("Can't add a node to a task graph that already runs");
+    return INVALID;
+
+  }
+
+  size_t id = this->nodes.size();
+
+  for(size_t d : deps) {
+
+    if(d >= id) {
+
+      logger.error(std::string("Unknown task graph dependency: ") + std::to_string(d));
+      return INVALID;
+
+    }
+
+  }
+
+  std::unique_ptr<Node> node(new Node());
+  node->work = std::move(work);
+  node->pending = deps.size();
+
+  for(size_t d : deps) {
+
+    this->nodes[d]->dependents.push_back(id);
+
+  }
+
+  this->nodes.push_back(std::move(node));
+
+  return id;
+
+}
+
+/**
+ * Starts every node without dependencies.  Only the first call gets a
+ * valid future
+ */
+std::future<bool> TaskGraph::run() {
+
+  std::vector<size_t> roots;
+
+  this->mutex.lock();
+
+  if(this->started) {
+
+    this->mutex.unlock();
+    logger.error("A task graph only runs once");
+    return std::future<bool>();
+
+  }
+
+  this->started = true;
+  std::future<bool> result = this->completion.get_future();
+  this->remaining = this->nodes.size();
+
+  if(this->nodes.empty()) {
+
+    //nothing to wait for
+    this->done = true;
+    this->completion.set_value(true);
+
+  }
+
+  for(size_t i=0; i < this->nodes.size(); ++i) {
+
+    if(this->nodes[i]->pending == 0) {
+
+      roots.push_back(i);
+
+    }
+
+  }
+
+  this->mutex.unlock();
+
+  for(size_t r : roots) {
+
+    if(!this->pool.post([this, r]() { this->execute(r); }, this->lane)) {
+
+      //a full pool gets no say in whether the graph finishes
+      execute(r);
+
+    }
+
+  }
+
+  return result;
+
+}
+
+/**
+ * Runs a node and then whatever it made ready.  One ready dependent stays
+ * on this thread and the rest go to the pool
+ */
+void TaskGraph::execute(size_t node) {
+
+  std::vector<size_t> ready;
+  ready.push_back(node);
+
+  while(!ready.empty()) {
+
+    Node *n = this->nodes[ready.back()].get();
+    ready.pop_back();
+
+    if(!this->cancelled) {
+
+      try {
+
+        n->work();
+
+      } catch(...) {
+
+        //the first failure wins and nothing new starts after it
+        this->mutex.lock();
+        if(!this->error) {
+
+          this->error = std::current_exception();
+
+        }
+        this->mutex.unlock();
+
+        cancel();
+
+      }
+
+    }
+
+    //drop whatever the work captured right away
+    n->work = Task();
+
+    bool kept = false;
+    for(size_t d : n->dependents) {
+
+      if(--this->nodes[d]->pending > 0) {
+
+        continue;
+
+      }
+
+      if(!kept) {
+
+        //we run this one ourselves instead of paying for a hand off
+        ready.push_back(d);
+        kept = true;
+
+      } else if(!this->pool.post([this, d]() { this->execute(d); }, this->lane)) {
+
+        ready.push_back(d);
+
+      }
+
+    }
+
+    //the last node can free the graph so this is the final touch of n
+    finish();
+
+  }
+
+}
+
+/**
+ * Marks a node finished and fulfills the completion once it was the last
+ */
+void TaskGraph::finish() {
+
+  if(--this->remaining > 0) {
+
+    return;
+
+  }
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+
+  if(this->error) {
+
+    this->completion.set_exception(this->error);
+
+  } else {
+
+    this->completion.set_value(!this->cancelled);
+
+  }
+
+  this->done = true;
+  this->done_cv.notify_all();
+
+}
+
+/**
+ * Cancels the graph.  Running nodes finish but no new ones start
+ */
+void TaskGraph::cancel() {
+
+  this->cancelled = true;
+
+}
+
+/**
+ * Returns true once the graph was cancelled
+ */
+bool TaskGraph::is_cancelled() {
+
+  return this->cancelled;
+
+}
+
+/**
+ * Returns the number of nodes
+ */
+size_t TaskGraph::size() {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+  return this->nodes.size();
+
+}
@@ -2,13 +2,113 @@
 
 using namespace asutils;
 
+/**
+ * The pool and index of the worker running on this thread so work added from
+ * inside a STEALING pool can go on the worker's own deque
+ */
+static thread_local ThreadPool *tl_pool = NULL;
+static thread_local uint32_t tl_index = 0;
+
+/**
+ * Monotonic micros used to time how long producers are blocked and how long
+ * work sits in the queue
+ */
+static uint64_t now_micros() {
+
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+
+}
+
+/**
+ * The default settings for a pool of p_size threads in the given mode
+ */
+ThreadPool::Config::Config(const uint32_t p_size, const Mode mode) {
+
+  this->p_size = p_size;
+  this->mode = mode;
+  this->backend = LOCKING;
+  this->capacity = 0;
+  this->policy = BLOCK;
+  this->block_to_millis = 0;
+  this->max_size = 0;
+  this->target_wait_micros = 10000;
+  this->idle_to_millis = 60000;
+  this->high_weight = 0;
+
+}
+
 /**
  * The constructor adds a threadpool size
  */
-ThreadPool::ThreadPool(const uint32_t p_size) {
+ThreadPool::ThreadPool(const uint32_t p_size) : ThreadPool(Config(p_size)) {
+
+}
+
+/**
+ * The constructor adds a threadpool size and a scheduling mode
+ */
+ThreadPool::ThreadPool(const uint32_t p_size, const Mode mode) : ThreadPool(Config(p_size, mode)) {
+
+}
+
+/**
+ * The constructor takes the full pool settings
+ */
+ThreadPool::ThreadPool(const Config &config) : l_pending(0), pending(0), parked(0), p_parked(0),
+  rejected(0), dropped(0), caller_runs(0), blocked_micros(0), last_pop(now_micros()), last_spawn(0) {
 
   //set the pool size
-  this->p_size = p_size;
+  this->p_size = config.p_size;
+  this->mode = config.mode;
+  this->backend = config.backend;
+  this->stop = false;
+  this->a_threads = 0;
+
+  this->policy = config.policy;
+  this->block_to_millis = config.block_to_millis;
+
+  //the pool only grows when max_size is above p_size
+  this->max_size = std::max(config.max_size, config.p_size);
+  this->elastic = this->max_size > this->p_size;
+  this->target_wait_micros = config.target_wait_micros;
+  this->idle_to_millis = config.idle_to_millis;
+  this->cpus = config.cpus;
+  this->high_weight = config.high_weight;
+
+  for(uint32_t i=0; i < 2; ++i) {
+
+    this->l_taken[i].store(0);
+    this->l_wait[i].store(0);
+
+  }
+
+  //by default the shared queue holds as much as there are workers and the
+  //stealing deques are unbounded
+  this->capacity = config.capacity;
+  if(this->capacity == 0 && this->mode == SHARED) {
+
+    this->capacity = this->p_size;
+
+  }
+
+  if(this->mode == STEALING) {
+
+    //every worker the pool can grow to gets its own deque up front so the
+    //deques never move under the thieves
+    for(uint32_t i=0; i < this->max_size; ++i) {
+
+      this->w_queues.emplace_back(new WorkerQueue());
+      this->w_live.push_back(false);
+
+    }
+
+  } else if(this->backend == RING) {
+
+    this->r_queue.reset(new RingQueue<QueuedTask>(this->capacity));
+    this->capacity = this->r_queue->capacity();
+
+  }
 
   //build the workers
   build_worker_threads();
@@ -16,14 +116,78 @@ ThreadPool::ThreadPool(const uint32_t p_size) {
 }
 
 /**
- * This method creates the threads that will live forever and 
- * do work off of the w_queue
+ * The destructor lets the workers finish the queued work and waits
+ * for them to exit
+ */
+ThreadPool::~ThreadPool() {
+
+  std::unique_lock<std::mutex> lck(this->mutex);
+  this->stop = true;
+  lck.unlock();
+
+  //wake up everyone so they can drain and exit
+  this->c_cv.notify_all();
+  this->p_cv.notify_all();
+  this->l_cv.notify_all();
+
+  lck.lock();
+  while(this->a_threads > 0) {
+
+    this->a_cv.wait(lck);
+
+  }
+
+}
+
+/**
+ * This method creates the threads that will live for the life of
+ * the pool and do work off of the w_queue
  */
 void ThreadPool::build_worker_threads() {
 
+  std::lock_guard<std::mutex> lck(this->mutex);
+
   for(uint32_t i=0; i < this->p_size; ++i) {
 
+    start_worker();
+
+  }
+
+}
+
+/**
+ * Starts one more worker thread.  Must be called holding the mutex
+ */
+void ThreadPool::start_worker() {
+
+  this->a_threads++;
+
+  if(this->mode == STEALING) {
+
+    //take the first deque nobody owns
+    uint32_t index = 0;
+    while(this->w_live[index]) {
+
+      index++;
+
+    }
+
+    this->w_live[index] = true;
+
+    std::thread w_thread (&ThreadPool::do_stealing_work, this, index);
+    Affinity::pin_thread(w_thread.native_handle(), this->cpus);
+    w_thread.detach();
+
+  } else if(this->backend == RING) {
+
+    std::thread w_thread (&ThreadPool::do_ring_work, this);
+    Affinity::pin_thread(w_thread.native_handle(), this->cpus);
+    w_thread.detach();
+
+  } else {
+
     std::thread w_thread (&ThreadPool::do_work, this);
+    Affinity::pin_thread(w_thread.native_handle(), this->cpus);
     w_thread.detach();
 
   }
@@ -31,66 +195,1206 @@ void ThreadPool::build_worker_threads() {
 }
 
 /**
- * Adds work to be done
+ * Spawns a worker if the pool is elastic, below max_size and hasn't
+ * spawned one in the last target_wait_micros
  */
-void ThreadPool::add_work(const std::function<void()> work) {
+void ThreadPool::maybe_grow(const uint64_t now) {
 
-  //lets grab a lock to make sure we can handle this
-  std::unique_lock<std::mutex> lck(this->mutex);
+  uint64_t last = this->last_spawn.load();
+  if(now < last + this->target_wait_micros || !this->last_spawn.compare_exchange_strong(last, now)) {
+
+    return;
+
+  }
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+
+  if(!this->stop && this->a_threads < this->max_size) {
+
+    start_worker();
+
+  }
+
+}
+
+/**
+ * Records that a worker took work queued at q_micros off of lane and grows
+ * the pool if it waited longer than target_wait_micros
+ */
+void ThreadPool::note_pop(const uint64_t q_micros, const Priority lane) {
+
+  uint64_t now = now_micros();
+  uint64_t waited = now > q_micros ? now - q_micros : 0;
 
-  while(this->w_queue.size() == this->p_size) {
+  this->l_taken[lane].fetch_add(1, std::memory_order_relaxed);
+  this->l_wait[lane].fetch_add(waited, std::memory_order_relaxed);
 
-    //the queue is full so we need to wait for room to open
-      
-    //while no producer signal has been sent wait here.  spin to pretect
-    //against spurious wakeups
-    this->p_cv.wait(lck);
+  if(!this->elastic) {
+
+    return;
+
+  }
+
+  this->last_pop.store(now);
+
+  if(waited > this->target_wait_micros) {
+
+    maybe_grow(now);
+
+  }
+
+}
+
+/**
+ * True if a worker that ran streak HIGH tasks in a row should look at the
+ * LOW lane first
+ */
+bool ThreadPool::low_turn(const uint32_t streak) {
+
+  return this->high_weight > 0 && streak >= this->high_weight && this->l_pending.load() > 0;
+
+}
+
+/**
+ * Pops the oldest LOW task.  Must be called holding the mutex
+ */
+bool ThreadPool::pop_low(QueuedTask &work) {
+
+  if(this->l_queue.empty()) {
+
+    return false;
 
   }
 
-  //add work to our work queue
-  this->w_queue.push(work);
+  work = std::move(this->l_queue.front());
+  this->l_queue.pop();
+  this->l_pending.fetch_sub(1);
+
+  return true;
+
+}
+
+/**
+ * Pops the oldest LOW task, skipping the mutex when the lane is empty
+ */
+bool ThreadPool::try_low(QueuedTask &work) {
+
+  if(this->l_pending.load() <= 0) {
 
-  //unlock
+    return false;
+
+  }
+
+  std::unique_lock<std::mutex> lck(this->mutex);
+  bool popped = pop_low(work);
   lck.unlock();
 
-  //notify the consumers that there is work to be done
-  this->c_cv.notify_one();
+  if(popped) {
+
+    //let a producer waiting on the LOW lane know there is room
+    this->l_cv.notify_one();
+
+  }
+
+  return popped;
 
 }
 
 /**
- * The main loop for the threads in the pool
+ * Runs a task taken off of lane and updates the worker's streak
  */
-void ThreadPool::do_work() {
+void ThreadPool::run_task(QueuedTask &work, const Priority lane, uint32_t &streak) {
 
-  while(1) {
+  streak = lane == HIGH ? streak + 1 : 0;
 
-    //lets grab a lock to synchronize the adding and removing of work
+  note_pop(work.q_micros, lane);
+  work.task();
+  work.task = Task();
+
+}
+
+/**
+ * Parks a worker holding lck until it is notified.  Returns false if the
+ * worker sat idle for idle_to_millis while the pool is above p_size and
+ * has to retire
+ */
+bool ThreadPool::park_worker(std::unique_lock<std::mutex> &lck, const uint32_t index) {
+
+  if(!this->elastic) {
+
+    this->c_cv.wait(lck);
+    return true;
+
+  }
+
+  if(this->c_cv.wait_for(lck, std::chrono::milliseconds(this->idle_to_millis)) == std::cv_status::no_timeout
+      || has_work() || this->a_threads <= this->p_size) {
+
+    return true;
+
+  }
+
+  //we have been idle for too long and the pool can do without us
+  this->a_threads--;
+  if(this->mode == STEALING) {
+
+    this->w_live[index] = false;
+
+  }
+  this->a_cv.notify_all();
+
+  return false;
+
+}
+
+/**
+ * True if there is queued work.  Must be called holding the mutex
+ */
+bool ThreadPool::has_work() {
+
+  if(this->l_pending.load() > 0) {
+
+    return true;
+
+  }
+
+  if(this->mode == SHARED && this->backend == LOCKING) {
+
+    return !this->w_queue.empty();
+
+  }
+
+  return this->pending.load() > 0;
+
+}
+
+/**
+ * Adds work to be done.  What happens when the lane is at capacity is up
+ * to the pool's policy.  Returns false if the work was rejected
+ */
+bool ThreadPool::add_work(std::function<void()> work, const Priority lane) {
+
+  return add_task(Task(std::move(work)), lane);
+
+}
+
+/**
+ * Adds a task to lane, applying the policy when it is full.  Returns false
+ * if the task was rejected
+ */
+bool ThreadPool::add_task(Task &&work, const Priority lane) {
+
+  if(try_add(work, lane)) {
+
+    return true;
+
+  }
+
+  //we are full, lets see what the policy wants
+  switch(this->policy) {
+
+    case REJECT:
+
+      this->rejected.fetch_add(1);
+      return false;
+
+    case CALLER_RUNS: {
+
+      //taken out of work so only rejected tasks are ever left behind
+      Task run = std::move(work);
+      this->caller_runs.fetch_add(1);
+      run();
+      return true;
+
+    }
+
+    case DROP_OLDEST: {
+
+      //one eviction makes room for one task.  if producers took it first we
+      //reject instead of racing them for ever
+      Task oldest;
+      if(take_oldest(oldest, lane)) {
+
+        this->dropped.fetch_add(1);
+        oldest = Task();
+
+        if(try_add(work, lane)) {
+
+          return true;
+
+        }
+
+      } else if(try_add(work, lane)) {
+
+        //the workers emptied the queue since we looked so there is room now
+        return true;
+
+      }
+
+      this->rejected.fetch_add(1);
+      return false;
+
+    }
+
+    default: {
+
+      //BLOCK or BLOCK_TIMEOUT
+      uint64_t start = now_micros();
+      bool added = false;
+
+      while(!added) {
+
+        added = try_add(work, lane);
+
+        if(!added && !wait_for_room(start, lane)) {
+
+          break;
+
+        }
+
+      }
+
+      this->blocked_micros.fetch_add(now_micros() - start);
+
+      if(!added) {
+
+        this->rejected.fetch_add(1);
+
+      }
+
+      return added;
+
+    }
+
+  }
+
+}
+
+/**
+ * Adds the task without blocking.  Only moves out of work when it succeeds
+ */
+bool ThreadPool::try_add(Task &work, const Priority lane) {
+
+  QueuedTask qt;
+  qt.q_micros = now_micros();
+
+  if(lane == LOW) {
+
+    if(!try_add_low(work, qt.q_micros)) {
+
+      return false;
+
+    }
+
+  } else if(this->mode == STEALING) {
+
+    if(!add_stealing_work(work, qt.q_micros)) {
+
+      return false;
+
+    }
+
+  } else if(this->backend == RING) {
+
+    qt.task = std::move(work);
+
+    if(!this->r_queue->try_push(std::move(qt))) {
+
+      //hand the task back to the caller
+      work = std::move(qt.task);
+      return false;
+
+    }
+
+    this->pending.fetch_add(1);
+    wake_worker();
+
+  } else {
+
+    //lets grab a lock to make sure we can handle this
     std::unique_lock<std::mutex> lck(this->mutex);
 
-    while(this->w_queue.empty()) {
+    if(this->w_queue.size() >= this->capacity) {
 
-      //the work queue is empty so we need to wait for more work to come
-      
-      //while no consumer signal has been sent lets wait here
-      this->c_cv.wait(lck);
+      return false;
 
     }
 
-    //dequeue the oldest work from our queue
-    std::function<void()> work = this->w_queue.front();
-    this->w_queue.pop();
+    //add work to our work queue
+    qt.task = std::move(work);
+    this->w_queue.push(std::move(qt));
 
     //unlock
     lck.unlock();
 
-    //send a signal to the producer letting it know there is room
-    this->p_cv.notify_one();
-
-    //do the work
-    work();
+    //notify the consumers that there is work to be done
+    this->c_cv.notify_one();
 
   }
 
+  note_push(qt.q_micros);
+
+  return true;
+
+}
+
+/**
+ * Adds up to n tasks with one lock acquisition and wakes as many workers
+ * as there are new tasks.  The tasks that don't fit go through add_task.
+ * Returns how many were added
+ */
+size_t ThreadPool::add_tasks(Task *tasks, const size_t n, const Priority lane) {
+
+  QueuedTask qt;
+  qt.q_micros = now_micros();
+  size_t queued = 0;
+
+  if(lane == LOW || (this->mode == SHARED && this->backend == LOCKING)) {
+
+    std::unique_lock<std::mutex> lck(this->mutex);
+
+    for(; queued < n && has_room(lane); ++queued) {
+
+      qt.task = std::move(tasks[queued]);
+
+      if(lane == LOW) {
+
+        this->l_queue.push(std::move(qt));
+        this->l_pending.fetch_add(1);
+
+      } else {
+
+        this->w_queue.push(std::move(qt));
+
+      }
+
+    }
+
+    lck.unlock();
+
+    //workers park under the mutex so only the ones already parked need a signal
+    notify_workers(queued);
+
+  } else if(this->mode == SHARED) {
+
+    for(; queued < n; ++queued) {
+
+      qt.task = std::move(tasks[queued]);
+
+      if(!this->r_queue->try_push(std::move(qt))) {
+
+        //the ring is full, hand the task back
+        tasks[queued] = std::move(qt.task);
+        break;
+
+      }
+
+    }
+
+    this->pending.fetch_add(queued);
+    wake_workers(queued);
+
+  } else {
+
+    //reserve room for the whole batch up front and give back what doesn't fit
+    int64_t before = this->pending.fetch_add(n);
+    queued = n;
+
+    if(this->capacity > 0 && before + (int64_t)n > (int64_t)this->capacity) {
+
+      queued = std::max((int64_t)this->capacity - before, (int64_t)0);
+      this->pending.fetch_sub(n - queued);
+
+    }
+
+    //the whole batch goes on one deque and the workers we wake steal from it.
+    //from outside the pool that is the shared one
+    WorkerQueue &wq = tl_pool == this ? *this->w_queues[tl_index] : this->inject;
+    wq.mutex.lock();
+    for(size_t i=0; i < queued; ++i) {
+
+      qt.task = std::move(tasks[i]);
+      wq.tasks.push_back(std::move(qt));
+
+    }
+    wq.mutex.unlock();
+
+    wake_workers(queued);
+
+  }
+
+  if(queued > 0) {
+
+    note_push(qt.q_micros);
+
+  }
+
+  //whatever didn't fit goes through the policy one at a time
+  size_t added = queued;
+  for(size_t i=queued; i < n; ++i) {
+
+    if(add_task(std::move(tasks[i]), lane)) {
+
+      added++;
+
+    }
+
+  }
+
+  return added;
+
+}
+
+/**
+ * Grows an elastic pool when work queued at q_micros finds every worker
+ * busy and none of them has taken work in a while
+ */
+void ThreadPool::note_push(const uint64_t q_micros) {
+
+  if(this->elastic && this->parked.load() == 0 && q_micros > this->last_pop.load() + this->target_wait_micros) {
+
+    maybe_grow(q_micros);
+
+  }
+
+}
+
+/**
+ * Adds the task to the LOW lane without blocking
+ */
+bool ThreadPool::try_add_low(Task &work, const uint64_t q_micros) {
+
+  std::unique_lock<std::mutex> lck(this->mutex);
+
+  if(!has_room(LOW)) {
+
+    return false;
+
+  }
+
+  QueuedTask qt;
+  qt.task = std::move(work);
+  qt.q_micros = q_micros;
+  this->l_queue.push(std::move(qt));
+  this->l_pending.fetch_add(1);
+
+  lck.unlock();
+
+  //workers park under the mutex so this can't be missed
+  this->c_cv.notify_one();
+
+  return true;
+
+}
+
+/**
+ * True if the lane has room.  Must be called holding the mutex
+ */
+bool ThreadPool::has_room(const Priority lane) {
+
+  if(lane == LOW) {
+
+    return this->capacity == 0 || this->l_queue.size() < this->capacity;
+
+  }
+
+  if(this->mode == SHARED && this->backend == LOCKING) {
+
+    return this->w_queue.size() < this->capacity;
+
+  }
+
+  return this->capacity == 0 || this->pending.load() < (int64_t)this->capacity;
+
+}
+
+/**
+ * Parks the producer until the lane has room.  Returns false if the
+ * BLOCK_TIMEOUT deadline counted from start passes first
+ */
+bool ThreadPool::wait_for_room(const uint64_t start, const Priority lane) {
+
+  //each lane has its own condition so a pop never wakes the wrong producer
+  std::condition_variable &cv = lane == LOW ? this->l_cv : this->p_cv;
+
+  std::unique_lock<std::mutex> lck(this->mutex);
+  this->p_parked.fetch_add(1);
+
+  bool room = true;
+
+  while(!has_room(lane) && !this->stop) {
+
+    if(this->policy != BLOCK_TIMEOUT) {
+
+      cv.wait(lck);
+      continue;
+
+    }
+
+    uint64_t waited = now_micros() - start;
+    uint64_t to_micros = this->block_to_millis * 1000;
+
+    if(waited >= to_micros) {
+
+      room = false;
+      break;
+
+    }
+
+    cv.wait_for(lck, std::chrono::microseconds(to_micros - waited));
+
+  }
+
+  this->p_parked.fetch_sub(1);
+
+  return room;
+
+}
+
+/**
+ * Takes the oldest queued task out of the lane.  Returns false if there
+ * was nothing to take
+ */
+bool ThreadPool::take_oldest(Task &work, const Priority lane) {
+
+  if(lane == LOW) {
+
+    QueuedTask qt;
+    std::lock_guard<std::mutex> lck(this->mutex);
+
+    if(!pop_low(qt)) {
+
+      return false;
+
+    }
+
+    work = std::move(qt.task);
+    return true;
+
+  }
+
+  if(this->mode == STEALING) {
+
+    //the fronts of the deques are the oldest work and outside work is older
+    //than what the workers spawned
+    uint32_t n_queues = this->w_queues.size();
+    for(uint32_t i=0; i <= n_queues; ++i) {
+
+      WorkerQueue &wq = i == 0 ? this->inject : *this->w_queues[i - 1];
+      std::lock_guard<std::mutex> lck(wq.mutex);
+
+      if(!wq.tasks.empty()) {
+
+        work = std::move(wq.tasks.front().task);
+        wq.tasks.pop_front();
+        this->pending.fetch_sub(1);
+        return true;
+
+      }
+
+    }
+
+    return false;
+
+  }
+
+  if(this->backend == RING) {
+
+    QueuedTask qt;
+    if(this->r_queue->try_pop(qt)) {
+
+      this->pending.fetch_sub(1);
+      work = std::move(qt.task);
+      return true;
+
+    }
+
+    return false;
+
+  }
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+
+  if(this->w_queue.empty()) {
+
+    return false;
+
+  }
+
+  work = std::move(this->w_queue.front().task);
+  this->w_queue.pop();
+  return true;
+
+}
+
+/**
+ * Returns the backpressure counters, the number of live threads and the
+ * depth and wait of every lane
+ */
+ThreadPool::Stats ThreadPool::get_stats() {
+
+  Stats stats;
+  stats.rejected = this->rejected.load();
+  stats.dropped = this->dropped.load();
+  stats.caller_runs = this->caller_runs.load();
+  stats.blocked_micros = this->blocked_micros.load();
+
+  this->mutex.lock();
+  stats.threads = this->a_threads;
+  stats.lanes[HIGH].depth = this->mode == SHARED && this->backend == LOCKING ? this->w_queue.size() :
+    std::max(this->pending.load(), (int64_t)0);
+  stats.lanes[LOW].depth = this->l_queue.size();
+  this->mutex.unlock();
+
+  for(uint32_t i=0; i < 2; ++i) {
+
+    stats.lanes[i].taken = this->l_taken[i].load();
+    stats.lanes[i].wait_micros = this->l_wait[i].load();
+
+  }
+
+  return stats;
+
+}
+
+/**
+ * The main loop for the threads in the pool
+ */
+void ThreadPool::do_work() {
+
+  uint32_t streak = 0;
+
+  while(1) {
+
+    //lets grab a lock to synchronize the adding and removing of work
+    std::unique_lock<std::mutex> lck(this->mutex);
+    this->parked.fetch_add(1);
+
+    while(!has_work() && !this->stop) {
+
+      //the work queue is empty so we need to wait for more work to come
+
+      //while no consumer signal has been sent lets wait here
+      if(!park_worker(lck, 0)) {
+
+        //idle for too long, retire
+        this->parked.fetch_sub(1);
+        return;
+
+      }
+
+    }
+
+    this->parked.fetch_sub(1);
+
+    if(!has_work()) {
+
+      //we are stopping and there is nothing left to do
+      lck.unlock();
+      exit_worker();
+      return;
+
+    }
+
+    QueuedTask work;
+    Priority lane = HIGH;
+
+    if(this->w_queue.empty() || low_turn(streak)) {
+
+      //nothing urgent or it is the LOW lane's turn
+      lane = LOW;
+      pop_low(work);
+
+    } else {
+
+      //dequeue the oldest work from our queue
+      work = std::move(this->w_queue.front());
+      this->w_queue.pop();
+
+    }
+
+    //unlock
+    lck.unlock();
+
+    //send a signal to the producer letting it know there is room
+    (lane == LOW ? this->l_cv : this->p_cv).notify_one();
+
+    //do the work
+    run_task(work, lane, streak);
+
+  }
+
+}
+
+/**
+ * Adds work to the deque of the calling worker or to the shared injection
+ * queue if called from outside the pool.  Returns false if the pool has a
+ * capacity and it is reached
+ */
+bool ThreadPool::add_stealing_work(Task &work, const uint64_t q_micros) {
+
+  //the work has to be counted before we look for parked workers or a worker
+  //about to park could miss it.  counting first also lets us hold to the capacity
+  int64_t queued = this->pending.fetch_add(1);
+
+  if(this->capacity > 0 && queued >= (int64_t)this->capacity) {
+
+    this->pending.fetch_sub(1);
+    return false;
+
+  }
+
+  //one of our own workers adding work keeps it local.  outside work goes to the
+  //shared queue so only live workers ever see it
+  WorkerQueue &wq = tl_pool == this ? *this->w_queues[tl_index] : this->inject;
+
+  QueuedTask qt;
+  qt.task = std::move(work);
+  qt.q_micros = q_micros;
+
+  wq.mutex.lock();
+  wq.tasks.push_back(std::move(qt));
+  wq.mutex.unlock();
+
+  wake_worker();
+
+  return true;
+
+}
+
+/**
+ * Wakes one producer parked waiting for room if there are any
+ */
+void ThreadPool::wake_producer() {
+
+  if(this->p_parked.load() > 0) {
+
+    this->mutex.lock();
+    this->mutex.unlock();
+    this->p_cv.notify_one();
+
+  }
+
+}
+
+/**
+ * Wakes one parked worker if there are any
+ */
+void ThreadPool::wake_worker() {
+
+  wake_workers(1);
+
+}
+
+/**
+ * Wakes up to n parked workers
+ */
+void ThreadPool::wake_workers(const size_t n) {
+
+  if(n > 0 && this->parked.load() > 0) {
+
+    //taking the lock makes sure the parked workers are actually waiting
+    this->mutex.lock();
+    this->mutex.unlock();
+    notify_workers(n);
+
+  }
+
+}
+
+/**
+ * Notifies up to n of the parked workers.  Must be called right after
+ * releasing the mutex the work was queued under
+ */
+void ThreadPool::notify_workers(const size_t n) {
+
+  uint32_t p = this->parked.load();
+
+  if(n == 0 || p == 0) {
+
+    return;
+
+  }
+
+  if(n >= p) {
+
+    this->c_cv.notify_all();
+    return;
+
+  }
+
+  for(size_t i=0; i < n; ++i) {
+
+    this->c_cv.notify_one();
+
+  }
+
+}
+
+/**
+ * The main loop for the threads with the RING backend
+ */
+void ThreadPool::do_ring_work() {
+
+  QueuedTask work;
+  uint32_t streak = 0;
+
+  while(1) {
+
+    if(low_turn(streak) && try_low(work)) {
+
+      run_task(work, LOW, streak);
+      continue;
+
+    }
+
+    if(this->r_queue->try_pop(work)) {
+
+      this->pending.fetch_sub(1);
+      wake_producer();
+
+      //do the work
+      run_task(work, HIGH, streak);
+      continue;
+
+    }
+
+    if(try_low(work)) {
+
+      run_task(work, LOW, streak);
+      continue;
+
+    }
+
+    //nothing to do so park until there is
+    std::unique_lock<std::mutex> lck(this->mutex);
+    this->parked.fetch_add(1);
+
+    while(!has_work() && !this->stop) {
+
+      if(!park_worker(lck, 0)) {
+
+        //idle for too long, retire
+        this->parked.fetch_sub(1);
+        return;
+
+      }
+
+    }
+
+    this->parked.fetch_sub(1);
+
+    if(this->stop && !has_work()) {
+
+      //we are stopping and there is nothing left to do
+      lck.unlock();
+      exit_worker();
+      return;
+
+    }
+
+  }
+
+}
+
+/**
+ * Pops the newest work off the worker's own deque, then the oldest outside
+ * work along with a share of the rest, then steals the oldest work of a random victim.  Returns false if
+ * nothing was found
+ */
+bool ThreadPool::find_work(const uint32_t index, std::minstd_rand &rand, QueuedTask &work) {
+
+  //first try our own deque.  we take from the back since what we pushed last
+  //is still hot in our cache
+  WorkerQueue &own = *this->w_queues[index];
+  own.mutex.lock();
+  if(!own.tasks.empty()) {
+
+    work = std::move(own.tasks.back());
+    own.tasks.pop_back();
+    own.mutex.unlock();
+    this->pending.fetch_sub(1);
+    wake_producer();
+    return true;
+
+  }
+  own.mutex.unlock();
+
+  //then work from outside the pool in the order it came, with a share of what
+  //is behind it so we don't come back to the shared lock for every task
+  if(take_inject(own, work)) {
+
+    return true;
+
+  }
+
+  //nothing local so lets go steal the oldest work of everyone else starting
+  //at a random victim
+  uint32_t n_queues = this->w_queues.size();
+  uint32_t start = rand() % n_queues;
+  for(uint32_t i=0; i < n_queues; ++i) {
+
+    uint32_t victim = (start + i) % n_queues;
+    if(victim == index) {
+
+      continue;
+
+    }
+
+    if(take_front(*this->w_queues[victim], work)) {
+
+      return true;
+
+    }
+
+  }
+
+  return false;
+
+}
+
+/**
+ * Takes the oldest outside work and moves up to half of what is left, at
+ * most BATCH_SIZE, onto own.  Returns false if there was none
+ */
+bool ThreadPool::take_inject(WorkerQueue &own, QueuedTask &work) {
+
+  QueuedTask batch[BATCH_SIZE];
+  size_t n = 0;
+
+  this->inject.mutex.lock();
+  if(this->inject.tasks.empty()) {
+
+    this->inject.mutex.unlock();
+    return false;
+
+  }
+
+  work = std::move(this->inject.tasks.front());
+  this->inject.tasks.pop_front();
+
+  size_t share = std::min(BATCH_SIZE, this->inject.tasks.size() / 2);
+  for(; n < share; ++n) {
+
+    batch[n] = std::move(this->inject.tasks.front());
+    this->inject.tasks.pop_front();
+
+  }
+  this->inject.mutex.unlock();
+
+  this->pending.fetch_sub(1);
+  wake_producer();
+
+  if(n > 0) {
+
+    //newest first so we still work the batch oldest first off of our back and
+    //thieves get what came in last
+    own.mutex.lock();
+    for(size_t i=n; i > 0; --i) {
+
+      own.tasks.push_back(std::move(batch[i - 1]));
+
+    }
+    own.mutex.unlock();
+
+  }
+
+  return true;
+
+}
+
+/**
+ * Takes the oldest work off of wq.  Returns false if it was empty
+ */
+bool ThreadPool::take_front(WorkerQueue &wq, QueuedTask &work) {
+
+  wq.mutex.lock();
+  if(wq.tasks.empty()) {
+
+    wq.mutex.unlock();
+    return false;
+
+  }
+
+  work = std::move(wq.tasks.front());
+  wq.tasks.pop_front();
+  wq.mutex.unlock();
+  this->pending.fetch_sub(1);
+  wake_producer();
+
+  return true;
+
+}
+
+/**
+ * The main loop for the threads in STEALING mode
+ */
+void ThreadPool::do_stealing_work(const uint32_t index) {
+
+  tl_pool = this;
+  tl_index = index;
+
+  std::minstd_rand rand(index + 1);
+  QueuedTask work;
+  uint32_t streak = 0;
+
+  while(1) {
+
+    if(low_turn(streak) && try_low(work)) {
+
+      run_task(work, LOW, streak);
+      continue;
+
+    }
+
+    if(find_work(index, rand, work)) {
+
+      //do the work
+      run_task(work, HIGH, streak);
+      continue;
+
+    }
+
+    if(try_low(work)) {
+
+      run_task(work, LOW, streak);
+      continue;
+
+    }
+
+    //nothing to do anywhere so park until there is
+    std::unique_lock<std::mutex> lck(this->mutex);
+    this->parked.fetch_add(1);
+
+    while(!has_work() && !this->stop) {
+
+      if(!park_worker(lck, index)) {
+
+        //idle for too long, retire
+        this->parked.fetch_sub(1);
+        return;
+
+      }
+
+    }
+
+    this->parked.fetch_sub(1);
+
+    if(this->stop && !has_work()) {
+
+      //we are stopping and there is nothing left to do
+      lck.unlock();
+      exit_worker();
+      return;
+
+    }
+
+  }
+
+}
+
+/**
+ * The shared state of one run_chunks call.  Helpers that get to run after
+ * every chunk is claimed only touch this, never the chunk function
+ */
+struct ChunkState {
+
+  std::atomic<size_t> next;
+  std::atomic<size_t> done;
+  size_t n_chunks;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::exception_ptr error;
+
+  /**
+   * Claims and runs chunks until there are none left
+   */
+  void work(const std::function<void(size_t)> &chunk) {
+
+    while(1) {
+
+      size_t c = this->next.fetch_add(1);
+      if(c >= this->n_chunks) {
+
+        return;
+
+      }
+
+      try {
+
+        chunk(c);
+
+      } catch(...) {
+
+        std::lock_guard<std::mutex> lck(this->mutex);
+        if(!this->error) {
+
+          this->error = std::current_exception();
+
+        }
+
+      }
+
+      if(this->done.fetch_add(1) + 1 == this->n_chunks) {
+
+        //last one out lets the caller know
+        std::lock_guard<std::mutex> lck(this->mutex);
+        this->cv.notify_all();
+
+      }
+
+    }
+
+  }
+
+};
+
+/**
+ * Runs chunk(0) to chunk(n_chunks - 1) on the calling thread and up to
+ * p_size workers and waits for all of them to finish
+ */
+void ThreadPool::run_chunks(const size_t n_chunks, const std::function<void(size_t)> &chunk) {
+
+  std::shared_ptr<ChunkState> state = std::make_shared<ChunkState>();
+  state->next = 0;
+  state->done = 0;
+  state->n_chunks = n_chunks;
+
+  //the caller takes chunks as well so we need one helper less
+  size_t helpers = std::min(n_chunks - 1, (size_t)this->p_size);
+  const std::function<void(size_t)> *c_ptr = &chunk;
+
+  for(size_t i=0; i < helpers; ++i) {
+
+    post([state, c_ptr]() { state->work(*c_ptr); });
+
+  }
+
+  state->work(chunk);
+
+  //wait for the chunks the helpers claimed
+  std::unique_lock<std::mutex> lck(state->mutex);
+  while(state->done.load() < n_chunks) {
+
+    state->cv.wait(lck);
+
+  }
+
+  if(state->error) {
+
+    std::rethrow_exception(state->error);
+
+  }
+
+}
+
+/**
+ * Marks a worker thread as exited
+ */
+void ThreadPool::exit_worker() {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+  this->a_threads--;
+  this->a_cv.notify_all();
+
 }
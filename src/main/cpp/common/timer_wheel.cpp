@@ -0,0 +1,322 @@
+#include "timer_wheel.hpp"
+
+using namespace asutils;
+
+log4cpp::Category& TimerWheel::logger = log4cpp::Category::getRoot();
+
+/**
+ * Monotonic millis the wheel is driven by
+ */
+static uint64_t now_millis() {
+
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+
+}
+
+/**
+ * The constructor takes the pool and lane expired timers run on and the
+ * tick length.  The driver waits on a timerfd unless use_timerfd is false,
+ * in which case it sleeps between ticks
+ */
+TimerWheel::TimerWheel(ThreadPool &pool, const ThreadPool::Priority lane, const uint64_t tick_millis,
+    const bool use_timerfd) : pool(pool), stop(false) {
+
+  this->lane = lane;
+  this->tick_millis = std::max(tick_millis, (uint64_t)1);
+  this->c_tick = 0;
+  this->next_id = 1;
+  this->start_millis = now_millis();
+  this->t_fd = -1;
+
+  for(uint32_t l=0; l < LEVELS; ++l) {
+
+    for(uint32_t s=0; s < SLOTS; ++s) {
+
+      this->wheels[l][s] = NULL;
+
+    }
+
+  }
+
+  if(use_timerfd) {
+
+    this->t_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    if(this->t_fd < 0) {
+
+      logger.error(std::string("Could not create a timerfd, sleeping between ticks instead: ") + std::to_string(errno));
+
+    } else {
+
+      //fire once a tick for as long as we live
+      struct itimerspec spec;
+      spec.it_interval.tv_sec = this->tick_millis / 1000;
+      spec.it_interval.tv_nsec = (this->tick_millis % 1000) * 1000000;
+      spec.it_value = spec.it_interval;
+      timerfd_settime(this->t_fd, 0, &spec, NULL);
+
+    }
+
+  }
+
+  this->d_thread = std::thread(&TimerWheel::run, this);
+
+}
+
+/**
+ * The destructor stops the driver.  Timers that haven't fired are dropped
+ */
+TimerWheel::~TimerWheel() {
+
+  //the driver notices within a tick
+  this->stop = true;
+  this->d_thread.join();
+
+  if(this->t_fd >= 0) {
+
+    close(this->t_fd);
+
+  }
+
+  for(auto &t : this->timers) {
+
+    delete t.second;
+
+  }
+
+}
+
+/**
+ * Returns the head of the slot a timer expiring at expire_tick goes in.
+ * Must be called holding the mutex
+ */
+TimerWheel::Timer **TimerWheel::slot_for(const uint64_t expire_tick) {
+
+  uint64_t delta = expire_tick - this->c_tick;
+
+  //the lowest level whose span still covers the delay
+  uint32_t level = 0;
+  while(level < LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * SLOT_BITS))) {
+
+    level++;
+
+  }
+
+  uint32_t index = (expire_tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+
+  return &this->wheels[level][index];
+
+}
+
+/**
+ * Links a timer into the slot for its expire tick.  Must be called
+ * holding the mutex
+ */
+void TimerWheel::link(Timer *timer) {
+
+  Timer **head = slot_for(timer->expire_tick);
+
+  timer->head = head;
+  timer->prev = NULL;
+  timer->next = *head;
+
+  if(*head != NULL) {
+
+    (*head)->prev = timer;
+
+  }
+
+  *head = timer;
+
+}
+
+/**
+ * Unlinks a timer from its slot.  Must be called holding the mutex
+ */
+void TimerWheel::unlink(Timer *timer) {
+
+  if(timer->prev != NULL) {
+
+    timer->prev->next = timer->next;
+
+  } else {
+
+    *timer->head = timer->next;
+
+  }
+
+  if(timer->next != NULL) {
+
+    timer->next->prev = timer->prev;
+
+  }
+
+}
+
+/**
+ * Moves every timer in the current slot of level down to where it belongs
+ * now.  Returns the index of the slot.  Must be called holding the mutex
+ */
+uint32_t TimerWheel::cascade(const uint32_t level) {
+
+  uint32_t index = (this->c_tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+
+  Timer *timer = this->wheels[level][index];
+  this->wheels[level][index] = NULL;
+
+  while(timer != NULL) {
+
+    Timer *next = timer->next;
+    link(timer);
+    timer = next;
+
+  }
+
+  return index;
+
+}
+
+/**
+ * Processes one tick, moving the tasks of the expired timers into expired.
+ * Must be called holding the mutex
+ */
+void TimerWheel::tick(std::vector<Task> &expired) {
+
+  uint32_t index = this->c_tick & (SLOTS - 1);
+
+  //every time the lowest wheel comes round the next one moves a slot down
+  if(index == 0) {
+
+    for(uint32_t l=1; l < LEVELS && cascade(l) == 0; ++l);
+
+  }
+
+  Timer *timer = this->wheels[0][index];
+  this->wheels[0][index] = NULL;
+
+  while(timer != NULL) {
+
+    Timer *next = timer->next;
+
+    this->timers.erase(timer->id);
+    expired.push_back(std::move(timer->task));
+    delete timer;
+
+    timer = next;
+
+  }
+
+  this->c_tick++;
+
+}
+
+/**
+ * The driver loop
+ */
+void TimerWheel::run() {
+
+  std::vector<Task> expired;
+
+  while(!this->stop) {
+
+    if(this->t_fd >= 0) {
+
+      uint64_t n;
+      if(::read(this->t_fd, &n, sizeof(n)) < 0 && errno != EINTR) {
+
+        logger.error(std::string("Could not read the timerfd: ") + std::to_string(errno));
+
+      }
+
+    } else {
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(this->tick_millis));
+
+    }
+
+    //catch up on every tick that passed, we may have been late
+    uint64_t r_tick = (now_millis() - this->start_millis) / this->tick_millis;
+
+    this->mutex.lock();
+    while(this->c_tick <= r_tick) {
+
+      tick(expired);
+
+    }
+    this->mutex.unlock();
+
+    if(!expired.empty()) {
+
+      this->pool.add_work_batch(expired.begin(), expired.end(), this->lane);
+      expired.clear();
+
+    }
+
+  }
+
+}
+
+/**
+ * Schedules a task to run after delay_millis and returns its id
+ */
+uint64_t TimerWheel::schedule_task(const uint64_t delay_millis, Task &&task) {
+
+  //round up and count from the tick we are in so we never fire early
+  uint64_t ticks = (delay_millis + this->tick_millis - 1) / this->tick_millis;
+  uint64_t r_tick = (now_millis() - this->start_millis) / this->tick_millis;
+
+  //past the last wheel we park it at the far end and it cascades from there
+  ticks = std::min(ticks + 1, ((uint64_t)1 << (LEVELS * SLOT_BITS)) - SLOTS);
+
+  Timer *timer = new Timer();
+  timer->task = std::move(task);
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+
+  timer->id = this->next_id++;
+  timer->expire_tick = std::max(r_tick + ticks, this->c_tick);
+
+  link(timer);
+  this->timers[timer->id] = timer;
+
+  return timer->id;
+
+}
+
+/**
+ * Cancels a timer.  Returns false if it already fired or was cancelled
+ */
+bool TimerWheel::cancel(const uint64_t id) {
+
+  Timer *timer = NULL;
+
+  this->mutex.lock();
+
+  std::unordered_map<uint64_t, Timer*>::iterator t_got = this->timers.find(id);
+  if(t_got != this->timers.end()) {
+
+    timer = t_got->second;
+    unlink(timer);
+    this->timers.erase(t_got);
+
+  }
+
+  this->mutex.unlock();
+
+  //the task is destroyed outside of the lock in case it owns something heavy
+  delete timer;
+
+  return timer != NULL;
+
+}
+
+/**
+ * Returns the number of pending timers
+ */
+size_t TimerWheel::size() {
+
+  std::lock_guard<std::mutex> lck(this->mutex);
+  return this->timers.size();
+
+}
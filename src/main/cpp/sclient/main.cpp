@@ -75,17 +75,13 @@ void call_block(SocketClient &client, int32_t tc) {
   //ThreadPool p_tp(std::thread::hardware_concurrency());
   ThreadPool p_tp(8); //if we use more threads then we block less.  leaving this as example
 
-  int32_t ip_calls = tc;
-
-  std::mutex ipc_mutex;
-  std::unique_lock<std::mutex> lck(ipc_mutex, std::defer_lock);
-  std::condition_variable cv;
- 
   uint64_t start = Utils::epoch_micros_now();
 
-  for(int32_t i=0; i < tc; i++) {
+  //every chunk sends its calls one after the other and parallel_for returns once
+  //all chunks are done
+  p_tp.parallel_for(0, tc, 100, [&logger, &client](size_t lo, size_t hi) {
 
-    std::function<void()> work = [&logger, i, &client, &ip_calls, &ipc_mutex, &cv]() {
+    for(size_t i=lo; i < hi; i++) {
 
       std::string hash_key = std::to_string(i);
       std::string msg = "blah blah";
@@ -104,25 +100,9 @@ void call_block(SocketClient &client, int32_t tc) {
 
       }
 
-      //decrement counter
-      ipc_mutex.lock();
-      ip_calls--;
-      ipc_mutex.unlock();
-      cv.notify_one();
-      
-    };
-
-    p_tp.add_work(work);
+    }
     
-  }
-  
-  ipc_mutex.lock();
-  while(ip_calls > 0) {
-
-    cv.wait(lck);
-
-  }
-  ipc_mutex.unlock();
+  });
 
   uint64_t time = Utils::epoch_micros_now() - start;
 
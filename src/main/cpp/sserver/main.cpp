@@ -17,32 +17,40 @@ int main(int argc, char **argv) {
   configure_log4cpp();
   log4cpp::Category& logger = log4cpp::Category::getRoot();
 
-  if(argc < 2 || argc > 2) {
+  if(argc < 2 || argc > 3) {
 
-    logger.error("Usage: server <port>");
+    logger.error("Usage: server <port> [numa node]");
     exit(1);
   }
 
   uint32_t port = std::stoi(argv[1]);
 
+  //pin everything to one numa node if asked to
+  std::vector<uint32_t> cpus;
+  if(argc == 3) {
+
+    cpus = Affinity::node_cpus(std::stoi(argv[2]));
+
+  }
+
   logger.info("Starting socket server");
 
-  std::function<void(std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
-            SocketServer &server, const uint32_t sfd)> handler = [&logger](std::vector<char> &&uuid_v, std::vector<char> &&msg_v, 
-            SocketServer &server, const uint32_t sfd) {
+  //the handler gets views into the read buffer so nothing is copied until we log
+  std::function<void(const char *uuid, const char *msg, size_t msg_size,
+            SocketServer &server, const int32_t sfd)> handler = [&logger](const char *uuid, const char *msg, size_t msg_size,
+            SocketServer &server, const int32_t sfd) {
 
-    std::string msg_s(msg_v.begin(), msg_v.end());
+    std::string msg_s(msg, msg_size);
 
     logger.info(std::string("Got : ") + msg_s);
 
     std::string d = "no way bro";
-    std::vector<char> n_msg(d.begin(), d.end());
 
-    server.send_msg(uuid_v, n_msg, sfd);
+    server.send_msg(uuid, d.c_str(), d.size(), sfd);
 
   };
 
-  SocketServer *server = new SocketServer(port, handler);
+  SocketServer *server = new SocketServer(port, handler, cpus);
   delete server;
 
 }
@@ -0,0 +1,40 @@
+#include "gtest/gtest.h"
+#include "affinity.hpp"
+#include "thread_pool.hpp"
+
+using namespace asutils;
+
+TEST(Affinity, TestParseCpuList) {
+
+  std::vector<uint32_t> cpus = Affinity::parse_cpu_list("0-3,8,10-11\n");
+
+  std::vector<uint32_t> expected = {0, 1, 2, 3, 8, 10, 11};
+  ASSERT_EQ(expected, cpus);
+  ASSERT_TRUE(Affinity::parse_cpu_list("").empty());
+
+  //reversed and out of range ranges are skipped instead of looping for ever
+  std::vector<uint32_t> sane = {2};
+  ASSERT_EQ(sane, Affinity::parse_cpu_list("3-1,2,0-4294967295,5000000000"));
+
+}
+
+TEST(Affinity, TestPinnedPool) {
+
+  ThreadPool::Config config(2);
+  config.cpus = {0};
+  ThreadPool tp(config);
+
+  //every worker only sees cpu 0
+  std::future<int32_t> r = tp.submit([]() {
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+
+    return CPU_ISSET(0, &set) ? CPU_COUNT(&set) : -1;
+
+  });
+
+  ASSERT_EQ(1, r.get());
+
+}
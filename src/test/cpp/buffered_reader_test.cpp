@@ -2,6 +2,9 @@
 #include "buffered_reader.hpp"
 #include <stdlib.h>
 #include <functional>
+#include <atomic>
+#include <string.h>
+#include <algorithm>
 
 using namespace asutils;
 
@@ -49,3 +52,530 @@ TEST(BufferedReader, TestBufferedReaderLoop) {
   }
 
 }
+
+TEST(BufferedReader, TestBufferedReaderSplit) {
+
+  std::vector<std::string> lines;
+  std::function<void(std::vector<char>)> call_back = [&lines](std::vector<char> bytes) { 
+    
+    lines.emplace_back(bytes.begin(), bytes.end());
+
+  };
+
+  //frames spanning reads, several frames in one read and empty frames
+  std::string data = "ab\ncdefgh\n\nijkl\nm";
+  
+  for(size_t step : {1, 3, 7, 100}) {
+
+    lines.clear();
+    BufferedReader br('\n', call_back);
+
+    for(size_t i=0; i < data.size(); i += step) {
+
+      br.read(data.c_str() + i, std::min(step, data.size() - i));
+
+    }
+
+    ASSERT_EQ((size_t)4, lines.size());
+    ASSERT_EQ(0, lines[0].compare("ab"));
+    ASSERT_EQ(0, lines[1].compare("cdefgh"));
+    ASSERT_EQ(0, lines[2].compare(""));
+    ASSERT_EQ(0, lines[3].compare("ijkl"));
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderView) {
+
+  std::vector<std::string> lines;
+  std::vector<const char*> at;
+  std::function<void(const char*, size_t)> call_back = [&lines, &at](const char *frame, size_t size) { 
+    
+    lines.emplace_back(frame, size);
+    at.push_back(frame);
+
+  };
+
+  const char *data1 = "abc\nde";
+  const char *data2 = "f\n";
+  
+  BufferedReader br('\n', call_back);
+  br.read(data1, 6);
+  br.read(data2, 2);
+
+  ASSERT_EQ((size_t)2, lines.size());
+  ASSERT_EQ(0, lines[0].compare("abc"));
+  ASSERT_EQ(0, lines[1].compare("def"));
+
+  //a frame inside one read is viewed in place, a split one comes from the buffer
+  ASSERT_EQ(data1, at[0]);
+  ASSERT_NE(data2, at[1]);
+
+}
+
+TEST(BufferedReader, TestBufferedReaderPrefixed) {
+
+  std::vector<std::string> frames;
+  std::function<void(const char*, size_t)> call_back = [&frames](const char *frame, size_t size) { 
+    
+    frames.emplace_back(frame, size);
+
+  };
+
+  //binary payloads with the del in them and an empty frame
+  std::vector<std::string> sent = {std::string("a\4b\nc", 5), "", std::string(300, '\4'), "xyz"};
+  std::string data;
+
+  for(std::string &f : sent) {
+
+    char prefix[BufferedReader::PREFIX_SIZE];
+    BufferedReader::write_prefix(f.size(), prefix);
+    data.append(prefix, BufferedReader::PREFIX_SIZE);
+    data.append(f);
+
+  }
+
+  for(size_t step : {1, 2, 5, 64, 1000}) {
+
+    frames.clear();
+    BufferedReader br(BufferedReader::LENGTH_PREFIXED, '\4', call_back);
+
+    for(size_t i=0; i < data.size(); i += step) {
+
+      br.read(data.c_str() + i, std::min(step, data.size() - i));
+
+    }
+
+    ASSERT_EQ(sent.size(), frames.size());
+    for(size_t i=0; i < sent.size(); i++) {
+
+      ASSERT_EQ(0, sent[i].compare(frames[i]));
+
+    }
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderLimits) {
+
+  std::atomic<int64_t> gauge(0);
+  uint32_t frames = 0;
+  uint32_t overflows = 0;
+
+  std::function<void(const char*, size_t)> call_back = [&frames](const char *frame, size_t size) { frames++; };
+
+  {
+
+    BufferedReader br('\n', call_back);
+    br.set_limits(8, 16, [&overflows]() { overflows++; }, &gauge);
+
+    //partial frames count on the gauge until they are done
+    ASSERT_TRUE(br.read("abc", 3));
+    ASSERT_EQ(3, gauge.load());
+    ASSERT_TRUE(br.read("de\n", 3));
+    ASSERT_EQ(0, gauge.load());
+    ASSERT_EQ((uint32_t)1, frames);
+
+    //a peer that never sends the del gets cut off at the limit
+    ASSERT_TRUE(br.read("12345", 5));
+    ASSERT_FALSE(br.read("6789", 4));
+    ASSERT_EQ((uint32_t)1, overflows);
+    ASSERT_EQ(0, gauge.load());
+
+    //and stays cut off
+    ASSERT_FALSE(br.read("a\n", 2));
+    ASSERT_EQ((uint32_t)1, frames);
+
+  }
+
+  {
+
+    BufferedReader br(BufferedReader::LENGTH_PREFIXED, '\4', call_back);
+    br.set_limits(8, 16, [&overflows]() { overflows++; }, &gauge);
+
+    //a prefix over the limit is refused before anything is buffered
+    char prefix[BufferedReader::PREFIX_SIZE];
+    BufferedReader::write_prefix(1 << 30, prefix);
+    ASSERT_FALSE(br.read(prefix, BufferedReader::PREFIX_SIZE));
+    ASSERT_EQ((uint32_t)2, overflows);
+
+  }
+
+  {
+
+    //moving a reader moves what it holds on the gauge
+    BufferedReader br('\n', call_back);
+    br.set_limits(0, 0, NULL, &gauge);
+    ASSERT_TRUE(br.read("abc", 3));
+
+    BufferedReader moved(std::move(br));
+    ASSERT_EQ(3, gauge.load());
+
+  }
+
+  ASSERT_EQ(0, gauge.load());
+
+}
+
+/**
+ * Feeds data to a reader the way a socket does, step bytes at a time straight
+ * into the space it prepares
+ */
+static void feed(BufferedReader &br, const std::string &data, size_t step) {
+
+  for(size_t i=0; i < data.size(); i += step) {
+
+    size_t space;
+    char *dst = br.prepare(space);
+    size_t n = std::min(std::min(step, space), data.size() - i);
+    memcpy(dst, data.c_str() + i, n);
+    ASSERT_TRUE(br.commit(n));
+    step = n;
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderPrepareCommit) {
+
+  std::vector<std::string> frames;
+  std::function<void(const char*, size_t)> call_back = [&frames](const char *frame, size_t size) { 
+    
+    frames.emplace_back(frame, size);
+
+  };
+
+  std::string big(20000, 'x');
+  std::string data = "ab\ncdefgh\n\n" + big + "\nijkl\n";
+
+  for(size_t step : {1, 3, 7, 4096, 100000}) {
+
+    frames.clear();
+    BufferedReader br('\n', call_back);
+    feed(br, data, step);
+
+    ASSERT_EQ((size_t)5, frames.size());
+    ASSERT_EQ(0, frames[0].compare("ab"));
+    ASSERT_EQ(0, frames[1].compare("cdefgh"));
+    ASSERT_EQ(0, frames[2].compare(""));
+    ASSERT_EQ(0, frames[3].compare(big));
+    ASSERT_EQ(0, frames[4].compare("ijkl"));
+
+  }
+
+  std::string prefixed;
+  for(std::string f : {std::string("a\nb"), std::string(), big}) {
+
+    char prefix[BufferedReader::PREFIX_SIZE];
+    BufferedReader::write_prefix(f.size(), prefix);
+    prefixed.append(prefix, BufferedReader::PREFIX_SIZE);
+    prefixed.append(f);
+
+  }
+
+  for(size_t step : {1, 5, 4096, 100000}) {
+
+    frames.clear();
+    BufferedReader br(BufferedReader::LENGTH_PREFIXED, '\4', call_back);
+    feed(br, prefixed, step);
+
+    ASSERT_EQ((size_t)3, frames.size());
+    ASSERT_EQ(0, frames[0].compare("a\nb"));
+    ASSERT_EQ(0, frames[1].compare(""));
+    ASSERT_EQ(0, frames[2].compare(big));
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderAdaptive) {
+
+  const char *at = NULL;
+  std::function<void(const char*, size_t)> call_back = [&at](const char *frame, size_t size) { at = frame; };
+
+  BufferedReader br('\n', call_back);
+
+  size_t space;
+  char *dst = br.prepare(space);
+  ASSERT_LE(BufferedReader::MIN_READ, space);
+
+  //a frame is delivered right where the socket put it
+  memcpy(dst, "abc\n", 4);
+  ASSERT_TRUE(br.commit(4));
+  ASSERT_EQ(dst, at);
+
+  //reads that fill everything we offer ask for more next time
+  size_t last = 0;
+  for(uint32_t i=0; i < 4; i++) {
+
+    dst = br.prepare(space);
+    ASSERT_LT(last, space);
+    last = space;
+    memset(dst, 'a', space);
+    ASSERT_TRUE(br.commit(space));
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderBudget) {
+
+  const size_t budget = 64 << 10;
+  const size_t max_frame = 1 << 20;
+  const size_t f_size = max_frame - 1;
+
+  size_t got = 0;
+  std::function<void(const char*, size_t)> call_back = [&got](const char *frame, size_t size) { got = size; };
+
+  //a frame we can't see the end of never takes more than the biggest frame
+  //and a budget of reads
+  BufferedReader br('\n', call_back);
+  br.set_limits(max_frame, budget, NULL);
+
+  size_t space;
+  size_t total = 0;
+  while(total < f_size) {
+
+    char *dst = br.prepare(space);
+    space = std::min(space, f_size - total);
+    memset(dst, 'a', space);
+    ASSERT_TRUE(br.commit(space));
+    total += space;
+    ASSERT_LE(br.capacity(), max_frame + budget);
+
+  }
+
+  char *dst = br.prepare(space);
+  dst[0] = '\n';
+  ASSERT_TRUE(br.commit(1));
+  ASSERT_EQ(f_size, got);
+
+  //and gives it all back once the frame is done
+  ASSERT_LE(br.capacity(), budget);
+
+  //a LENGTH_PREFIXED frame gets exactly its own size
+  BufferedReader lp(BufferedReader::LENGTH_PREFIXED, '\4', call_back);
+  lp.set_limits(max_frame, budget, NULL);
+
+  got = 0;
+  dst = lp.prepare(space);
+  BufferedReader::write_prefix(f_size, dst);
+  ASSERT_TRUE(lp.commit(BufferedReader::PREFIX_SIZE));
+
+  total = 0;
+  while(total < f_size) {
+
+    dst = lp.prepare(space);
+    ASSERT_LE(space, f_size - total);
+    memset(dst, 'a', space);
+    ASSERT_TRUE(lp.commit(space));
+    total += space;
+    ASSERT_LE(lp.capacity(), BufferedReader::PREFIX_SIZE + f_size);
+
+  }
+
+  ASSERT_EQ(f_size, got);
+  ASSERT_LE(lp.capacity(), budget);
+
+}
+
+TEST(BufferedReader, TestBufferedReaderBatch) {
+
+  std::vector<size_t> calls;
+  std::vector<std::string> frames;
+  std::function<void(const BufferedReader::Frame*, size_t)> call_back = [&calls, &frames](const BufferedReader::Frame *batch,
+      size_t n) { 
+    
+    calls.push_back(n);
+    for(size_t i=0; i < n; i++) {
+
+      frames.emplace_back(batch[i].data, batch[i].size);
+
+    }
+
+  };
+
+  {
+
+    //pipelined frames from one socket read come in one call
+    BufferedReader br(BufferedReader::DELIMITED, '\n', call_back);
+    std::string data = "a\nbb\nccc\ndd";
+
+    size_t space;
+    char *dst = br.prepare(space);
+    memcpy(dst, data.c_str(), data.size());
+    ASSERT_TRUE(br.commit(data.size()));
+
+    ASSERT_EQ((size_t)1, calls.size());
+    ASSERT_EQ((size_t)3, calls[0]);
+
+    //the partial one finishes with the next read
+    dst = br.prepare(space);
+    memcpy(dst, "d\n", 2);
+    ASSERT_TRUE(br.commit(2));
+
+    ASSERT_EQ((size_t)2, calls.size());
+    ASSERT_EQ(0, frames[3].compare("ddd"));
+
+  }
+
+  calls.clear();
+  frames.clear();
+
+  {
+
+    //a frame finished out of the reader's own buffer goes first since the
+    //buffer gets reused, the rest of the read comes together
+    BufferedReader br(BufferedReader::LENGTH_PREFIXED, '\4', call_back);
+    std::string data;
+    for(std::string f : {"one", "two", "three"}) {
+
+      char prefix[BufferedReader::PREFIX_SIZE];
+      BufferedReader::write_prefix(f.size(), prefix);
+      data.append(prefix, BufferedReader::PREFIX_SIZE);
+      data.append(f);
+
+    }
+
+    ASSERT_TRUE(br.read(data.c_str(), 5));
+    ASSERT_TRUE(br.read(data.c_str() + 5, data.size() - 5));
+
+    ASSERT_EQ((size_t)2, calls.size());
+    ASSERT_EQ((size_t)1, calls[0]);
+    ASSERT_EQ((size_t)2, calls[1]);
+    ASSERT_EQ(0, frames[0].compare("one"));
+    ASSERT_EQ(0, frames[1].compare("two"));
+    ASSERT_EQ(0, frames[2].compare("three"));
+
+  }
+
+}
+
+TEST(BufferedReader, TestBufferedReaderStream) {
+
+  std::vector<std::string> headers;
+  std::vector<std::string> frames;
+  std::string current;
+  size_t biggest = 0;
+
+  std::function<void(const BufferedReader::Event, const char*, size_t)> call_back = [&](
+      const BufferedReader::Event event, const char *data, size_t size) {
+
+    if(event == BufferedReader::BEGIN) {
+
+      headers.push_back(std::string(data, size));
+      current.assign(data, size);
+
+    } else if(event == BufferedReader::CHUNK) {
+
+      current.append(data, size);
+      biggest = std::max(biggest, size);
+
+    } else {
+
+      frames.push_back(current);
+
+    }
+
+  };
+
+  std::string big(100000, 'x');
+  std::vector<std::string> expected = {"headerbody", "hea", "", big};
+
+  std::string delimited;
+  std::string prefixed;
+  for(const std::string &f : expected) {
+
+    delimited.append(f);
+    delimited.push_back('\n');
+
+    char prefix[BufferedReader::PREFIX_SIZE];
+    BufferedReader::write_prefix(f.size(), prefix);
+    prefixed.append(prefix, BufferedReader::PREFIX_SIZE);
+    prefixed.append(f);
+
+  }
+
+  for(BufferedReader::Framing framing : {BufferedReader::DELIMITED, BufferedReader::LENGTH_PREFIXED}) {
+
+    const std::string &data = framing == BufferedReader::DELIMITED ? delimited : prefixed;
+
+    for(size_t step : {(size_t)1, (size_t)2, (size_t)7, (size_t)4096, data.size()}) {
+
+      headers.clear();
+      frames.clear();
+      biggest = 0;
+
+      BufferedReader br(framing, '\n', 6, call_back);
+      for(size_t i=0; i < data.size(); i += step) {
+
+        ASSERT_TRUE(br.read(data.c_str() + i, std::min(step, data.size() - i)));
+
+      }
+
+      ASSERT_EQ(expected.size(), frames.size());
+      for(size_t i=0; i < expected.size(); i++) {
+
+        ASSERT_EQ(0, frames[i].compare(expected[i]));
+
+      }
+
+      //the header comes whole, or the whole frame when it is shorter
+      ASSERT_EQ(0, headers[0].compare("header"));
+      ASSERT_EQ(0, headers[1].compare("hea"));
+      ASSERT_EQ(0, headers[2].compare(""));
+      ASSERT_EQ(0, headers[3].compare("xxxxxx"));
+
+      //chunks are views of the reads, never the frame put back together
+      ASSERT_TRUE(biggest <= step);
+
+    }
+
+  }
+
+  {
+
+    //the frame limit still holds, even though the frame is never buffered
+    headers.clear();
+    frames.clear();
+    uint32_t overflows = 0;
+    std::atomic<int64_t> gauge(0);
+
+    BufferedReader br(BufferedReader::DELIMITED, '\n', 6, call_back);
+    br.set_limits(16, 0, [&overflows]() { overflows++; }, &gauge);
+
+    ASSERT_TRUE(br.read("header", 6));
+    ASSERT_EQ((size_t)1, headers.size());
+    ASSERT_EQ(0, gauge.load());
+    ASSERT_TRUE(br.read("0123456789", 10));
+    ASSERT_FALSE(br.read("a", 1));
+    ASSERT_EQ((uint32_t)1, overflows);
+    ASSERT_EQ((size_t)0, frames.size());
+
+  }
+
+  {
+
+    //and streaming works off of the owned buffer too
+    frames.clear();
+    BufferedReader br(BufferedReader::LENGTH_PREFIXED, '\4', 6, call_back);
+
+    for(size_t i=0; i < prefixed.size();) {
+
+      size_t space;
+      char *dst = br.prepare(space);
+      size_t n = std::min(space, prefixed.size() - i);
+      memcpy(dst, prefixed.c_str() + i, n);
+      ASSERT_TRUE(br.commit(n));
+      i += n;
+
+    }
+
+    ASSERT_EQ(expected.size(), frames.size());
+    ASSERT_EQ(0, frames[3].compare(big));
+
+  }
+
+}
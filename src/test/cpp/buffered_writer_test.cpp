@@ -1,5 +1,9 @@
 #include "gtest/gtest.h"
 #include "buffered_writer.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
 
 using namespace asutils;
 
@@ -18,7 +22,7 @@ TEST(BufferedWriter, TestBufferedWriter) {
   w.iread(buffer, 3);
   
   std::string e(data1);
-  std::string r(buffer);
+  std::string r(buffer, 3);
 
   ASSERT_EQ(0, e.compare(r));
   w.clear(3);
@@ -29,8 +33,151 @@ TEST(BufferedWriter, TestBufferedWriter) {
   w.iread(buffer2, 6);
 
   std::string e2 = std::string(data2) + std::string(data3);
-  std::string r2(buffer2);
+  std::string r2(buffer2, 6);
 
   ASSERT_EQ(0, e2.compare(r2));
 
 }
+
+TEST(BufferedWriter, TestBufferedWriterChunks) {
+
+  BufferedWriter w;
+
+  //enough to span a few chunks, with a pattern so every byte is checked
+  std::string data;
+  for(size_t i=0; i < BufferedWriter::CHUNK_SIZE * 3 + 100; i++) {
+
+    data.push_back((char)('a' + i % 26));
+
+  }
+
+  w.write(data.c_str(), 10);
+  w.write(data.c_str() + 10, data.size() - 10);
+  ASSERT_EQ(data.size(), w.size());
+
+  //drain it the way a socket would, in uneven pieces
+  size_t done = 0;
+  size_t step = 1000;
+  std::vector<char> buffer(BufferedWriter::CHUNK_SIZE * 2);
+  while(w.size() > 0) {
+
+    size_t n = std::min(step, w.size());
+    w.iread(&buffer[0], n);
+    ASSERT_EQ(0, data.compare(done, n, &buffer[0], n));
+
+    w.clear(n);
+    done += n;
+    step = step * 3 % (BufferedWriter::CHUNK_SIZE * 2) + 1;
+
+  }
+
+  ASSERT_EQ(data.size(), done);
+
+  //and it keeps working once the chunks are recycled
+  w.write("xyz", 3);
+  char small[3];
+  w.iread(small, 3);
+  ASSERT_EQ(0, std::string(small, 3).compare("xyz"));
+  w.clear(3);
+  ASSERT_EQ((size_t)0, w.size());
+
+}
+
+TEST(BufferedWriter, TestBufferedWriterPeek) {
+
+  BufferedWriter w;
+
+  std::string data(BufferedWriter::CHUNK_SIZE * 2 + 10, 'x');
+  data[0] = 'a';
+  data[BufferedWriter::CHUNK_SIZE] = 'b';
+  w.write(data.c_str(), data.size());
+  w.clear(1);
+
+  //one iovec per chunk, starting past what was cleared
+  struct iovec iov[8];
+  ASSERT_EQ((size_t)3, w.peek(iov, 8));
+  ASSERT_EQ(BufferedWriter::CHUNK_SIZE - 1, iov[0].iov_len);
+  ASSERT_EQ('b', *(char*)iov[1].iov_base);
+  ASSERT_EQ((size_t)10, iov[2].iov_len);
+
+  //and no more than asked for
+  ASSERT_EQ((size_t)2, w.peek(iov, 2));
+
+  w.clear(w.size());
+  ASSERT_EQ((size_t)0, w.peek(iov, 8));
+
+}
+
+TEST(BufferedWriter, TestBufferedWriterOwned) {
+
+  BufferedWriter w;
+
+  std::vector<char> payload(BufferedWriter::MIN_SEGMENT * 4, 'p');
+  const char *p_data = payload.data();
+  std::string tail(BufferedWriter::MIN_SEGMENT, 't');
+  std::shared_ptr<std::vector<char>> shared = std::make_shared<std::vector<char>>(BufferedWriter::MIN_SEGMENT, 's');
+  std::weak_ptr<std::vector<char>> watch = shared;
+
+  //small pieces around handed over buffers go in our own chunks
+  w.write("head", 4);
+  w.write(std::move(payload));
+  w.write("|", 1);
+  w.write(std::move(tail));
+  w.write(shared->data(), shared->size(), shared);
+  w.write(std::string("tiny"));
+  shared.reset();
+
+  size_t expected = 4 + BufferedWriter::MIN_SEGMENT * 6 + 1 + 4;
+  ASSERT_EQ(expected, w.size());
+
+  //the vector went in as is, nothing was copied
+  struct iovec iov[8];
+  ASSERT_EQ((size_t)6, w.peek(iov, 8));
+  ASSERT_EQ(p_data, iov[1].iov_base);
+  ASSERT_EQ((size_t)4, iov[5].iov_len);
+
+  std::vector<char> all(expected);
+  w.iread(&all[0], expected);
+  std::string got(all.begin(), all.end());
+  std::string want = "head" + std::string(BufferedWriter::MIN_SEGMENT * 4, 'p') + "|" +
+    std::string(BufferedWriter::MIN_SEGMENT, 't') + std::string(BufferedWriter::MIN_SEGMENT, 's') + "tiny";
+  ASSERT_EQ(0, got.compare(want));
+
+  //a shared buffer is let go of once it is sent
+  w.clear(expected - 4);
+  ASSERT_TRUE(watch.expired());
+  w.clear(4);
+  ASSERT_EQ((size_t)0, w.size());
+
+}
+
+TEST(BufferedWriter, TestBufferedWriterGauge) {
+
+  std::atomic<int64_t> gauge(0);
+
+  {
+
+    BufferedWriter w;
+    w.write("abc", 3);
+    w.set_gauge(&gauge);
+    ASSERT_EQ(3, gauge.load());
+
+    std::string owned(BufferedWriter::MIN_SEGMENT, 'o');
+    w.write(std::move(owned));
+    ASSERT_EQ((int64_t)(3 + BufferedWriter::MIN_SEGMENT), gauge.load());
+
+    w.clear(2);
+    ASSERT_EQ((int64_t)(1 + BufferedWriter::MIN_SEGMENT), gauge.load());
+
+    //moving a writer moves what it holds on the gauge
+    BufferedWriter moved(std::move(w));
+    ASSERT_EQ((size_t)0, w.size());
+    ASSERT_EQ((size_t)(1 + BufferedWriter::MIN_SEGMENT), moved.size());
+    ASSERT_EQ((int64_t)(1 + BufferedWriter::MIN_SEGMENT), gauge.load());
+
+  }
+
+  //and what is never sent comes off when the writer goes
+  ASSERT_EQ(0, gauge.load());
+
+}
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+#include "ring_queue.hpp"
+#include <thread>
+#include <vector>
+
+using namespace asutils;
+
+TEST(RingQueue, TestCapacity) {
+
+  RingQueue<uint32_t> rq(5);
+
+  //capacity is rounded up to a power of two
+  ASSERT_EQ((size_t)8, rq.capacity());
+
+  for(uint32_t i=0; i < 8; i++) {
+
+    ASSERT_TRUE(rq.try_push(i));
+
+  }
+
+  ASSERT_FALSE(rq.try_push((uint32_t)8));
+
+  uint32_t v;
+  for(uint32_t i=0; i < 8; i++) {
+
+    ASSERT_TRUE(rq.try_pop(v));
+    ASSERT_EQ(i, v);
+
+  }
+
+  ASSERT_FALSE(rq.try_pop(v));
+
+}
+
+TEST(RingQueue, TestMPMC) {
+
+  RingQueue<uint64_t> rq(128);
+  std::atomic<uint64_t> sum(0);
+  std::atomic<uint32_t> popped(0);
+
+  std::vector<std::thread> threads;
+
+  for(uint32_t p=0; p < 4; p++) {
+
+    threads.emplace_back([&rq]() {
+
+      for(uint64_t i=1; i <= 10000; i++) {
+
+        while(!rq.try_push(i)) {
+
+          std::this_thread::yield();
+
+        }
+
+      }
+
+    });
+
+    threads.emplace_back([&rq, &sum, &popped]() {
+
+      uint64_t v;
+      while(popped.load() < 40000) {
+
+        if(rq.try_pop(v)) {
+
+          sum += v;
+          popped++;
+
+        } else {
+
+          std::this_thread::yield();
+
+        }
+
+      }
+
+    });
+
+  }
+
+  for(std::thread &t : threads) {
+
+    t.join();
+
+  }
+
+  ASSERT_EQ((uint64_t)(4 * (10000 * 10001 / 2)), sum.load());
+
+}
@@ -0,0 +1,257 @@
+#include "gtest/gtest.h"
+#include "socket_client.hpp"
+#include <arpa/inet.h>
+#include <future>
+#include <chrono>
+
+using namespace asutils;
+
+/**
+ * A server on a local port that takes one connection.  The test plays the
+ * server's part on sfd
+ */
+struct LocalServer {
+
+  int32_t l_sfd;
+  int32_t sfd;
+  std::string host;
+
+  LocalServer() : sfd(-1) {
+
+    this->l_sfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr;
+    bzero((char *) &addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    //the kernel picks the port
+    socklen_t a_len = sizeof(addr);
+    bind(this->l_sfd, (struct sockaddr *) &addr, a_len);
+    listen(this->l_sfd, 1);
+    getsockname(this->l_sfd, (struct sockaddr *) &addr, &a_len);
+
+    this->host = std::string("127.0.0.1:") + std::to_string(ntohs(addr.sin_port));
+
+  }
+
+  /**
+   * Takes the connection the client made
+   */
+  void accept_client() {
+
+    this->sfd = accept(this->l_sfd, NULL, NULL);
+
+  }
+
+  /**
+   * Reads one delimited frame off the connection
+   */
+  std::vector<char> read_frame() {
+
+    std::vector<char> frame;
+    char c = 0;
+    while(c != 4 && ::read(this->sfd, &c, 1) == 1) {
+
+      frame.push_back(c);
+
+    }
+
+    return frame;
+
+  }
+
+};
+
+/**
+ * The response a callback got and whether the request worked
+ */
+typedef std::pair<bool, std::vector<char>> Outcome;
+
+/**
+ * Sends msg and hands back what its callback gets.  calls counts every time
+ * the callback is called
+ */
+static std::future<Outcome> send(SocketClient &client, const std::string &msg, const uint64_t to_millis,
+    std::shared_ptr<std::atomic<uint32_t>> calls) {
+
+  std::shared_ptr<std::promise<Outcome>> outcome = std::make_shared<std::promise<Outcome>>();
+  std::string uuid_str = Utils::build_uuid_str();
+
+  bool sent = client.send_msg(msg.c_str(), msg.size(), (uint32_t)0, [outcome, calls](std::vector<char> resp, bool ok) {
+
+    if(calls->fetch_add(1) == 0) {
+
+      outcome->set_value(Outcome(ok, std::move(resp)));
+
+    }
+
+  }, uuid_str, to_millis);
+
+  EXPECT_TRUE(sent);
+
+  return outcome->get_future();
+
+}
+
+//the clients and servers are never deleted.  a client's epoll thread runs for
+//good and would be left with a dangling client, and a hang up would have it
+//close fds a later test may have been given
+
+TEST(SocketClient, TestTimeoutFailsRequest) {
+
+  LocalServer &server = *new LocalServer();
+  SocketClient *client = new SocketClient({server.host});
+  ASSERT_EQ(1, client->connect_to_hosts());
+  server.accept_client();
+
+  //the server never answers
+  std::shared_ptr<std::atomic<uint32_t>> calls = std::make_shared<std::atomic<uint32_t>>(0);
+  std::future<Outcome> outcome = send(*client, "apples", 20, calls);
+
+  ASSERT_EQ(std::future_status::ready, outcome.wait_for(std::chrono::seconds(5)));
+  Outcome got = outcome.get();
+  ASSERT_FALSE(got.first);
+  ASSERT_TRUE(got.second.empty());
+
+  //and the blocking send says so
+  std::vector<char> result;
+  std::string msg = "pears";
+  ASSERT_FALSE(client->send_msg(msg.c_str(), msg.size(), (uint32_t)0, result, 20));
+
+}
+
+TEST(SocketClient, TestResponseCancelsTimeout) {
+
+  LocalServer &server = *new LocalServer();
+  SocketClient *client = new SocketClient({server.host});
+  ASSERT_EQ(1, client->connect_to_hosts());
+  server.accept_client();
+
+  std::shared_ptr<std::atomic<uint32_t>> calls = std::make_shared<std::atomic<uint32_t>>(0);
+  std::future<Outcome> outcome = send(*client, "apples", 200, calls);
+
+  //answer with the same uuid and message
+  std::vector<char> frame = server.read_frame();
+  ASSERT_EQ(37 + 6 + 1, frame.size());
+  ASSERT_EQ((ssize_t)frame.size(), write(server.sfd, frame.data(), frame.size()));
+
+  ASSERT_EQ(std::future_status::ready, outcome.wait_for(std::chrono::seconds(5)));
+  Outcome got = outcome.get();
+  ASSERT_TRUE(got.first);
+  ASSERT_EQ("apples", std::string(got.second.begin(), got.second.end()));
+
+  //the timer was called off so the callback isn't called again once it's up
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  ASSERT_EQ(1, calls->load());
+
+}
+
+TEST(SocketClient, TestCloseFailsPending) {
+
+  LocalServer &server = *new LocalServer();
+  SocketClient *client = new SocketClient({server.host});
+  ASSERT_EQ(1, client->connect_to_hosts());
+  server.accept_client();
+
+  //no timer, only the close can end these
+  std::shared_ptr<std::atomic<uint32_t>> calls = std::make_shared<std::atomic<uint32_t>>(0);
+  std::shared_ptr<std::atomic<uint32_t>> o_calls = std::make_shared<std::atomic<uint32_t>>(0);
+  std::future<Outcome> outcome = send(*client, "apples", 0, calls);
+  std::future<Outcome> other = send(*client, "pears", 0, o_calls);
+
+  //the client reads to the end of the stream and gives up on the connection
+  server.read_frame();
+  shutdown(server.sfd, SHUT_WR);
+
+  ASSERT_EQ(std::future_status::ready, outcome.wait_for(std::chrono::seconds(5)));
+  ASSERT_EQ(std::future_status::ready, other.wait_for(std::chrono::seconds(5)));
+  ASSERT_FALSE(outcome.get().first);
+  ASSERT_FALSE(other.get().first);
+  ASSERT_EQ(1, calls->load());
+  ASSERT_EQ(1, o_calls->load());
+
+}
+
+TEST(SocketClient, TestHighLowWater) {
+
+  LocalServer &server = *new LocalServer();
+  size_t high = 8 << 20;
+  size_t low = 2 << 20;
+  SocketUtils::Limits limits(16 << 20, 64 << 10, 0, 0, high, low);
+  SocketClient *client = new SocketClient({server.host}, BufferedReader::DELIMITED, limits);
+  ASSERT_EQ(1, client->connect_to_hosts());
+  server.accept_client();
+
+  std::string msg(256 << 10, 'a');
+  std::string uuid_str = Utils::build_uuid_str();
+  std::function<void(std::vector<char>, bool)> ignore = [](std::vector<char>, bool) {};
+
+  //the server doesn't read so the sends pile up until one is turned away
+  uint32_t sent = 0;
+  while(sent < 1000 && client->send_msg(msg.c_str(), msg.size(), (uint32_t)0, ignore, uuid_str)) {
+
+    sent++;
+
+  }
+  ASSERT_LT(sent, 1000);
+
+  //read until the writer is well under the high water but not at the low water yet
+  std::vector<char> chunk(64 << 10);
+  while(client->buffered_bytes() > high - (2 << 20)) {
+
+    ASSERT_GT(::read(server.sfd, chunk.data(), chunk.size()), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  }
+  ASSERT_GT(client->buffered_bytes(), low + (2 << 20));
+  ASSERT_FALSE(client->send_msg(msg.c_str(), msg.size(), (uint32_t)0, ignore, uuid_str));
+
+  //back down to the low water it takes frames again
+  while(client->buffered_bytes() > low) {
+
+    ASSERT_GT(::read(server.sfd, chunk.data(), chunk.size()), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  }
+  ASSERT_TRUE(client->send_msg(msg.c_str(), msg.size(), (uint32_t)0, ignore, uuid_str));
+
+}
+
+TEST(SocketClient, TestSendCounters) {
+
+  LocalServer &server = *new LocalServer();
+  SocketClient *client = new SocketClient({server.host});
+  ASSERT_EQ(1, client->connect_to_hosts());
+  server.accept_client();
+
+  std::string msg = "apples";
+  std::string uuid_str = Utils::build_uuid_str();
+  std::function<void(std::vector<char>, bool)> ignore = [](std::vector<char>, bool) {};
+
+  for(uint32_t i=0; i < 10; i++) {
+
+    ASSERT_TRUE(client->send_msg(msg.c_str(), msg.size(), (uint32_t)0, ignore, uuid_str));
+
+  }
+
+  //every frame makes it to the server
+  for(uint32_t i=0; i < 10; i++) {
+
+    ASSERT_EQ(37 + 6 + 1, server.read_frame().size());
+
+  }
+
+  //and went out in at least one send but no more than one each.  the send is
+  //counted once it returns, which can be after the server has the bytes
+  ASSERT_EQ(10, client->frames_queued());
+  for(uint32_t i=0; i < 1000 && client->send_calls() == 0; i++) {
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  }
+  ASSERT_GE(client->send_calls(), 1);
+  ASSERT_LE(client->send_calls(), 10);
+
+}
@@ -36,3 +36,357 @@ TEST(SocketUtils, TestMsgPackUnpack) {
   }
 
 }
+
+TEST(SocketUtils, TestMsgUnpackView) {
+
+  std::string uuid_str = Utils::build_uuid_str();
+
+  std::string msg_s = "I really love apples";
+
+  uint32_t mfs = 37+msg_s.size()+1;
+  char msg_frame[mfs];
+
+  SocketUtils::pack_frame(uuid_str.c_str(), msg_s.c_str(), msg_s.size(), msg_frame);
+
+  const char *msg = NULL;
+  size_t msg_size = 0;
+
+  //the BufferedReader hands us the frame without the del
+  ASSERT_TRUE(SocketUtils::unpack_frame(msg_frame, mfs - 1, msg, msg_size));
+  ASSERT_EQ(msg_frame + 37, msg);
+  ASSERT_EQ(0, msg_s.compare(std::string(msg, msg_size)));
+
+  //too short to hold a uuid
+  ASSERT_FALSE(SocketUtils::unpack_frame(msg_frame, 36, msg, msg_size));
+
+}
+
+TEST(SocketUtils, TestMsgPackUnpackPrefixed) {
+
+  std::string uuid_str = Utils::build_uuid_str();
+
+  //a binary message with the del in it
+  std::string msg_s("I really\4love\0apples", 20);
+
+  size_t mfs = SocketUtils::frame_size(BufferedReader::LENGTH_PREFIXED, msg_s.size());
+  ASSERT_EQ(BufferedReader::PREFIX_SIZE + 37 + msg_s.size(), mfs);
+
+  std::vector<char> msg_frame(mfs);
+  SocketUtils::pack_frame(BufferedReader::LENGTH_PREFIXED, uuid_str.c_str(), msg_s.c_str(), msg_s.size(), &msg_frame[0]);
+
+  std::vector<char> uuid_v;
+  std::vector<char> msg_v;
+
+  SocketUtils::unpack_frame(BufferedReader::LENGTH_PREFIXED, &msg_frame[0], mfs, uuid_v, msg_v);
+
+  ASSERT_EQ((size_t)37, uuid_v.size());
+  ASSERT_EQ(0, uuid_str.compare(0, 36, &uuid_v[0], 36));
+  ASSERT_EQ(0, msg_s.compare(std::string(msg_v.begin(), msg_v.end())));
+
+  //and the reader finds the same message
+  std::string got;
+  BufferedReader br(BufferedReader::LENGTH_PREFIXED, (char) 4, [&got](const char *frame, size_t size) {
+
+    const char *msg;
+    size_t msg_size;
+    ASSERT_TRUE(SocketUtils::unpack_frame(frame, size, msg, msg_size));
+    got.assign(msg, msg_size);
+
+  });
+  br.read(&msg_frame[0], mfs);
+
+  ASSERT_EQ(0, msg_s.compare(got));
+
+}
+
+TEST(SocketUtils, TestReadFromSfd) {
+
+  int32_t sv[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  SocketUtils::unblock_socket(sv[0]);
+
+  int32_t ep_sfd = epoll_create1(0);
+  struct epoll_event e_event;
+  e_event.data.fd = sv[0];
+  e_event.events = EPOLLIN;
+  ASSERT_EQ(0, epoll_ctl(ep_sfd, EPOLL_CTL_ADD, sv[0], &e_event));
+
+  std::vector<std::string> frames;
+  BufferedReader br('\n', [&frames](const char *frame, size_t size) { frames.emplace_back(frame, size); });
+
+  //more than one read worth so the reader has to grow and keep a partial frame
+  std::string big(100000, 'x');
+  std::string data = "abc\n" + big + "\ndef\n";
+  ASSERT_EQ((ssize_t)data.size(), write(sv[1], data.c_str(), data.size()));
+
+  bool closed = false;
+  std::unordered_map<int32_t, int32_t> sfd_events;
+  std::mutex e_mutex;
+
+  SocketUtils::read_from_sfd(ep_sfd, sv[0], br, [&closed]() { closed = true; }, sfd_events, e_mutex);
+
+  ASSERT_FALSE(closed);
+  ASSERT_EQ((size_t)3, frames.size());
+  ASSERT_EQ(0, frames[0].compare("abc"));
+  ASSERT_EQ(0, frames[1].compare(big));
+  ASSERT_EQ(0, frames[2].compare("def"));
+
+  //the peer going away is noticed
+  close(sv[1]);
+  SocketUtils::read_from_sfd(ep_sfd, sv[0], br, [&closed]() { closed = true; }, sfd_events, e_mutex);
+  ASSERT_TRUE(closed);
+
+  close(sv[0]);
+  close(ep_sfd);
+
+}
+
+TEST(SocketUtils, TestWriteToSfd) {
+
+  int32_t sv[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  SocketUtils::unblock_socket(sv[0]);
+
+  int32_t ep_sfd = epoll_create1(0);
+  struct epoll_event e_event;
+  e_event.data.fd = sv[0];
+  e_event.events = EPOLLIN;
+  ASSERT_EQ(0, epoll_ctl(ep_sfd, EPOLL_CTL_ADD, sv[0], &e_event));
+
+  //more than the socket buffer so the writer is left partly drained
+  std::string data;
+  for(size_t i=0; i < 4 << 20; i++) {
+
+    data.push_back((char)('a' + i % 26));
+
+  }
+
+  BufferedWriter bw;
+  bw.write(data.c_str(), data.size());
+
+  bool closed = false;
+  std::unordered_map<int32_t, int32_t> sfd_events;
+  sfd_events[sv[0]] = EPOLLIN;
+  std::mutex e_mutex;
+
+  std::string got;
+  std::vector<char> buffer(1 << 16);
+  while(bw.size() > 0) {
+
+    SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex);
+    ASSERT_FALSE(closed);
+
+    if(bw.size() > 0) {
+
+      //the socket filled up so we got told to wait for EPOLLOUT
+      ASSERT_TRUE(sfd_events[sv[0]] & EPOLLOUT);
+
+    }
+
+    ssize_t r = read(sv[1], &buffer[0], buffer.size());
+    ASSERT_TRUE(r > 0);
+    got.append(&buffer[0], r);
+
+  }
+
+  while(got.size() < data.size()) {
+
+    ssize_t r = read(sv[1], &buffer[0], buffer.size());
+    ASSERT_TRUE(r > 0);
+    got.append(&buffer[0], r);
+
+  }
+
+  ASSERT_EQ(0, got.compare(data));
+
+  close(sv[0]);
+  close(sv[1]);
+  close(ep_sfd);
+
+}
+
+TEST(SocketUtils, TestPackHeaderTrailer) {
+
+  std::string uuid_str = Utils::build_uuid_str();
+  std::string msg = "I really love apples";
+
+  for(BufferedReader::Framing framing : {BufferedReader::DELIMITED, BufferedReader::LENGTH_PREFIXED}) {
+
+    std::vector<char> frame(SocketUtils::frame_size(framing, msg.size()));
+    SocketUtils::pack_frame(framing, uuid_str.c_str(), msg.c_str(), msg.size(), &frame[0]);
+
+    //header, message and trailer put together are the frame
+    char edges[SocketUtils::MAX_HEADER + 1];
+    size_t h_size = SocketUtils::pack_header(framing, uuid_str.c_str(), msg.size(), edges);
+    size_t t_size = SocketUtils::pack_trailer(framing, edges + h_size);
+
+    std::string pieces = std::string(edges, h_size) + msg + std::string(edges + h_size, t_size);
+    ASSERT_EQ(0, pieces.compare(std::string(frame.begin(), frame.end())));
+
+  }
+
+}
+
+TEST(SocketUtils, TestFitsFrame) {
+
+  //the prefix counts the uuid too so the biggest message is 37 short of it
+  ASSERT_TRUE(SocketUtils::fits_frame(BufferedReader::LENGTH_PREFIXED, 0));
+  ASSERT_TRUE(SocketUtils::fits_frame(BufferedReader::LENGTH_PREFIXED, UINT32_MAX - 37));
+  ASSERT_FALSE(SocketUtils::fits_frame(BufferedReader::LENGTH_PREFIXED, UINT32_MAX - 36));
+  ASSERT_FALSE(SocketUtils::fits_frame(BufferedReader::LENGTH_PREFIXED, (size_t)UINT32_MAX + 1));
+
+  //nothing counts a delimited frame
+  ASSERT_TRUE(SocketUtils::fits_frame(BufferedReader::DELIMITED, (size_t)UINT32_MAX + 1));
+
+}
+
+TEST(SocketUtils, TestWriteToSfdCoalesce) {
+
+  int32_t sv[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  SocketUtils::unblock_socket(sv[0]);
+  SocketUtils::unblock_socket(sv[1]);
+
+  int32_t ep_sfd = epoll_create1(0);
+  struct epoll_event e_event;
+  e_event.data.fd = sv[0];
+  e_event.events = EPOLLIN;
+  ASSERT_EQ(0, epoll_ctl(ep_sfd, EPOLL_CTL_ADD, sv[0], &e_event));
+
+  bool closed = false;
+  std::unordered_map<int32_t, int32_t> sfd_events;
+  sfd_events[sv[0]] = EPOLLIN;
+  std::mutex e_mutex;
+  std::atomic<uint64_t> sends(0);
+  char buffer[64];
+
+  //a small young writer waits for more without epoll waking us for it
+  SocketUtils::Limits limits(16 << 20, 64 << 10, 1024, 60000000);
+  BufferedWriter bw;
+  bw.write("abc", 3);
+  sfd_events[sv[0]] |= EPOLLOUT;
+  uint64_t hold = SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex, limits, &sends);
+
+  ASSERT_TRUE(hold > 0);
+  ASSERT_TRUE(hold <= limits.flush_micros);
+  ASSERT_EQ((size_t)3, bw.size());
+  ASSERT_EQ((uint64_t)0, sends.load());
+  ASSERT_FALSE(sfd_events[sv[0]] & EPOLLOUT);
+  ASSERT_TRUE(read(sv[1], buffer, sizeof(buffer)) < 0);
+
+  //and everything queued meanwhile goes out with one send once it's old enough
+  bw.write("def", 3);
+  limits.flush_micros = 0;
+  hold = SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex, limits, &sends);
+  ASSERT_EQ((uint64_t)0, hold);
+
+  ASSERT_FALSE(closed);
+  ASSERT_EQ((size_t)0, bw.size());
+  ASSERT_EQ((uint64_t)1, sends.load());
+  ASSERT_EQ(6, read(sv[1], buffer, sizeof(buffer)));
+  ASSERT_EQ(0, std::string(buffer, 6).compare("abcdef"));
+
+  //or when it holds enough
+  limits.flush_micros = 60000000;
+  std::string big(2048, 'x');
+  bw.write(big.c_str(), big.size());
+  hold = SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex, limits, &sends);
+  ASSERT_EQ((uint64_t)0, hold);
+  ASSERT_EQ((size_t)0, bw.size());
+  ASSERT_EQ((uint64_t)2, sends.load());
+  ASSERT_EQ(2048, read(sv[1], &big[0], big.size()));
+
+  //a corked writer that goes out while frames are still coming needs a flush
+  bool corked = false;
+  bw.write(big.c_str(), big.size());
+  hold = SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex, limits, &sends, &corked);
+  ASSERT_TRUE(hold > 0);
+  ASSERT_TRUE(corked);
+  ASSERT_EQ((size_t)0, bw.size());
+
+  //which takes the cork off even with nothing left to send
+  hold = SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex, limits, &sends, &corked);
+  ASSERT_EQ((uint64_t)0, hold);
+  ASSERT_FALSE(corked);
+  ASSERT_EQ((uint64_t)3, sends.load());
+
+  close(sv[0]);
+  close(sv[1]);
+  close(ep_sfd);
+
+}
+
+TEST(SocketUtils, TestWriteToSfdFile) {
+
+  int32_t sv[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  SocketUtils::unblock_socket(sv[0]);
+
+  int32_t ep_sfd = epoll_create1(0);
+  struct epoll_event e_event;
+  e_event.data.fd = sv[0];
+  e_event.events = EPOLLIN;
+  ASSERT_EQ(0, epoll_ctl(ep_sfd, EPOLL_CTL_ADD, sv[0], &e_event));
+
+  //a file bigger than the socket buffer
+  std::string body;
+  for(size_t i=0; i < 1 << 20; i++) {
+
+    body.push_back((char)('a' + i % 26));
+
+  }
+
+  char path[] = "/tmp/socket_utils_testXXXXXX";
+  int32_t fd = mkstemp(path);
+  ASSERT_TRUE(fd >= 0);
+  unlink(path);
+  ASSERT_EQ((ssize_t)body.size(), write(fd, body.c_str(), body.size()));
+
+  //the file goes between the header and trailer from the middle of the file
+  bool released = false;
+  std::shared_ptr<const void> keep(new int32_t(fd), [&released](const int32_t *f_fd) {
+
+    released = true;
+    delete f_fd;
+
+  });
+
+  BufferedWriter bw;
+  bw.write("head", 4);
+  bw.write_file(fd, 10, body.size() - 10, keep);
+  bw.write("tail", 4);
+  keep.reset();
+
+  //the iovecs stop at the file
+  struct iovec iov[4];
+  ASSERT_EQ((size_t)1, bw.peek(iov, 4));
+
+  bool closed = false;
+  std::unordered_map<int32_t, int32_t> sfd_events;
+  sfd_events[sv[0]] = EPOLLIN;
+  std::mutex e_mutex;
+
+  std::string expected = "head" + body.substr(10) + "tail";
+  std::string got;
+  std::vector<char> buffer(1 << 16);
+  while(got.size() < expected.size()) {
+
+    SocketUtils::write_to_sfd(ep_sfd, sv[0], bw, [&closed]() { closed = true; }, sfd_events, e_mutex);
+    ASSERT_FALSE(closed);
+
+    ssize_t r = read(sv[1], &buffer[0], buffer.size());
+    ASSERT_TRUE(r > 0);
+    got.append(&buffer[0], r);
+
+  }
+
+  ASSERT_EQ(0, got.compare(expected));
+  ASSERT_EQ((size_t)0, bw.size());
+  ASSERT_TRUE(released);
+
+  close(fd);
+  close(sv[0]);
+  close(sv[1]);
+  close(ep_sfd);
+
+}
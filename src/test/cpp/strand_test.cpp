@@ -0,0 +1,155 @@
+#include "gtest/gtest.h"
+#include "strand.hpp"
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+using namespace asutils;
+
+TEST(Strand, TestInOrder) {
+
+  std::vector<uint32_t> order;
+
+  {
+
+    ThreadPool tp(4, ThreadPool::STEALING);
+    std::shared_ptr<Strand> strand = std::make_shared<Strand>(tp);
+
+    //more than a RUN_BATCH so the strand has to requeue itself
+    for(uint32_t i=0; i < 1000; i++) {
+
+      strand->post([&order, i]() { order.push_back(i); });
+
+    }
+
+  }
+
+  ASSERT_EQ((size_t)1000, order.size());
+  for(uint32_t i=0; i < 1000; i++) {
+
+    ASSERT_EQ(i, order[i]);
+
+  }
+
+}
+
+TEST(Strand, TestNeverConcurrent) {
+
+  const uint32_t n_strands = 8;
+  std::vector<std::atomic<uint32_t>> inside(n_strands);
+  std::vector<uint32_t> counts(n_strands, 0);
+  std::atomic<uint32_t> overlaps(0);
+
+  for(std::atomic<uint32_t> &in : inside) {
+
+    in = 0;
+
+  }
+
+  {
+
+    ThreadPool tp(4);
+    std::vector<std::shared_ptr<Strand>> strands;
+    for(uint32_t s=0; s < n_strands; s++) {
+
+      strands.push_back(std::make_shared<Strand>(tp));
+
+    }
+
+    std::vector<Task> batch;
+    for(uint32_t i=0; i < 4000; i++) {
+
+      uint32_t s = i % n_strands;
+      Task run = strands[s]->enqueue(Task([&inside, &counts, &overlaps, s]() {
+
+        if(inside[s].fetch_add(1) != 0) {
+
+          overlaps++;
+
+        }
+
+        //not atomic on purpose, the strand is the only guard
+        counts[s]++;
+        std::this_thread::yield();
+        inside[s].fetch_sub(1);
+
+      }));
+
+      //the strands that were idle get handed to the pool in batches
+      if(run) {
+
+        batch.push_back(std::move(run));
+
+      }
+
+      if(batch.size() == 8) {
+
+        tp.add_work_batch(batch.begin(), batch.end());
+        batch.clear();
+
+      }
+
+    }
+
+    tp.add_work_batch(batch.begin(), batch.end());
+
+  }
+
+  ASSERT_EQ((uint32_t)0, overlaps.load());
+  for(uint32_t c : counts) {
+
+    ASSERT_EQ((uint32_t)500, c);
+
+  }
+
+}
+
+TEST(Strand, TestDroppedRunner) {
+
+  std::vector<uint32_t> order;
+
+  {
+
+    ThreadPool tp(2);
+    std::shared_ptr<Strand> strand = std::make_shared<Strand>(tp);
+
+    //a runner the pool turned away is dropped, the strand must not wait on it
+    Task run = strand->enqueue(Task([&order]() { order.push_back(0); }));
+    ASSERT_TRUE((bool)run);
+    run = Task();
+
+    run = strand->enqueue(Task([&order]() { order.push_back(1); }));
+    ASSERT_TRUE((bool)run);
+    run();
+
+  }
+
+  ASSERT_EQ((size_t)2, order.size());
+  ASSERT_EQ((uint32_t)0, order[0]);
+  ASSERT_EQ((uint32_t)1, order[1]);
+
+}
+
+TEST(Strand, TestThrowingTask) {
+
+  std::vector<uint32_t> order;
+
+  {
+
+    //the tasks run on the pool's workers, which would terminate on a throw
+    ThreadPool tp(2);
+    std::shared_ptr<Strand> strand = std::make_shared<Strand>(tp);
+
+    strand->post([&order]() { order.push_back(0); });
+    strand->post([]() { throw std::runtime_error("boom"); });
+    strand->post([&order]() { order.push_back(1); });
+    strand->post([]() { throw 42; });
+    strand->post([&order]() { order.push_back(2); });
+
+  }
+
+  //the tasks behind the throwing ones still ran, in order
+  ASSERT_EQ(std::vector<uint32_t>({0, 1, 2}), order);
+
+}
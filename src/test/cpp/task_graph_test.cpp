@@ -0,0 +1,120 @@
+#include "gtest/gtest.h"
+#include "task_graph.hpp"
+#include <atomic>
+#include <stdexcept>
+
+using namespace asutils;
+
+TEST(TaskGraph, TestDiamond) {
+
+  ThreadPool tp(4, ThreadPool::STEALING);
+  TaskGraph graph(tp);
+
+  std::atomic<uint32_t> a(0);
+  std::atomic<uint32_t> b(0);
+  std::atomic<uint32_t> c(0);
+  uint32_t d = 0;
+
+  size_t na = graph.add([&a]() { a = 1; });
+  size_t nb = graph.add([&a, &b]() { b = a + 1; }, {na});
+  size_t nc = graph.add([&a, &c]() { c = a + 2; }, {na});
+  graph.add([&b, &c, &d]() { d = b + c; }, {nb, nc});
+
+  ASSERT_EQ((size_t)4, graph.size());
+  ASSERT_TRUE(graph.run().get());
+  ASSERT_EQ((uint32_t)5, d);
+
+}
+
+TEST(TaskGraph, TestFanOut) {
+
+  ThreadPool tp(4, ThreadPool::STEALING);
+  TaskGraph graph(tp);
+
+  std::vector<uint64_t> partials(1000, 0);
+  std::vector<size_t> stage;
+  uint64_t total = 0;
+
+  for(size_t i=0; i < partials.size(); i++) {
+
+    stage.push_back(graph.add([&partials, i]() { partials[i] = i; }));
+
+  }
+
+  graph.add([&partials, &total]() {
+
+    for(uint64_t p : partials) {
+
+      total += p;
+
+    }
+
+  }, stage);
+
+  ASSERT_TRUE(graph.run().get());
+  ASSERT_EQ((uint64_t)(999 * 1000 / 2), total);
+
+}
+
+TEST(TaskGraph, TestCancel) {
+
+  ThreadPool tp(2);
+  TaskGraph graph(tp);
+
+  std::atomic<uint32_t> count(0);
+
+  size_t first = graph.add([&graph, &count]() {
+
+    count++;
+    graph.cancel();
+
+  });
+  graph.add([&count]() { count++; }, {first});
+
+  ASSERT_FALSE(graph.run().get());
+  ASSERT_TRUE(graph.is_cancelled());
+  ASSERT_EQ((uint32_t)1, count.load());
+
+}
+
+TEST(TaskGraph, TestException) {
+
+  ThreadPool tp(2);
+  TaskGraph graph(tp);
+
+  std::atomic<uint32_t> count(0);
+
+  size_t first = graph.add([]() { throw std::runtime_error("boom"); });
+  graph.add([&count]() { count++; }, {first});
+
+  std::future<bool> result = graph.run();
+  ASSERT_THROW(result.get(), std::runtime_error);
+  ASSERT_EQ((uint32_t)0, count.load());
+
+}
+
+TEST(TaskGraph, TestInvalid) {
+
+  ThreadPool tp(2);
+  TaskGraph graph(tp);
+
+  //dependencies have to exist already so there are no cycles
+  ASSERT_EQ(TaskGraph::INVALID, graph.add([]() {}, {0}));
+
+  graph.add([]() {});
+  ASSERT_TRUE(graph.run().get());
+
+  //a graph runs once
+  ASSERT_EQ(TaskGraph::INVALID, graph.add([]() {}));
+  ASSERT_FALSE(graph.run().valid());
+
+}
+
+TEST(TaskGraph, TestEmpty) {
+
+  ThreadPool tp(2);
+  TaskGraph graph(tp);
+
+  ASSERT_TRUE(graph.run().get());
+
+}
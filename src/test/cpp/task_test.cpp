@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+#include "task.hpp"
+#include <memory>
+#include <array>
+
+using namespace asutils;
+
+TEST(Task, TestInline) {
+
+  uint32_t count = 0;
+  uint64_t a = 1, b = 2;
+
+  auto small = [&count, a, b]() { count += a + b; };
+  ASSERT_TRUE(Task::fits_inline<decltype(small)>::value);
+
+  Task t(small);
+  ASSERT_TRUE((bool)t);
+
+  //moving hands over the callable and empties the source
+  Task m(std::move(t));
+  ASSERT_FALSE((bool)t);
+
+  m();
+  ASSERT_EQ((uint32_t)3, count);
+
+}
+
+TEST(Task, TestHeap) {
+
+  uint32_t count = 0;
+  std::array<uint64_t, 16> big;
+  big.fill(1);
+
+  auto large = [&count, big]() { count += big.size(); };
+  ASSERT_FALSE(Task::fits_inline<decltype(large)>::value);
+
+  Task t(large);
+  Task m;
+  m = std::move(t);
+  m();
+
+  ASSERT_EQ((uint32_t)16, count);
+
+}
+
+TEST(Task, TestMoveOnlyCapture) {
+
+  std::shared_ptr<uint32_t> alive(new uint32_t(7));
+  std::unique_ptr<uint32_t> owned(new uint32_t(5));
+  uint32_t result = 0;
+
+  {
+
+    Task t([&result, alive, o = std::move(owned)]() { result = *o + *alive; });
+    ASSERT_EQ(2, alive.use_count());
+
+    t();
+
+  }
+
+  //the capture is destroyed with the task
+  ASSERT_EQ((uint32_t)12, result);
+  ASSERT_EQ(1, alive.use_count());
+
+}
@@ -2,6 +2,10 @@
 #include "thread_pool.hpp"
 #include <stdlib.h>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <stdexcept>
 
 using namespace asutils;
 
@@ -35,3 +39,642 @@ TEST(ThreadPool, TestParallel) {
 
 }
 
+TEST(ThreadPool, TestSharedRunsAll) {
+
+  std::atomic<uint32_t> count(0);
+
+  {
+
+    ThreadPool tp(4);
+
+    for(uint32_t i=0; i < 10000; i++) {
+
+      tp.add_work([&count]() { count++; });
+
+    }
+
+    //the destructor drains the queue before returning
+  }
+
+  ASSERT_EQ((uint32_t)10000, count.load());
+
+}
+
+TEST(ThreadPool, TestStealingRunsAll) {
+
+  std::atomic<uint32_t> count(0);
+
+  {
+
+    ThreadPool tp(4, ThreadPool::STEALING);
+
+    for(uint32_t i=0; i < 10000; i++) {
+
+      tp.add_work([&count]() { count++; });
+
+    }
+
+  }
+
+  ASSERT_EQ((uint32_t)10000, count.load());
+
+}
+
+TEST(ThreadPool, TestStealingNested) {
+
+  std::atomic<uint32_t> count(0);
+
+  {
+
+    ThreadPool tp(4, ThreadPool::STEALING);
+
+    for(uint32_t i=0; i < 100; i++) {
+
+      //work added from inside a worker lands on its own deque and gets stolen
+      tp.add_work([&count, &tp]() {
+
+        for(uint32_t j=0; j < 100; j++) {
+
+          tp.add_work([&count]() { count++; });
+
+        }
+
+      });
+
+    }
+
+    //give the outer work a chance to run before we start shutting down
+    while(count.load() < 10000) {
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    }
+
+  }
+
+  ASSERT_EQ((uint32_t)10000, count.load());
+
+}
+
+TEST(ThreadPool, TestStealingOrder) {
+
+  std::mutex o_mutex;
+  std::vector<uint32_t> order;
+  auto record = [&o_mutex, &order](uint32_t i) {
+
+    std::lock_guard<std::mutex> lck(o_mutex);
+    order.push_back(i);
+
+  };
+
+  {
+
+    //a lone worker works its own deque newest first
+    ThreadPool tp(1, ThreadPool::STEALING);
+    tp.post([&tp, &record]() {
+
+      for(uint32_t i=0; i < 3; i++) {
+
+        tp.post([&record, i]() { record(i); });
+
+      }
+
+    });
+
+  }
+
+  ASSERT_EQ(std::vector<uint32_t>({2, 1, 0}), order);
+  order.clear();
+
+  {
+
+    //while its owner is busy a thief takes the oldest first
+    ThreadPool tp(2, ThreadPool::STEALING);
+    std::atomic<uint32_t> ran(0);
+    tp.post([&tp, &record, &ran]() {
+
+      for(uint32_t i=0; i < 3; i++) {
+
+        tp.post([&record, &ran, i]() { record(i); ran++; });
+
+      }
+
+      for(uint32_t i=0; i < 5000 && ran.load() < 3; i++) {
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      }
+
+    });
+
+  }
+
+  ASSERT_EQ(std::vector<uint32_t>({0, 1, 2}), order);
+
+}
+
+TEST(ThreadPool, TestStealingDrainsInject) {
+
+  std::atomic<uint32_t> count(0);
+  std::atomic<bool> release(false);
+
+  {
+
+    ThreadPool tp(4, ThreadPool::STEALING);
+
+    //hold every worker so the outside work piles up in the shared queue, then
+    //let them share it out
+    for(uint32_t i=0; i < 4; i++) {
+
+      tp.post([&release]() {
+
+        while(!release.load()) {
+
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        }
+
+      });
+
+    }
+
+    for(uint32_t i=0; i < 10000; i++) {
+
+      tp.post([&count]() { count++; });
+
+    }
+
+    release = true;
+
+  }
+
+  ASSERT_EQ((uint32_t)10000, count.load());
+
+}
+
+TEST(ThreadPool, TestRingRunsAll) {
+
+  std::atomic<uint32_t> count(0);
+
+  {
+
+    ThreadPool::Config config(4);
+    config.backend = ThreadPool::RING;
+    config.capacity = 64;
+    ThreadPool tp(config);
+
+    std::vector<std::thread> producers;
+    for(uint32_t p=0; p < 4; p++) {
+
+      producers.emplace_back([&count, &tp]() {
+
+        for(uint32_t i=0; i < 10000; i++) {
+
+          tp.add_work([&count]() { count++; });
+
+        }
+
+      });
+
+    }
+
+    for(std::thread &t : producers) {
+
+      t.join();
+
+    }
+
+  }
+
+  ASSERT_EQ((uint32_t)40000, count.load());
+
+}
+
+TEST(ThreadPool, TestPostMoveOnly) {
+
+  std::atomic<uint32_t> count(0);
+
+  {
+
+    ThreadPool tp(2);
+
+    for(uint32_t i=0; i < 1000; i++) {
+
+      std::unique_ptr<uint32_t> v(new uint32_t(i));
+      tp.post([&count, v = std::move(v)]() { count += *v; });
+
+    }
+
+  }
+
+  ASSERT_EQ((uint32_t)(999 * 1000 / 2), count.load());
+
+}
+
+TEST(ThreadPool, TestSubmitFuture) {
+
+  ThreadPool tp(2);
+
+  std::future<uint32_t> r = tp.submit([]() { return (uint32_t)42; });
+  ASSERT_EQ((uint32_t)42, r.get());
+
+  //exceptions end up in the future
+  std::future<void> e = tp.submit([]() { throw std::runtime_error("nope"); });
+  ASSERT_THROW(e.get(), std::runtime_error);
+
+}
+
+TEST(ThreadPool, TestParallelFor) {
+
+  ThreadPool tp(4);
+  std::vector<uint32_t> hits(10007, 0);
+
+  tp.parallel_for(0, hits.size(), 64, [&hits](size_t lo, size_t hi) {
+
+    for(size_t i=lo; i < hi; i++) {
+
+      hits[i]++;
+
+    }
+
+  });
+
+  //every index is visited exactly once
+  for(uint32_t h : hits) {
+
+    ASSERT_EQ((uint32_t)1, h);
+
+  }
+
+  ASSERT_THROW(tp.parallel_for(0, 100, 10, [](size_t lo, size_t hi) {
+
+    if(lo == 50) {
+
+      throw std::runtime_error("nope");
+
+    }
+
+  }), std::runtime_error);
+
+}
+
+TEST(ThreadPool, TestParallelReduce) {
+
+  ThreadPool tp(4, ThreadPool::STEALING);
+
+  uint64_t sum = tp.parallel_reduce(0, 100000, 1000, (uint64_t)0, [&tp](size_t lo, size_t hi) {
+
+    //nest a parallel_for to make sure it can't starve the pool
+    std::atomic<uint64_t> s(0);
+    tp.parallel_for(lo, hi, 100, [&s](size_t l, size_t h) {
+
+      for(size_t i=l; i < h; i++) {
+
+        s += i;
+
+      }
+
+    });
+
+    return s.load();
+
+  }, [](uint64_t a, uint64_t b) { return a + b; });
+
+  ASSERT_EQ((uint64_t)99999 * 100000 / 2, sum);
+
+}
+
+/**
+ * Builds a one worker pool with a queue of two and a worker stuck until
+ * the returned gate is opened
+ */
+static ThreadPool *build_full_pool(ThreadPool::Policy policy, std::promise<void> &gate) {
+
+  ThreadPool::Config config(1);
+  config.capacity = 2;
+  config.policy = policy;
+  config.block_to_millis = 20;
+
+  ThreadPool *tp = new ThreadPool(config);
+
+  std::shared_future<void> g = gate.get_future().share();
+  std::promise<void> started;
+  tp->post([g, &started]() { started.set_value(); g.wait(); });
+  started.get_future().wait();
+
+  //fill the queue up
+  tp->post([]() {});
+  tp->post([]() {});
+
+  return tp;
+
+}
+
+TEST(ThreadPool, TestPolicyReject) {
+
+  std::promise<void> gate;
+  ThreadPool *tp = build_full_pool(ThreadPool::REJECT, gate);
+
+  ASSERT_FALSE(tp->post([]() {}));
+  ASSERT_EQ((uint64_t)1, tp->get_stats().rejected);
+
+  gate.set_value();
+  delete tp;
+
+}
+
+TEST(ThreadPool, TestPolicyBlockTimeout) {
+
+  std::promise<void> gate;
+  ThreadPool *tp = build_full_pool(ThreadPool::BLOCK_TIMEOUT, gate);
+
+  ASSERT_FALSE(tp->post([]() {}));
+
+  ThreadPool::Stats stats = tp->get_stats();
+  ASSERT_EQ((uint64_t)1, stats.rejected);
+  ASSERT_LE((uint64_t)20000, stats.blocked_micros);
+
+  gate.set_value();
+  delete tp;
+
+}
+
+TEST(ThreadPool, TestPolicyCallerRuns) {
+
+  std::promise<void> gate;
+  ThreadPool *tp = build_full_pool(ThreadPool::CALLER_RUNS, gate);
+
+  std::thread::id ran_on;
+  ASSERT_TRUE(tp->post([&ran_on]() { ran_on = std::this_thread::get_id(); }));
+  ASSERT_EQ(std::this_thread::get_id(), ran_on);
+  ASSERT_EQ((uint64_t)1, tp->get_stats().caller_runs);
+
+  gate.set_value();
+  delete tp;
+
+}
+
+TEST(ThreadPool, TestPolicyDropOldest) {
+
+  std::promise<void> gate;
+  ThreadPool *tp = build_full_pool(ThreadPool::DROP_OLDEST, gate);
+
+  std::atomic<uint32_t> count(0);
+  ASSERT_TRUE(tp->post([&count]() { count++; }));
+  ASSERT_EQ((uint64_t)1, tp->get_stats().dropped);
+
+  gate.set_value();
+  delete tp;
+
+  //the newest work still ran
+  ASSERT_EQ((uint32_t)1, count.load());
+
+}
+
+TEST(ThreadPool, TestPolicyDropOldestOneForOne) {
+
+  std::vector<char> ran;
+
+  {
+
+    ThreadPool::Config config(1);
+    config.capacity = 2;
+    config.policy = ThreadPool::DROP_OLDEST;
+    ThreadPool tp(config);
+
+    std::promise<void> gate;
+    std::shared_future<void> g = gate.get_future().share();
+    std::promise<void> started;
+    tp.post([g, &started]() { started.set_value(); g.wait(); });
+    started.get_future().wait();
+
+    tp.post([&ran]() { ran.push_back('a'); });
+    tp.post([&ran]() { ran.push_back('b'); });
+
+    //every task that comes in evicts just the one in front of the queue
+    ASSERT_TRUE(tp.post([&ran]() { ran.push_back('c'); }));
+    ASSERT_TRUE(tp.post([&ran]() { ran.push_back('d'); }));
+    ASSERT_TRUE(tp.post([&ran]() { ran.push_back('e'); }));
+
+    ThreadPool::Stats stats = tp.get_stats();
+    ASSERT_EQ((uint64_t)3, stats.dropped);
+    ASSERT_EQ((uint64_t)0, stats.rejected);
+
+    gate.set_value();
+
+  }
+
+  ASSERT_EQ(std::vector<char>({'d', 'e'}), ran);
+
+}
+
+/**
+ * Blocks every worker of an elastic pool and checks it grows to max_size,
+ * then releases them and checks it shrinks back to p_size
+ */
+static void check_elastic(ThreadPool::Config config) {
+
+  config.max_size = 4;
+  config.capacity = 1024;
+  config.target_wait_micros = 1000;
+  config.idle_to_millis = 50;
+
+  ThreadPool tp(config);
+  ASSERT_EQ((uint32_t)1, tp.get_stats().threads);
+
+  std::atomic<bool> release(false);
+  for(uint32_t i=0; i < 4; i++) {
+
+    tp.post([&release]() {
+
+      while(!release.load()) {
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+      }
+
+    });
+
+  }
+
+  //keep adding a little work so the pool sees it waiting
+  for(uint32_t i=0; i < 1000 && tp.get_stats().threads < 4; i++) {
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    tp.post([]() {});
+
+  }
+
+  ASSERT_EQ((uint32_t)4, tp.get_stats().threads);
+
+  release = true;
+
+  for(uint32_t i=0; i < 1000 && tp.get_stats().threads > 1; i++) {
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+  }
+
+  ASSERT_EQ((uint32_t)1, tp.get_stats().threads);
+
+}
+
+TEST(ThreadPool, TestElasticShared) {
+
+  check_elastic(ThreadPool::Config(1));
+
+}
+
+TEST(ThreadPool, TestElasticRing) {
+
+  ThreadPool::Config config(1);
+  config.backend = ThreadPool::RING;
+  check_elastic(config);
+
+}
+
+TEST(ThreadPool, TestElasticStealing) {
+
+  check_elastic(ThreadPool::Config(1, ThreadPool::STEALING));
+
+}
+
+/**
+ * Queues LOW and HIGH work behind a stuck single worker and returns the
+ * order the lanes ran in once it is released
+ */
+static std::string run_lanes(ThreadPool::Config config) {
+
+  config.p_size = 1;
+  config.capacity = 16;
+
+  std::string order;
+
+  {
+
+    ThreadPool tp(config);
+
+    std::promise<void> gate;
+    std::shared_future<void> g = gate.get_future().share();
+    std::promise<void> started;
+    tp.post([g, &started]() { started.set_value(); g.wait(); });
+    started.get_future().wait();
+
+    for(uint32_t i=0; i < 4; i++) {
+
+      tp.post([&order]() { order.push_back('L'); }, ThreadPool::LOW);
+
+    }
+
+    for(uint32_t i=0; i < 6; i++) {
+
+      tp.post([&order]() { order.push_back('H'); });
+
+    }
+
+    ThreadPool::Stats stats = tp.get_stats();
+    EXPECT_EQ((uint64_t)6, stats.lanes[ThreadPool::HIGH].depth);
+    EXPECT_EQ((uint64_t)4, stats.lanes[ThreadPool::LOW].depth);
+
+    gate.set_value();
+
+  }
+
+  return order;
+
+}
+
+TEST(ThreadPool, TestLanesStrict) {
+
+  ASSERT_EQ("HHHHHHLLLL", run_lanes(ThreadPool::Config(1)));
+
+  ThreadPool::Config ring(1);
+  ring.backend = ThreadPool::RING;
+  ASSERT_EQ("HHHHHHLLLL", run_lanes(ring));
+
+  ASSERT_EQ("HHHHHHLLLL", run_lanes(ThreadPool::Config(1, ThreadPool::STEALING)));
+
+}
+
+TEST(ThreadPool, TestLanesWeighted) {
+
+  //the stuck task counts as the first HIGH of the streak
+  ThreadPool::Config config(1);
+  config.high_weight = 2;
+  ASSERT_EQ("HLHHLHHLHL", run_lanes(config));
+
+  config.mode = ThreadPool::STEALING;
+  ASSERT_EQ("HLHHLHHLHL", run_lanes(config));
+
+}
+
+TEST(ThreadPool, TestLaneStats) {
+
+  ThreadPool tp(2);
+
+  tp.submit([]() {}, ThreadPool::LOW).get();
+  tp.submit([]() {}).get();
+
+  ThreadPool::Stats stats = tp.get_stats();
+  ASSERT_EQ((uint64_t)1, stats.lanes[ThreadPool::LOW].taken);
+  ASSERT_EQ((uint64_t)1, stats.lanes[ThreadPool::HIGH].taken);
+  ASSERT_EQ((uint64_t)0, stats.lanes[ThreadPool::LOW].depth);
+
+}
+
+/**
+ * Adds 1000 counting tasks in one batch and checks they all ran
+ */
+static void check_batch(const ThreadPool::Config &config, const ThreadPool::Priority lane) {
+
+  std::atomic<uint32_t> count(0);
+  std::vector<std::function<void()>> work(1000, [&count]() { count++; });
+
+  {
+
+    ThreadPool tp(config);
+    ASSERT_EQ((size_t)1000, tp.add_work_batch(work.begin(), work.end(), lane));
+
+  }
+
+  ASSERT_EQ((uint32_t)1000, count.load());
+
+}
+
+TEST(ThreadPool, TestBatch) {
+
+  ThreadPool::Config ring(4);
+  ring.backend = ThreadPool::RING;
+  ring.capacity = 16;
+
+  ThreadPool::Config stealing(4, ThreadPool::STEALING);
+  stealing.capacity = 16;
+
+  //the batches are bigger than the queues so the policy takes the rest
+  check_batch(ThreadPool::Config(4), ThreadPool::HIGH);
+  check_batch(ThreadPool::Config(4), ThreadPool::LOW);
+  check_batch(ring, ThreadPool::HIGH);
+  check_batch(stealing, ThreadPool::HIGH);
+  check_batch(ThreadPool::Config(4, ThreadPool::STEALING), ThreadPool::HIGH);
+
+}
+
+TEST(ThreadPool, TestBatchReject) {
+
+  std::promise<void> gate;
+  ThreadPool *tp = build_full_pool(ThreadPool::REJECT, gate);
+
+  std::vector<Task> work;
+  for(uint32_t i=0; i < 3; i++) {
+
+    work.emplace_back([]() {});
+
+  }
+
+  ASSERT_EQ((size_t)0, tp->add_work_batch(work.begin(), work.end()));
+  ASSERT_EQ((uint64_t)3, tp->get_stats().rejected);
+
+  gate.set_value();
+  delete tp;
+
+}
@@ -0,0 +1,101 @@
+#include "gtest/gtest.h"
+#include "timer_wheel.hpp"
+#include <atomic>
+#include <chrono>
+
+using namespace asutils;
+
+/**
+ * Waits up to a second for count to reach expected
+ */
+static void wait_for(std::atomic<uint32_t> &count, const uint32_t expected) {
+
+  for(uint32_t i=0; i < 1000 && count.load() < expected; i++) {
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  }
+
+}
+
+TEST(TimerWheel, TestFires) {
+
+  ThreadPool tp(2);
+  TimerWheel timers(tp);
+
+  std::atomic<uint32_t> count(0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point fired;
+
+  timers.schedule(50, [&count, &fired]() {
+
+    fired = std::chrono::steady_clock::now();
+    count++;
+
+  });
+
+  ASSERT_EQ((size_t)1, timers.size());
+  wait_for(count, 1);
+
+  ASSERT_EQ((uint32_t)1, count.load());
+  ASSERT_EQ((size_t)0, timers.size());
+
+  //never early
+  ASSERT_LE(50, std::chrono::duration_cast<std::chrono::milliseconds>(fired - start).count());
+
+}
+
+TEST(TimerWheel, TestCancel) {
+
+  ThreadPool tp(2);
+  TimerWheel timers(tp);
+
+  std::atomic<uint32_t> count(0);
+  uint64_t id = timers.schedule(20, [&count]() { count += 100; });
+  timers.schedule(40, [&count]() { count++; });
+
+  ASSERT_TRUE(timers.cancel(id));
+  ASSERT_FALSE(timers.cancel(id));
+
+  wait_for(count, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  ASSERT_EQ((uint32_t)1, count.load());
+
+}
+
+TEST(TimerWheel, TestCascade) {
+
+  ThreadPool tp(2);
+
+  //1ms ticks push everything past 256ms into the second wheel
+  TimerWheel timers(tp, ThreadPool::LOW, 1, false);
+
+  std::atomic<uint32_t> count(0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::atomic<int64_t> late(0);
+
+  for(uint64_t d : {5, 255, 256, 300, 600}) {
+
+    timers.schedule(d, [&count, &late, start, d]() {
+
+      int64_t took = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start).count();
+
+      if(took < (int64_t)d) {
+
+        late = -1;
+
+      }
+
+      count++;
+
+    });
+
+  }
+
+  wait_for(count, 5);
+  ASSERT_EQ((uint32_t)5, count.load());
+  ASSERT_EQ(0, late.load());
+
+}